@@ -0,0 +1,177 @@
+//
+// Bitsliced AES backend for the bulk modes.
+//
+// Every bit of the state is spread over a vector of 64-bit words so that the
+// S-box becomes a fixed boolean circuit and all blocks of a batch go through
+// the cipher together, without any table lookups. This only pays off when a
+// whole batch is available, so the backend implements just CTR, XTS and CBC
+// decryption; the tails of those and everything else are left to the table
+// based code (see crypto_init()).
+//
+// The vectors are GCC vector extensions: two 64-bit lanes (8 blocks) map to
+// SSE2 or AltiVec registers, four lanes (16 blocks) to AVX2 registers.
+// Only the AVX2 width beats the T-tables; the two-lane flavour is slower
+// and only used when forced.
+//
+
+#include "crypto_backend.h"
+
+typedef uint64_t bs_vec128_t __attribute__((vector_size(16)));
+
+#if defined(CPU_X86)
+typedef uint64_t bs_vec256_t __attribute__((vector_size(32)));
+#endif
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+//
+// Spreads the 4 columns of a block over the even (lo) and odd (hi) bytes of
+// two 64-bit words, ortho then finishes the transposition
+//
+static inline void bs_interleave_in(uint64_t* const lo, uint64_t* const hi, const uint8_t* const block) {
+	const __m128i m16 = _mm_set1_epi64x(0x0000FFFF0000FFFFULL);
+	const __m128i m8 = _mm_set1_epi64x(0x00FF00FF00FF00FFULL);
+	__m128i w, x01, x23;
+
+	w = _mm_loadu_si128((const __m128i*)block);
+	x01 = _mm_unpacklo_epi32(w, _mm_setzero_si128());
+	x23 = _mm_unpackhi_epi32(w, _mm_setzero_si128());
+
+	x01 = _mm_and_si128(_mm_or_si128(x01, _mm_slli_epi64(x01, 16)), m16);
+	x23 = _mm_and_si128(_mm_or_si128(x23, _mm_slli_epi64(x23, 16)), m16);
+	x01 = _mm_and_si128(_mm_or_si128(x01, _mm_slli_epi64(x01, 8)), m8);
+	x23 = _mm_and_si128(_mm_or_si128(x23, _mm_slli_epi64(x23, 8)), m8);
+
+	w = _mm_or_si128(x01, _mm_slli_epi64(x23, 8));
+	_mm_storel_epi64((__m128i*)lo, w);
+	_mm_storel_epi64((__m128i*)hi, _mm_unpackhi_epi64(w, w));
+}
+
+static inline void bs_interleave_out(uint8_t* const block, const uint64_t lo, const uint64_t hi) {
+	const __m128i m16 = _mm_set1_epi64x(0x0000FFFF0000FFFFULL);
+	const __m128i m8 = _mm_set1_epi64x(0x00FF00FF00FF00FFULL);
+	__m128i w, x01, x23;
+
+	w = _mm_set_epi64x(hi, lo);
+	x01 = _mm_and_si128(w, m8);
+	x23 = _mm_and_si128(_mm_srli_epi64(w, 8), m8);
+
+	x01 = _mm_and_si128(_mm_or_si128(x01, _mm_srli_epi64(x01, 8)), m16);
+	x23 = _mm_and_si128(_mm_or_si128(x23, _mm_srli_epi64(x23, 8)), m16);
+	x01 = _mm_or_si128(x01, _mm_srli_epi64(x01, 16));
+	x23 = _mm_or_si128(x23, _mm_srli_epi64(x23, 16));
+
+	w = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(x01), _mm_castsi128_ps(x23), _MM_SHUFFLE(2, 0, 2, 0)));
+	_mm_storeu_si128((__m128i*)block, w);
+}
+
+#else
+
+static inline void bs_interleave_in(uint64_t* const lo, uint64_t* const hi, const uint8_t* const block) {
+	uint64_t x[4];
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		x[i] = (uint64_t)block[4 * i] | ((uint64_t)block[4 * i + 1] << 8) | ((uint64_t)block[4 * i + 2] << 16) | ((uint64_t)block[4 * i + 3] << 24);
+		x[i] |= (x[i] << 16);
+		x[i] &= 0x0000FFFF0000FFFFULL;
+		x[i] |= (x[i] << 8);
+		x[i] &= 0x00FF00FF00FF00FFULL;
+	}
+
+	*lo = x[0] | (x[2] << 8);
+	*hi = x[1] | (x[3] << 8);
+}
+
+static inline void bs_interleave_out(uint8_t* const block, const uint64_t lo, const uint64_t hi) {
+	uint64_t x[4];
+	uint32_t w;
+	int i;
+
+	x[0] = lo & 0x00FF00FF00FF00FFULL;
+	x[1] = hi & 0x00FF00FF00FF00FFULL;
+	x[2] = (lo >> 8) & 0x00FF00FF00FF00FFULL;
+	x[3] = (hi >> 8) & 0x00FF00FF00FF00FFULL;
+
+	for (i = 0; i < 4; ++i) {
+		x[i] |= (x[i] >> 8);
+		x[i] &= 0x0000FFFF0000FFFFULL;
+		w = (uint32_t)x[i] | (uint32_t)(x[i] >> 16);
+
+		block[4 * i] = (uint8_t)w;
+		block[4 * i + 1] = (uint8_t)(w >> 8);
+		block[4 * i + 2] = (uint8_t)(w >> 16);
+		block[4 * i + 3] = (uint8_t)(w >> 24);
+	}
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// 128-bit vectors, 8 blocks per batch
+//-----------------------------------------------------------------------------
+
+#define BS_VEC bs_vec128_t
+#define BS_LANES 2
+#define BS_FN(name) name##_128
+#define BS_TARGET
+
+#include "aes_bitslice_core.h"
+
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_LANES
+#undef BS_VEC
+
+const struct aes_backend_t aes_backend_bitslice = {
+	.name = "bitslice",
+	.supported = NULL,
+	.cbc_decrypt = bs_cbc_decrypt_128,
+	.ctr = bs_ctr_128,
+	.xts = bs_xts_128,
+};
+
+//-----------------------------------------------------------------------------
+// 256-bit vectors, 16 blocks per batch
+//-----------------------------------------------------------------------------
+
+#if defined(CPU_X86)
+
+#define BS_VEC bs_vec256_t
+#define BS_LANES 4
+#define BS_FN(name) name##_256
+#define BS_TARGET __attribute__((target("avx2")))
+
+#include "aes_bitslice_core.h"
+
+#undef BS_TARGET
+#undef BS_FN
+#undef BS_LANES
+#undef BS_VEC
+
+static int bitslice_avx2_supported(void) {
+	return cpu_has(CPU_FEATURE_AVX2);
+}
+
+const struct aes_backend_t aes_backend_bitslice_avx2 = {
+	.name = "bitslice-avx2",
+	.supported = bitslice_avx2_supported,
+	.cbc_decrypt = bs_cbc_decrypt_256,
+	.ctr = bs_ctr_256,
+	.xts = bs_xts_256,
+};
+
+#else
+
+static int bitslice_avx2_supported(void) {
+	return 0;
+}
+
+const struct aes_backend_t aes_backend_bitslice_avx2 = {
+	.name = "bitslice-avx2",
+	.supported = bitslice_avx2_supported,
+};
+
+#endif
@@ -0,0 +1,398 @@
+//
+// Bitsliced AES core, instantiated by aes_bitslice.c once per vector width.
+//
+// Expects:
+//   BS_VEC       vector of BS_LANES uint64_t (GCC vector extension)
+//   BS_LANES     number of 64-bit lanes, each lane carries 4 blocks
+//   BS_FN(name)  name mangling for this instantiation
+//   BS_TARGET    function attributes for this instantiation
+//
+// Within a lane the layout is the one of BearSSL's aes_ct64: q[i] holds bit i
+// of every state byte, 16-bit groups are rows, 4-bit groups are columns and
+// the 4 bits of a column belong to the 4 blocks of the lane. All operations
+// are lane-wise, so wider vectors simply carry more blocks.
+//
+
+#define BS_BLOCKS (4 * BS_LANES)
+
+static BS_TARGET void BS_FN(bs_ortho)(BS_VEC* const q) {
+	BS_VEC a, b;
+
+#define BS_SWAPN(cl, ch, s, x, y) \
+	a = (x); \
+	b = (y); \
+	(x) = (a & (uint64_t)(cl)) | ((b & (uint64_t)(cl)) << (s)); \
+	(y) = ((a & (uint64_t)(ch)) >> (s)) | (b & (uint64_t)(ch))
+
+#define BS_SWAP2(x, y) BS_SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define BS_SWAP4(x, y) BS_SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define BS_SWAP8(x, y) BS_SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+	BS_SWAP2(q[0], q[1]); BS_SWAP2(q[2], q[3]); BS_SWAP2(q[4], q[5]); BS_SWAP2(q[6], q[7]);
+	BS_SWAP4(q[0], q[2]); BS_SWAP4(q[1], q[3]); BS_SWAP4(q[4], q[6]); BS_SWAP4(q[5], q[7]);
+	BS_SWAP8(q[0], q[4]); BS_SWAP8(q[1], q[5]); BS_SWAP8(q[2], q[6]); BS_SWAP8(q[3], q[7]);
+
+#undef BS_SWAP8
+#undef BS_SWAP4
+#undef BS_SWAP2
+#undef BS_SWAPN
+}
+
+//
+// Boyar-Peralta S-box circuit, x0 is the most significant bit
+//
+static BS_TARGET void BS_FN(bs_sbox)(BS_VEC* const q) {
+	BS_VEC x0, x1, x2, x3, x4, x5, x6, x7;
+	BS_VEC y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+	BS_VEC z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17;
+	BS_VEC t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	BS_VEC t20, t21, t22, t23, t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	BS_VEC t40, t41, t42, t43, t44, t45, t46, t47, t48, t49, t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	BS_VEC t60, t61, t62, t63, t64, t65, t66, t67;
+
+	x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+	x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+	// top linear transformation
+	y14 = x3 ^ x5; y13 = x0 ^ x6; y9 = x0 ^ x3; y8 = x0 ^ x5;
+	t0 = x1 ^ x2; y1 = t0 ^ x7; y4 = y1 ^ x3; y12 = y13 ^ y14;
+	y2 = y1 ^ x0; y5 = y1 ^ x6; y3 = y5 ^ y8; t1 = x4 ^ y12;
+	y15 = t1 ^ x5; y20 = t1 ^ x1; y6 = y15 ^ x7; y10 = y15 ^ t0;
+	y11 = y20 ^ y9; y7 = x7 ^ y11; y17 = y10 ^ y11; y19 = y10 ^ y8;
+	y16 = t0 ^ y11; y21 = y13 ^ y16; y18 = x0 ^ y16;
+
+	// shared non-linear part
+	t2 = y12 & y15; t3 = y3 & y6; t4 = t3 ^ t2; t5 = y4 & x7;
+	t6 = t5 ^ t2; t7 = y13 & y16; t8 = y5 & y1; t9 = t8 ^ t7;
+	t10 = y2 & y7; t11 = t10 ^ t7; t12 = y9 & y11; t13 = y14 & y17;
+	t14 = t13 ^ t12; t15 = y8 & y10; t16 = t15 ^ t12; t17 = t4 ^ t14;
+	t18 = t6 ^ t16; t19 = t9 ^ t14; t20 = t11 ^ t16; t21 = t17 ^ y20;
+	t22 = t18 ^ y19; t23 = t19 ^ y21; t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22; t26 = t21 & t23; t27 = t24 ^ t26; t28 = t25 & t27;
+	t29 = t28 ^ t22; t30 = t23 ^ t24; t31 = t22 ^ t26; t32 = t31 & t30;
+	t33 = t32 ^ t24; t34 = t23 ^ t33; t35 = t27 ^ t33; t36 = t24 & t35;
+	t37 = t36 ^ t34; t38 = t27 ^ t36; t39 = t29 & t38; t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37; t42 = t29 ^ t33; t43 = t29 ^ t40; t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15; z1 = t37 & y6; z2 = t33 & x7; z3 = t43 & y16;
+	z4 = t40 & y1; z5 = t29 & y7; z6 = t42 & y11; z7 = t45 & y17;
+	z8 = t41 & y10; z9 = t44 & y12; z10 = t37 & y3; z11 = t33 & y4;
+	z12 = t43 & y13; z13 = t40 & y5; z14 = t29 & y2; z15 = t42 & y9;
+	z16 = t45 & y14; z17 = t41 & y8;
+
+	// bottom linear transformation
+	t46 = z15 ^ z16; t47 = z10 ^ z11; t48 = z5 ^ z13; t49 = z9 ^ z10;
+	t50 = z2 ^ z12; t51 = z2 ^ z5; t52 = z7 ^ z8; t53 = z0 ^ z3;
+	t54 = z6 ^ z7; t55 = z16 ^ z17; t56 = z12 ^ t48; t57 = t50 ^ t53;
+	t58 = z4 ^ t46; t59 = z3 ^ t54; t60 = t46 ^ t57; t61 = z14 ^ t57;
+	t62 = t52 ^ t58; t63 = t49 ^ t58; t64 = z4 ^ t59; t65 = t61 ^ t62;
+	t66 = z1 ^ t63; t67 = t64 ^ t65;
+
+	q[7] = t59 ^ t63;
+	q[4] = t53 ^ t66;
+	q[6] = t64 ^ ~q[4];
+	q[5] = t55 ^ ~t67;
+	q[3] = t51 ^ t66;
+	q[2] = t47 ^ t65;
+	q[1] = t56 ^ ~t62;
+	q[0] = t48 ^ ~t60;
+}
+
+//
+// y -> A^-1(y + 0x63), the inverse of the affine part of the S-box
+//
+static BS_TARGET void BS_FN(bs_inv_affine)(BS_VEC* const q) {
+	BS_VEC q0, q1, q2, q3, q4, q5, q6, q7;
+
+	q0 = ~q[0]; q1 = ~q[1]; q2 = q[2]; q3 = q[3];
+	q4 = q[4]; q5 = ~q[5]; q6 = ~q[6]; q7 = q[7];
+
+	q[7] = q1 ^ q4 ^ q6;
+	q[6] = q0 ^ q3 ^ q5;
+	q[5] = q7 ^ q2 ^ q4;
+	q[4] = q6 ^ q1 ^ q3;
+	q[3] = q5 ^ q0 ^ q2;
+	q[2] = q4 ^ q7 ^ q1;
+	q[1] = q3 ^ q6 ^ q0;
+	q[0] = q2 ^ q5 ^ q7;
+}
+
+//
+// InvSubBytes(y) = A^-1(S(A^-1(y + 0x63)) + 0x63)
+//
+static BS_TARGET void BS_FN(bs_inv_sbox)(BS_VEC* const q) {
+	BS_FN(bs_inv_affine)(q);
+	BS_FN(bs_sbox)(q);
+	BS_FN(bs_inv_affine)(q);
+}
+
+static BS_TARGET void BS_FN(bs_shift_rows)(BS_VEC* const q) {
+	BS_VEC x;
+	int i;
+
+	for (i = 0; i < 8; ++i) {
+		x = q[i];
+		q[i] = (x & 0x000000000000FFFFULL)
+			| ((x & 0x00000000FFF00000ULL) >> 4) | ((x & 0x00000000000F0000ULL) << 12)
+			| ((x & 0x0000FF0000000000ULL) >> 8) | ((x & 0x000000FF00000000ULL) << 8)
+			| ((x & 0xF000000000000000ULL) >> 12) | ((x & 0x0FFF000000000000ULL) << 4);
+	}
+}
+
+static BS_TARGET void BS_FN(bs_inv_shift_rows)(BS_VEC* const q) {
+	BS_VEC x;
+	int i;
+
+	for (i = 0; i < 8; ++i) {
+		x = q[i];
+		q[i] = (x & 0x000000000000FFFFULL)
+			| ((x & 0x000000000FFF0000ULL) << 4) | ((x & 0x00000000F0000000ULL) >> 12)
+			| ((x & 0x000000FF00000000ULL) << 8) | ((x & 0x0000FF0000000000ULL) >> 8)
+			| ((x & 0x000F000000000000ULL) << 12) | ((x & 0xFFF0000000000000ULL) >> 4);
+	}
+}
+
+// next row of the column
+#define BS_ROW1(x) (((x) >> 16) | ((x) << 48))
+// row after next
+#define BS_ROW2(x) (((x) >> 32) | ((x) << 32))
+
+static BS_TARGET void BS_FN(bs_mix_columns)(BS_VEC* const q) {
+	BS_VEC q0, q1, q2, q3, q4, q5, q6, q7;
+	BS_VEC r0, r1, r2, r3, r4, r5, r6, r7;
+
+	q0 = q[0]; q1 = q[1]; q2 = q[2]; q3 = q[3];
+	q4 = q[4]; q5 = q[5]; q6 = q[6]; q7 = q[7];
+	r0 = BS_ROW1(q0); r1 = BS_ROW1(q1); r2 = BS_ROW1(q2); r3 = BS_ROW1(q3);
+	r4 = BS_ROW1(q4); r5 = BS_ROW1(q5); r6 = BS_ROW1(q6); r7 = BS_ROW1(q7);
+
+	// 2 * (a0 + a1) + a1 + (a2 + a3)
+	q[0] = q7 ^ r7 ^ r0 ^ BS_ROW2(q0 ^ r0);
+	q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ BS_ROW2(q1 ^ r1);
+	q[2] = q1 ^ r1 ^ r2 ^ BS_ROW2(q2 ^ r2);
+	q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ BS_ROW2(q3 ^ r3);
+	q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ BS_ROW2(q4 ^ r4);
+	q[5] = q4 ^ r4 ^ r5 ^ BS_ROW2(q5 ^ r5);
+	q[6] = q5 ^ r5 ^ r6 ^ BS_ROW2(q6 ^ r6);
+	q[7] = q6 ^ r6 ^ r7 ^ BS_ROW2(q7 ^ r7);
+}
+
+//
+// InvMixColumns(x) = MixColumns(x + 4 * (x + row2(x)))
+//
+static BS_TARGET void BS_FN(bs_inv_mix_columns)(BS_VEC* const q) {
+	BS_VEC u0, u1, u2, u3, u4, u5, u6, u7;
+
+	u0 = q[0] ^ BS_ROW2(q[0]); u1 = q[1] ^ BS_ROW2(q[1]);
+	u2 = q[2] ^ BS_ROW2(q[2]); u3 = q[3] ^ BS_ROW2(q[3]);
+	u4 = q[4] ^ BS_ROW2(q[4]); u5 = q[5] ^ BS_ROW2(q[5]);
+	u6 = q[6] ^ BS_ROW2(q[6]); u7 = q[7] ^ BS_ROW2(q[7]);
+
+	// multiplication by 4 = x^2 modulo x^8 + x^4 + x^3 + x + 1
+	q[0] ^= u6;
+	q[1] ^= u6 ^ u7;
+	q[2] ^= u0 ^ u7;
+	q[3] ^= u1 ^ u6;
+	q[4] ^= u2 ^ u6 ^ u7;
+	q[5] ^= u3 ^ u7;
+	q[6] ^= u4;
+	q[7] ^= u5;
+
+	BS_FN(bs_mix_columns)(q);
+}
+
+#undef BS_ROW2
+#undef BS_ROW1
+
+static BS_TARGET void BS_FN(bs_add_round_key)(BS_VEC* const q, const BS_VEC* const sk) {
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		q[i] ^= sk[i];
+}
+
+//
+// Converts the round keys of the context, every block of the batch gets the
+// same key
+//
+static BS_TARGET void BS_FN(bs_key_schedule)(BS_VEC* const sk, const struct aes_context_t* const ctx) {
+	uint8_t key[AES_BLOCK_SIZE];
+	uint64_t lo, hi;
+	int r, i, l;
+
+	for (r = 0; r <= ctx->nr; ++r) {
+		for (i = 0; i < 4; ++i) {
+			key[4 * i] = (uint8_t)ctx->rk[4 * r + i];
+			key[4 * i + 1] = (uint8_t)(ctx->rk[4 * r + i] >> 8);
+			key[4 * i + 2] = (uint8_t)(ctx->rk[4 * r + i] >> 16);
+			key[4 * i + 3] = (uint8_t)(ctx->rk[4 * r + i] >> 24);
+		}
+		bs_interleave_in(&lo, &hi, key);
+
+		for (i = 0; i < 4; ++i) {
+			for (l = 0; l < BS_LANES; ++l) {
+				sk[8 * r + i][l] = lo;
+				sk[8 * r + i + 4][l] = hi;
+			}
+		}
+		BS_FN(bs_ortho)(sk + 8 * r);
+	}
+}
+
+//
+// The words are assembled in scalar memory and copied into the vectors in
+// one go, inserting single lanes is a lot slower
+//
+static BS_TARGET void BS_FN(bs_load)(BS_VEC* const q, const uint8_t* const blocks) {
+	uint64_t x[8][BS_LANES];
+	int l, j;
+
+	for (l = 0; l < BS_LANES; ++l) {
+		for (j = 0; j < 4; ++j)
+			bs_interleave_in(&x[j][l], &x[j + 4][l], blocks + (4 * l + j) * AES_BLOCK_SIZE);
+	}
+	memcpy(q, x, sizeof(x));
+	BS_FN(bs_ortho)(q);
+}
+
+static BS_TARGET void BS_FN(bs_store)(uint8_t* const blocks, BS_VEC* const q) {
+	uint64_t x[8][BS_LANES];
+	int l, j;
+
+	BS_FN(bs_ortho)(q);
+	memcpy(x, q, sizeof(x));
+	for (l = 0; l < BS_LANES; ++l) {
+		for (j = 0; j < 4; ++j)
+			bs_interleave_out(blocks + (4 * l + j) * AES_BLOCK_SIZE, x[j][l], x[j + 4][l]);
+	}
+}
+
+//
+// dst = a ^ b over a whole batch
+//
+static BS_TARGET void BS_FN(bs_xor_batch)(uint8_t* const dst, const uint8_t* const a, const uint8_t* const b) {
+	BS_VEC x, y;
+	int i;
+
+	for (i = 0; i < BS_BLOCKS * AES_BLOCK_SIZE; i += sizeof(BS_VEC)) {
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		x ^= y;
+		memcpy(dst + i, &x, sizeof(x));
+	}
+}
+
+//
+// Runs a batch through the cipher in the direction of the context, the
+// decryption schedule is the equivalent inverse cipher one from aes_init
+//
+static BS_TARGET void BS_FN(bs_crypt)(const BS_VEC* const sk, const struct aes_context_t* const ctx, uint8_t* const blocks) {
+	BS_VEC q[8];
+	int i;
+
+	BS_FN(bs_load)(q, blocks);
+	BS_FN(bs_add_round_key)(q, sk);
+
+	if (ctx->mode == AES_DECRYPT) {
+		for (i = 1; i < ctx->nr; ++i) {
+			BS_FN(bs_inv_sbox)(q);
+			BS_FN(bs_inv_shift_rows)(q);
+			BS_FN(bs_inv_mix_columns)(q);
+			BS_FN(bs_add_round_key)(q, sk + 8 * i);
+		}
+		BS_FN(bs_inv_sbox)(q);
+		BS_FN(bs_inv_shift_rows)(q);
+	} else {
+		for (i = 1; i < ctx->nr; ++i) {
+			BS_FN(bs_sbox)(q);
+			BS_FN(bs_shift_rows)(q);
+			BS_FN(bs_mix_columns)(q);
+			BS_FN(bs_add_round_key)(q, sk + 8 * i);
+		}
+		BS_FN(bs_sbox)(q);
+		BS_FN(bs_shift_rows)(q);
+	}
+	BS_FN(bs_add_round_key)(q, sk + 8 * ctx->nr);
+
+	BS_FN(bs_store)(blocks, q);
+}
+
+static BS_TARGET void BS_FN(bs_cbc_decrypt)(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	BS_VEC sk[15 * 8];
+	uint8_t cipher[BS_BLOCKS * AES_BLOCK_SIZE];
+	uint8_t plain[BS_BLOCKS * AES_BLOCK_SIZE];
+
+	if (nblocks >= BS_BLOCKS) {
+		BS_FN(bs_key_schedule)(sk, ctx);
+
+		while (nblocks >= BS_BLOCKS) {
+			// keep the ciphertext, src and dst may be the same buffer
+			memcpy(cipher, src, sizeof(cipher));
+			memcpy(plain, src, sizeof(plain));
+			BS_FN(bs_crypt)(sk, ctx, plain);
+			aes_cbc_decrypt_chain(iv, cipher, dst, plain, BS_BLOCKS);
+
+			src += BS_BLOCKS * AES_BLOCK_SIZE;
+			dst += BS_BLOCKS * AES_BLOCK_SIZE;
+			nblocks -= BS_BLOCKS;
+		}
+	}
+
+	if (nblocks > 0)
+		aes_backend_portable.cbc_decrypt(ctx, iv, src, dst, nblocks);
+}
+
+static BS_TARGET void BS_FN(bs_ctr)(const struct aes_context_t* const ctx, uint8_t counter[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	BS_VEC sk[15 * 8];
+	uint8_t stream[BS_BLOCKS * AES_BLOCK_SIZE];
+
+	if (nblocks >= BS_BLOCKS) {
+		BS_FN(bs_key_schedule)(sk, ctx);
+
+		while (nblocks >= BS_BLOCKS) {
+			aes_ctr_fill(stream, counter, BS_BLOCKS);
+			BS_FN(bs_crypt)(sk, ctx, stream);
+			BS_FN(bs_xor_batch)(dst, src, stream);
+
+			src += BS_BLOCKS * AES_BLOCK_SIZE;
+			dst += BS_BLOCKS * AES_BLOCK_SIZE;
+			nblocks -= BS_BLOCKS;
+		}
+	}
+
+	if (nblocks > 0)
+		aes_backend_portable.ctr(ctx, counter, src, dst, nblocks);
+}
+
+static BS_TARGET void BS_FN(bs_xts)(const struct aes_context_t* const ctx, uint8_t tweak[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	BS_VEC sk[15 * 8];
+	uint8_t tweaks[BS_BLOCKS * AES_BLOCK_SIZE];
+	uint8_t data[BS_BLOCKS * AES_BLOCK_SIZE];
+	uint32_t i;
+
+	if (nblocks >= BS_BLOCKS) {
+		BS_FN(bs_key_schedule)(sk, ctx);
+
+		while (nblocks >= BS_BLOCKS) {
+			for (i = 0; i < BS_BLOCKS; ++i) {
+				memcpy(tweaks + i * AES_BLOCK_SIZE, tweak, AES_BLOCK_SIZE);
+				aes_xts_mulx(tweak);
+			}
+
+			BS_FN(bs_xor_batch)(data, src, tweaks);
+			BS_FN(bs_crypt)(sk, ctx, data);
+			BS_FN(bs_xor_batch)(dst, data, tweaks);
+
+			src += BS_BLOCKS * AES_BLOCK_SIZE;
+			dst += BS_BLOCKS * AES_BLOCK_SIZE;
+			nblocks -= BS_BLOCKS;
+		}
+	}
+
+	if (nblocks > 0)
+		aes_backend_portable.xts(ctx, tweak, src, dst, nblocks);
+}
+
+#undef BS_BLOCKS
@@ -0,0 +1,344 @@
+//
+// Compact table AES backend.
+//
+// The portable code keeps four 1 KB T-tables per direction plus both S-boxes,
+// 8.5 KB that compete with the working buffers for a small L1. This backend
+// keeps a single table per direction and derives the other three columns by
+// rotation, which costs three rotates per round and column but touches only
+// 1 KB for encryption and 1.25 KB for decryption. The forward S-box is the
+// second byte of the forward table, so only the reverse S-box is separate.
+//
+// The tables are generated on first use instead of being stored, and the key
+// schedule is computed from them as well, so a process running on this
+// backend never touches the portable tables at all. Build with
+// make AES_COMPACT=1 to make it the table fallback instead of the portable
+// backend, or select it at run time with SV_AES_BACKEND=compact.
+//
+
+#include "crypto_backend.h"
+
+#include <pthread.h>
+
+static uint8_t ct_rsb[256];
+static uint32_t ct_ft[256];
+static uint32_t ct_rt[256];
+static uint32_t ct_rcon[10];
+
+static pthread_once_t ct_tables_once = PTHREAD_ONCE_INIT;
+
+#define CT_ROTL8(x) (((x) << 8) | ((x) >> 24))
+#define CT_ROTL16(x) (((x) << 16) | ((x) >> 16))
+#define CT_ROTL24(x) (((x) << 24) | ((x) >> 8))
+
+#define CT_XTIME(x) ((((x) << 1) ^ (((x) & 0x80) ? 0x1B : 0x00)) & 0xFF)
+
+//
+// Forward S-box as a byte of the forward table
+//
+#define CT_FSB(x) ((ct_ft[(x)] >> 8) & 0xFF)
+
+static inline uint32_t ct_load(const uint8_t* const p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void ct_store(uint8_t* const p, const uint32_t x) {
+	p[0] = (uint8_t)x;
+	p[1] = (uint8_t)(x >> 8);
+	p[2] = (uint8_t)(x >> 16);
+	p[3] = (uint8_t)(x >> 24);
+}
+
+static int ct_mul(const int x, const int y, const int pow[256], const int log[256]) {
+	return (x && y) ? pow[(log[x] + log[y]) % 255] : 0;
+}
+
+static void ct_gen_tables(void) {
+	int pow[256], log[256];
+	int i, x, y, s;
+
+	// powers of 3 generate the multiplicative group
+	for (i = 0, x = 1; i < 256; ++i) {
+		pow[i] = x;
+		log[x] = i;
+		x = (x ^ CT_XTIME(x)) & 0xFF;
+	}
+
+	for (i = 0, x = 1; i < 10; ++i) {
+		ct_rcon[i] = (uint32_t)x;
+		x = CT_XTIME(x);
+	}
+
+	// S-box: inversion followed by the affine transformation
+	for (i = 0; i < 256; ++i) {
+		x = (i == 0) ? 0 : pow[255 - log[i]];
+
+		s = x;
+		y = ((x << 1) | (x >> 7)) & 0xFF; s ^= y;
+		y = ((y << 1) | (y >> 7)) & 0xFF; s ^= y;
+		y = ((y << 1) | (y >> 7)) & 0xFF; s ^= y;
+		y = ((y << 1) | (y >> 7)) & 0xFF; s ^= y;
+		s ^= 0x63;
+
+		ct_ft[i] = (uint32_t)CT_XTIME(s) ^ ((uint32_t)s << 8) ^ ((uint32_t)s << 16) ^ ((uint32_t)(CT_XTIME(s) ^ s) << 24);
+		ct_rsb[s] = (uint8_t)i;
+	}
+
+	for (i = 0; i < 256; ++i) {
+		x = ct_rsb[i];
+
+		ct_rt[i] = (uint32_t)ct_mul(0x0E, x, pow, log) ^
+			((uint32_t)ct_mul(0x09, x, pow, log) << 8) ^
+			((uint32_t)ct_mul(0x0D, x, pow, log) << 16) ^
+			((uint32_t)ct_mul(0x0B, x, pow, log) << 24);
+	}
+}
+
+static inline void ct_init(void) {
+	pthread_once(&ct_tables_once, ct_gen_tables);
+}
+
+static inline uint32_t ct_sub_word(const uint32_t x) {
+	return CT_FSB(x & 0xFF) ^
+		(CT_FSB((x >> 8) & 0xFF) << 8) ^
+		(CT_FSB((x >> 16) & 0xFF) << 16) ^
+		(CT_FSB((x >> 24) & 0xFF) << 24);
+}
+
+static int compact_expand_key(uint32_t* const rk_out, const uint8_t* const key, const unsigned int key_size) {
+	uint32_t* rk = rk_out;
+	const int nk = key_size >> 5;
+	const int words = 4 * ((key_size >> 5) + 7);
+	uint32_t t;
+	int i;
+
+	ct_init();
+
+	for (i = 0; i < nk; ++i)
+		rk[i] = ct_load(key + 4 * i);
+
+	for (i = nk; i < words; ++i) {
+		t = rk[i - 1];
+
+		if (i % nk == 0)
+			t = ct_sub_word(CT_ROTL24(t)) ^ ct_rcon[i / nk - 1];
+		else if (nk == 8 && i % nk == 4)
+			t = ct_sub_word(t);
+
+		rk[i] = rk[i - nk] ^ t;
+	}
+
+	return 0;
+}
+
+static void compact_invert_key(uint32_t* const drk, const uint32_t* const erk, const int nr) {
+	uint32_t* rk = drk;
+	const uint32_t* sk = erk + nr * 4;
+
+	int i, j;
+
+	ct_init();
+
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+
+	sk -= 8;
+	for (i = nr - 1; i > 0; --i) {
+		for (j = 0; j < 4; ++j, ++sk) {
+			const uint32_t t1 = ct_rt[CT_FSB((*sk >> 8) & 0xFF)];
+			const uint32_t t2 = ct_rt[CT_FSB((*sk >> 16) & 0xFF)];
+			const uint32_t t3 = ct_rt[CT_FSB((*sk >> 24) & 0xFF)];
+
+			*rk++ = ct_rt[CT_FSB((*sk) & 0xFF)] ^ CT_ROTL8(t1) ^ CT_ROTL16(t2) ^ CT_ROTL24(t3);
+		}
+		sk -= 8;
+	}
+
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+}
+
+//
+// One column of a round, the T-table columns 1..3 are rotations of column 0
+//
+#define CT_COLUMN(t, k, a, b, c, d) \
+	((k) ^ t[(a) & 0xFF] ^ CT_ROTL8(t[((b) >> 8) & 0xFF]) ^ \
+		CT_ROTL16(t[((c) >> 16) & 0xFF]) ^ CT_ROTL24(t[((d) >> 24) & 0xFF]))
+
+static void compact_encrypt_block(const uint32_t* rk, const int nr, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
+	uint32_t x0, x1, x2, x3;
+	uint32_t y0, y1, y2, y3;
+	int i;
+
+	x0 = ct_load(input + 0) ^ rk[0];
+	x1 = ct_load(input + 4) ^ rk[1];
+	x2 = ct_load(input + 8) ^ rk[2];
+	x3 = ct_load(input + 12) ^ rk[3];
+	rk += 4;
+
+	for (i = 1; i < nr; ++i) {
+		y0 = CT_COLUMN(ct_ft, rk[0], x0, x1, x2, x3);
+		y1 = CT_COLUMN(ct_ft, rk[1], x1, x2, x3, x0);
+		y2 = CT_COLUMN(ct_ft, rk[2], x2, x3, x0, x1);
+		y3 = CT_COLUMN(ct_ft, rk[3], x3, x0, x1, x2);
+		rk += 4;
+
+		x0 = y0; x1 = y1; x2 = y2; x3 = y3;
+	}
+
+	y0 = rk[0] ^ CT_FSB(x0 & 0xFF) ^ (CT_FSB((x1 >> 8) & 0xFF) << 8) ^ (CT_FSB((x2 >> 16) & 0xFF) << 16) ^ (CT_FSB((x3 >> 24) & 0xFF) << 24);
+	y1 = rk[1] ^ CT_FSB(x1 & 0xFF) ^ (CT_FSB((x2 >> 8) & 0xFF) << 8) ^ (CT_FSB((x3 >> 16) & 0xFF) << 16) ^ (CT_FSB((x0 >> 24) & 0xFF) << 24);
+	y2 = rk[2] ^ CT_FSB(x2 & 0xFF) ^ (CT_FSB((x3 >> 8) & 0xFF) << 8) ^ (CT_FSB((x0 >> 16) & 0xFF) << 16) ^ (CT_FSB((x1 >> 24) & 0xFF) << 24);
+	y3 = rk[3] ^ CT_FSB(x3 & 0xFF) ^ (CT_FSB((x0 >> 8) & 0xFF) << 8) ^ (CT_FSB((x1 >> 16) & 0xFF) << 16) ^ (CT_FSB((x2 >> 24) & 0xFF) << 24);
+
+	ct_store(output + 0, y0);
+	ct_store(output + 4, y1);
+	ct_store(output + 8, y2);
+	ct_store(output + 12, y3);
+}
+
+static void compact_decrypt_block(const uint32_t* rk, const int nr, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
+	uint32_t x0, x1, x2, x3;
+	uint32_t y0, y1, y2, y3;
+	int i;
+
+	x0 = ct_load(input + 0) ^ rk[0];
+	x1 = ct_load(input + 4) ^ rk[1];
+	x2 = ct_load(input + 8) ^ rk[2];
+	x3 = ct_load(input + 12) ^ rk[3];
+	rk += 4;
+
+	for (i = 1; i < nr; ++i) {
+		y0 = CT_COLUMN(ct_rt, rk[0], x0, x3, x2, x1);
+		y1 = CT_COLUMN(ct_rt, rk[1], x1, x0, x3, x2);
+		y2 = CT_COLUMN(ct_rt, rk[2], x2, x1, x0, x3);
+		y3 = CT_COLUMN(ct_rt, rk[3], x3, x2, x1, x0);
+		rk += 4;
+
+		x0 = y0; x1 = y1; x2 = y2; x3 = y3;
+	}
+
+	y0 = rk[0] ^ (uint32_t)ct_rsb[x0 & 0xFF] ^ ((uint32_t)ct_rsb[(x3 >> 8) & 0xFF] << 8) ^ ((uint32_t)ct_rsb[(x2 >> 16) & 0xFF] << 16) ^ ((uint32_t)ct_rsb[(x1 >> 24) & 0xFF] << 24);
+	y1 = rk[1] ^ (uint32_t)ct_rsb[x1 & 0xFF] ^ ((uint32_t)ct_rsb[(x0 >> 8) & 0xFF] << 8) ^ ((uint32_t)ct_rsb[(x3 >> 16) & 0xFF] << 16) ^ ((uint32_t)ct_rsb[(x2 >> 24) & 0xFF] << 24);
+	y2 = rk[2] ^ (uint32_t)ct_rsb[x2 & 0xFF] ^ ((uint32_t)ct_rsb[(x1 >> 8) & 0xFF] << 8) ^ ((uint32_t)ct_rsb[(x0 >> 16) & 0xFF] << 16) ^ ((uint32_t)ct_rsb[(x3 >> 24) & 0xFF] << 24);
+	y3 = rk[3] ^ (uint32_t)ct_rsb[x3 & 0xFF] ^ ((uint32_t)ct_rsb[(x2 >> 8) & 0xFF] << 8) ^ ((uint32_t)ct_rsb[(x1 >> 16) & 0xFF] << 16) ^ ((uint32_t)ct_rsb[(x0 >> 24) & 0xFF] << 24);
+
+	ct_store(output + 0, y0);
+	ct_store(output + 4, y1);
+	ct_store(output + 8, y2);
+	ct_store(output + 12, y3);
+}
+
+#undef CT_COLUMN
+
+static void compact_ecb(const struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
+	ct_init();
+
+	if (ctx->mode == AES_DECRYPT)
+		compact_decrypt_block(ctx->rk, ctx->nr, input, output);
+	else
+		compact_encrypt_block(ctx->rk, ctx->nr, input, output);
+}
+
+static void compact_cbc_encrypt(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	uint8_t block[AES_BLOCK_SIZE];
+
+	ct_init();
+
+	while (nblocks > 0) {
+		aes_xor_bytes(block, src, iv, AES_BLOCK_SIZE);
+		compact_encrypt_block(ctx->rk, ctx->nr, block, iv);
+		memcpy(dst, iv, AES_BLOCK_SIZE);
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+}
+
+static void compact_cbc_decrypt(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	uint8_t plain[AES_BLOCK_SIZE];
+
+	ct_init();
+
+	while (nblocks > 0) {
+		compact_decrypt_block(ctx->rk, ctx->nr, src, plain);
+		aes_cbc_decrypt_chain(iv, src, dst, plain, 1);
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+}
+
+static void compact_ctr(const struct aes_context_t* const ctx, uint8_t counter[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	uint8_t stream[AES_BLOCK_SIZE];
+
+	ct_init();
+
+	while (nblocks > 0) {
+		compact_encrypt_block(ctx->rk, ctx->nr, counter, stream);
+		aes_ctr_increment(counter);
+		aes_xor_bytes(dst, src, stream, AES_BLOCK_SIZE);
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+}
+
+static void compact_xts(const struct aes_context_t* const ctx, uint8_t tweak[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	uint8_t block[AES_BLOCK_SIZE];
+
+	ct_init();
+
+	while (nblocks > 0) {
+		aes_xor_bytes(block, src, tweak, AES_BLOCK_SIZE);
+		if (ctx->mode == AES_DECRYPT)
+			compact_decrypt_block(ctx->rk, ctx->nr, block, block);
+		else
+			compact_encrypt_block(ctx->rk, ctx->nr, block, block);
+		aes_xor_bytes(dst, block, tweak, AES_BLOCK_SIZE);
+		aes_xts_mulx(tweak);
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+}
+
+static void compact_cbc_encrypt_lanes(struct aes_lane_cursor_t* const lanes, const uint32_t count, const int nr, uint32_t nblocks) {
+	uint8_t block[AES_BLOCK_SIZE];
+	uint32_t l;
+
+	ct_init();
+
+	while (nblocks > 0) {
+		for (l = 0; l < count; ++l) {
+			aes_xor_bytes(block, lanes[l].input, lanes[l].iv, AES_BLOCK_SIZE);
+			compact_encrypt_block(lanes[l].rk, nr, block, lanes[l].iv);
+			memcpy(lanes[l].output, lanes[l].iv, AES_BLOCK_SIZE);
+
+			lanes[l].input += AES_BLOCK_SIZE;
+			lanes[l].output += AES_BLOCK_SIZE;
+		}
+		nblocks--;
+	}
+}
+
+const struct aes_backend_t aes_backend_compact = {
+	.name = "compact",
+	.supported = NULL,
+	.expand_key = compact_expand_key,
+	.invert_key = compact_invert_key,
+	.ecb = compact_ecb,
+	.cbc_encrypt = compact_cbc_encrypt,
+	.cbc_decrypt = compact_cbc_decrypt,
+	.ctr = compact_ctr,
+	.xts = compact_xts,
+	.max_lanes = AES_MAX_LANES,
+	.cbc_encrypt_lanes = compact_cbc_encrypt_lanes,
+};
@@ -0,0 +1,359 @@
+//
+// AES-NI backend.
+//
+// The hardware round instructions consume the round keys exactly as aes_init
+// lays them out in memory on little endian hosts (the decryption schedule is
+// already the "equivalent inverse cipher" form expected by aesdec), so this
+// backend only replaces the block processing and the key expansion.
+//
+
+#include "crypto_backend.h"
+
+#if defined(CPU_X86)
+
+#include <immintrin.h>
+
+#define AESNI_TARGET __attribute__((target("aes,sse4.1")))
+
+static int aesni_supported(void) {
+	return cpu_has(CPU_FEATURE_AESNI | CPU_FEATURE_SSE41);
+}
+
+static AESNI_TARGET __m128i aesni_expand_step(__m128i key, __m128i assist) {
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+#define AESNI_EXPAND_EVEN(prev, last, rcon) \
+	aesni_expand_step((prev), _mm_shuffle_epi32(_mm_aeskeygenassist_si128((last), (rcon)), 0xFF))
+
+#define AESNI_EXPAND_ODD(prev, last) \
+	aesni_expand_step((prev), _mm_shuffle_epi32(_mm_aeskeygenassist_si128((last), 0x00), 0xAA))
+
+static AESNI_TARGET int aesni_expand_key(uint32_t* const rk, const uint8_t* const key, const unsigned int key_size) {
+	__m128i* const k = (__m128i*)rk;
+	__m128i a, b;
+
+	switch (key_size) {
+		case 128:
+			a = _mm_loadu_si128((const __m128i*)key);
+			_mm_storeu_si128(k + 0, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x01); _mm_storeu_si128(k + 1, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x02); _mm_storeu_si128(k + 2, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x04); _mm_storeu_si128(k + 3, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x08); _mm_storeu_si128(k + 4, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x10); _mm_storeu_si128(k + 5, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x20); _mm_storeu_si128(k + 6, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x40); _mm_storeu_si128(k + 7, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x80); _mm_storeu_si128(k + 8, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x1B); _mm_storeu_si128(k + 9, a);
+			a = AESNI_EXPAND_EVEN(a, a, 0x36); _mm_storeu_si128(k + 10, a);
+			return 0;
+
+		case 256:
+			a = _mm_loadu_si128((const __m128i*)key);
+			b = _mm_loadu_si128((const __m128i*)(key + 16));
+			_mm_storeu_si128(k + 0, a);
+			_mm_storeu_si128(k + 1, b);
+			a = AESNI_EXPAND_EVEN(a, b, 0x01); _mm_storeu_si128(k + 2, a);
+			b = AESNI_EXPAND_ODD(b, a); _mm_storeu_si128(k + 3, b);
+			a = AESNI_EXPAND_EVEN(a, b, 0x02); _mm_storeu_si128(k + 4, a);
+			b = AESNI_EXPAND_ODD(b, a); _mm_storeu_si128(k + 5, b);
+			a = AESNI_EXPAND_EVEN(a, b, 0x04); _mm_storeu_si128(k + 6, a);
+			b = AESNI_EXPAND_ODD(b, a); _mm_storeu_si128(k + 7, b);
+			a = AESNI_EXPAND_EVEN(a, b, 0x08); _mm_storeu_si128(k + 8, a);
+			b = AESNI_EXPAND_ODD(b, a); _mm_storeu_si128(k + 9, b);
+			a = AESNI_EXPAND_EVEN(a, b, 0x10); _mm_storeu_si128(k + 10, a);
+			b = AESNI_EXPAND_ODD(b, a); _mm_storeu_si128(k + 11, b);
+			a = AESNI_EXPAND_EVEN(a, b, 0x20); _mm_storeu_si128(k + 12, a);
+			b = AESNI_EXPAND_ODD(b, a); _mm_storeu_si128(k + 13, b);
+			a = AESNI_EXPAND_EVEN(a, b, 0x40); _mm_storeu_si128(k + 14, a);
+			return 0;
+
+		default:
+			// 192-bit keys do not fit the 128-bit register stride, use the portable schedule
+			return -1;
+	}
+}
+
+#undef AESNI_EXPAND_EVEN
+#undef AESNI_EXPAND_ODD
+
+static AESNI_TARGET void aesni_invert_key(uint32_t* const drk, const uint32_t* const erk, const int nr) {
+	const __m128i* const ek = (const __m128i*)erk;
+	__m128i* const dk = (__m128i*)drk;
+	int i;
+
+	_mm_storeu_si128(dk, _mm_loadu_si128(ek + nr));
+	for (i = 1; i < nr; ++i)
+		_mm_storeu_si128(dk + i, _mm_aesimc_si128(_mm_loadu_si128(ek + nr - i)));
+	_mm_storeu_si128(dk + nr, _mm_loadu_si128(ek));
+}
+
+static AESNI_TARGET void aesni_load_keys(const struct aes_context_t* const ctx, __m128i k[15]) {
+	const __m128i* const rk = (const __m128i*)ctx->rk;
+	int i;
+
+	// the schedule buffer always holds 15 round keys worth of space
+	for (i = 0; i < 15; ++i)
+		k[i] = _mm_loadu_si128(rk + i);
+}
+
+static AESNI_TARGET __m128i aesni_encrypt_block(const __m128i k[15], const int nr, __m128i x) {
+	int i;
+
+	x = _mm_xor_si128(x, k[0]);
+	for (i = 1; i < nr; ++i)
+		x = _mm_aesenc_si128(x, k[i]);
+	return _mm_aesenclast_si128(x, k[nr]);
+}
+
+static AESNI_TARGET __m128i aesni_decrypt_block(const __m128i k[15], const int nr, __m128i x) {
+	int i;
+
+	x = _mm_xor_si128(x, k[0]);
+	for (i = 1; i < nr; ++i)
+		x = _mm_aesdec_si128(x, k[i]);
+	return _mm_aesdeclast_si128(x, k[nr]);
+}
+
+static AESNI_TARGET void aesni_ecb(const struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
+	__m128i k[15];
+	__m128i x;
+
+	aesni_load_keys(ctx, k);
+
+	x = _mm_loadu_si128((const __m128i*)input);
+	if (ctx->mode == AES_DECRYPT)
+		x = aesni_decrypt_block(k, ctx->nr, x);
+	else
+		x = aesni_encrypt_block(k, ctx->nr, x);
+	_mm_storeu_si128((__m128i*)output, x);
+}
+
+static AESNI_TARGET void aesni_cbc_encrypt(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	__m128i k[15];
+	__m128i x;
+
+	aesni_load_keys(ctx, k);
+
+	x = _mm_loadu_si128((const __m128i*)iv);
+	while (nblocks > 0) {
+		x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i*)src));
+		x = aesni_encrypt_block(k, ctx->nr, x);
+		_mm_storeu_si128((__m128i*)dst, x);
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+	_mm_storeu_si128((__m128i*)iv, x);
+}
+
+#define AESNI_LOAD8(p) \
+	c0 = _mm_loadu_si128((const __m128i*)(p) + 0); c1 = _mm_loadu_si128((const __m128i*)(p) + 1); \
+	c2 = _mm_loadu_si128((const __m128i*)(p) + 2); c3 = _mm_loadu_si128((const __m128i*)(p) + 3); \
+	c4 = _mm_loadu_si128((const __m128i*)(p) + 4); c5 = _mm_loadu_si128((const __m128i*)(p) + 5); \
+	c6 = _mm_loadu_si128((const __m128i*)(p) + 6); c7 = _mm_loadu_si128((const __m128i*)(p) + 7)
+
+#define AESNI_ROUND8(op, key) \
+	x0 = op(x0, key); x1 = op(x1, key); x2 = op(x2, key); x3 = op(x3, key); \
+	x4 = op(x4, key); x5 = op(x5, key); x6 = op(x6, key); x7 = op(x7, key)
+
+//
+// CBC decryption has no dependency between blocks, eight of them are kept in
+// flight to cover the latency of the round instructions
+//
+static AESNI_TARGET void aesni_cbc_decrypt(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	__m128i k[15];
+	__m128i prev, c;
+	__m128i c0, c1, c2, c3, c4, c5, c6, c7;
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7;
+	int i;
+
+	aesni_load_keys(ctx, k);
+
+	prev = _mm_loadu_si128((const __m128i*)iv);
+	while (nblocks >= 8) {
+		AESNI_LOAD8(src);
+
+		x0 = _mm_xor_si128(c0, k[0]); x1 = _mm_xor_si128(c1, k[0]);
+		x2 = _mm_xor_si128(c2, k[0]); x3 = _mm_xor_si128(c3, k[0]);
+		x4 = _mm_xor_si128(c4, k[0]); x5 = _mm_xor_si128(c5, k[0]);
+		x6 = _mm_xor_si128(c6, k[0]); x7 = _mm_xor_si128(c7, k[0]);
+
+		for (i = 1; i < ctx->nr; ++i) {
+			AESNI_ROUND8(_mm_aesdec_si128, k[i]);
+		}
+		AESNI_ROUND8(_mm_aesdeclast_si128, k[ctx->nr]);
+
+		_mm_storeu_si128((__m128i*)dst + 0, _mm_xor_si128(x0, prev));
+		_mm_storeu_si128((__m128i*)dst + 1, _mm_xor_si128(x1, c0));
+		_mm_storeu_si128((__m128i*)dst + 2, _mm_xor_si128(x2, c1));
+		_mm_storeu_si128((__m128i*)dst + 3, _mm_xor_si128(x3, c2));
+		_mm_storeu_si128((__m128i*)dst + 4, _mm_xor_si128(x4, c3));
+		_mm_storeu_si128((__m128i*)dst + 5, _mm_xor_si128(x5, c4));
+		_mm_storeu_si128((__m128i*)dst + 6, _mm_xor_si128(x6, c5));
+		_mm_storeu_si128((__m128i*)dst + 7, _mm_xor_si128(x7, c6));
+		prev = c7;
+
+		src += 8 * AES_BLOCK_SIZE;
+		dst += 8 * AES_BLOCK_SIZE;
+		nblocks -= 8;
+	}
+
+	while (nblocks > 0) {
+		c = _mm_loadu_si128((const __m128i*)src);
+		_mm_storeu_si128((__m128i*)dst, _mm_xor_si128(aesni_decrypt_block(k, ctx->nr, c), prev));
+		prev = c;
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+	_mm_storeu_si128((__m128i*)iv, prev);
+}
+
+//
+// Eight counter blocks are generated and encrypted together
+//
+static AESNI_TARGET void aesni_ctr(const struct aes_context_t* const ctx, uint8_t counter[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	uint8_t block[8 * AES_BLOCK_SIZE];
+	__m128i k[15];
+	__m128i x;
+	__m128i c0, c1, c2, c3, c4, c5, c6, c7;
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7;
+	int i;
+
+	aesni_load_keys(ctx, k);
+
+	while (nblocks >= 8) {
+		aes_ctr_fill(block, counter, 8);
+		AESNI_LOAD8(block);
+
+		x0 = _mm_xor_si128(c0, k[0]); x1 = _mm_xor_si128(c1, k[0]);
+		x2 = _mm_xor_si128(c2, k[0]); x3 = _mm_xor_si128(c3, k[0]);
+		x4 = _mm_xor_si128(c4, k[0]); x5 = _mm_xor_si128(c5, k[0]);
+		x6 = _mm_xor_si128(c6, k[0]); x7 = _mm_xor_si128(c7, k[0]);
+
+		for (i = 1; i < ctx->nr; ++i) {
+			AESNI_ROUND8(_mm_aesenc_si128, k[i]);
+		}
+		AESNI_ROUND8(_mm_aesenclast_si128, k[ctx->nr]);
+
+		AESNI_LOAD8(src);
+		_mm_storeu_si128((__m128i*)dst + 0, _mm_xor_si128(x0, c0));
+		_mm_storeu_si128((__m128i*)dst + 1, _mm_xor_si128(x1, c1));
+		_mm_storeu_si128((__m128i*)dst + 2, _mm_xor_si128(x2, c2));
+		_mm_storeu_si128((__m128i*)dst + 3, _mm_xor_si128(x3, c3));
+		_mm_storeu_si128((__m128i*)dst + 4, _mm_xor_si128(x4, c4));
+		_mm_storeu_si128((__m128i*)dst + 5, _mm_xor_si128(x5, c5));
+		_mm_storeu_si128((__m128i*)dst + 6, _mm_xor_si128(x6, c6));
+		_mm_storeu_si128((__m128i*)dst + 7, _mm_xor_si128(x7, c7));
+
+		src += 8 * AES_BLOCK_SIZE;
+		dst += 8 * AES_BLOCK_SIZE;
+		nblocks -= 8;
+	}
+
+	while (nblocks > 0) {
+		x = aesni_encrypt_block(k, ctx->nr, _mm_loadu_si128((const __m128i*)counter));
+		_mm_storeu_si128((__m128i*)dst, _mm_xor_si128(x, _mm_loadu_si128((const __m128i*)src)));
+		aes_ctr_increment(counter);
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+}
+
+static AESNI_TARGET void aesni_cbc_encrypt_lanes(struct aes_lane_cursor_t* const lanes, const uint32_t count, const int nr, uint32_t nblocks) {
+	const __m128i* rk[AES_MAX_LANES];
+	__m128i x[AES_MAX_LANES];
+	uint32_t l;
+	int i;
+
+	for (l = 0; l < count; ++l) {
+		rk[l] = (const __m128i*)lanes[l].rk;
+		x[l] = _mm_loadu_si128((const __m128i*)lanes[l].iv);
+	}
+
+	while (nblocks > 0) {
+		for (l = 0; l < count; ++l)
+			x[l] = _mm_xor_si128(x[l], _mm_xor_si128(_mm_loadu_si128((const __m128i*)lanes[l].input), _mm_loadu_si128(rk[l])));
+
+		for (i = 1; i < nr; ++i) {
+			for (l = 0; l < count; ++l)
+				x[l] = _mm_aesenc_si128(x[l], _mm_loadu_si128(rk[l] + i));
+		}
+
+		for (l = 0; l < count; ++l) {
+			x[l] = _mm_aesenclast_si128(x[l], _mm_loadu_si128(rk[l] + nr));
+			_mm_storeu_si128((__m128i*)lanes[l].output, x[l]);
+			lanes[l].input += AES_BLOCK_SIZE;
+			lanes[l].output += AES_BLOCK_SIZE;
+		}
+		nblocks--;
+	}
+
+	for (l = 0; l < count; ++l)
+		_mm_storeu_si128((__m128i*)lanes[l].iv, x[l]);
+}
+
+static AESNI_TARGET __m128i aesni_xts_mulx(const __m128i t) {
+	__m128i carry = _mm_srai_epi32(t, 31);
+	carry = _mm_and_si128(_mm_shuffle_epi32(carry, 0x93), _mm_set_epi32(1, 1, 1, 0x87));
+	return _mm_xor_si128(_mm_slli_epi32(t, 1), carry);
+}
+
+static AESNI_TARGET void aesni_xts(const struct aes_context_t* const ctx, uint8_t tweak[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	__m128i k[15];
+	__m128i t, x;
+
+	aesni_load_keys(ctx, k);
+
+	t = _mm_loadu_si128((const __m128i*)tweak);
+	while (nblocks > 0) {
+		x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)src), t);
+		if (ctx->mode == AES_DECRYPT)
+			x = aesni_decrypt_block(k, ctx->nr, x);
+		else
+			x = aesni_encrypt_block(k, ctx->nr, x);
+		_mm_storeu_si128((__m128i*)dst, _mm_xor_si128(x, t));
+		t = aesni_xts_mulx(t);
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+	_mm_storeu_si128((__m128i*)tweak, t);
+}
+
+const struct aes_backend_t aes_backend_aesni = {
+	.name = "aesni",
+	.supported = aesni_supported,
+	.expand_key = aesni_expand_key,
+	.invert_key = aesni_invert_key,
+	.ecb = aesni_ecb,
+	.cbc_encrypt = aesni_cbc_encrypt,
+	.cbc_decrypt = aesni_cbc_decrypt,
+	.ctr = aesni_ctr,
+	.xts = aesni_xts,
+	.max_lanes = 8,
+	.cbc_encrypt_lanes = aesni_cbc_encrypt_lanes,
+};
+
+#else
+
+static int aesni_supported(void) {
+	return 0;
+}
+
+const struct aes_backend_t aes_backend_aesni = {
+	.name = "aesni",
+	.supported = aesni_supported,
+};
+
+#endif
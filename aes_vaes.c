@@ -0,0 +1,175 @@
+//
+// VAES backends.
+//
+// The vector AES instructions run the AES-NI round on every 128-bit block of
+// a 256-bit or 512-bit register, so with enough independent blocks the
+// cipher keeps up with memory. Only the modes without a dependency between
+// blocks benefit: CTR, XTS and CBC decryption. Everything else, including
+// the tails of the bulk modes, is the AES-NI code (see crypto_init()).
+//
+
+#include "crypto_backend.h"
+
+#if defined(CPU_X86)
+
+#include <immintrin.h>
+
+static inline uint64_t vaes_load_be64(const uint8_t* const p) {
+	uint64_t x = 0;
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		x = (x << 8) | p[i];
+	return x;
+}
+
+static inline void vaes_store_be64(uint8_t* const p, uint64_t x) {
+	int i;
+
+	for (i = 7; i >= 0; --i) {
+		p[i] = (uint8_t)x;
+		x >>= 8;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// 256-bit vectors, 16 blocks per iteration
+//-----------------------------------------------------------------------------
+
+#define V_VEC __m256i
+#define V_WIDTH 2
+#define V_FN(name) name##_256
+#define V_TARGET __attribute__((target("aes,vaes,avx2")))
+#define V_LOADU(p) _mm256_loadu_si256((const __m256i*)(p))
+#define V_STOREU(p, x) _mm256_storeu_si256((__m256i*)(p), (x))
+#define V_XOR _mm256_xor_si256
+#define V_ADD64 _mm256_add_epi64
+#define V_SLLI64 _mm256_slli_epi64
+#define V_SRLI64 _mm256_srli_epi64
+#define V_BSLLI _mm256_bslli_epi128
+#define V_BSRLI _mm256_bsrli_epi128
+#define V_BSWAP _mm256_shuffle_epi8
+#define V_BROADCAST _mm256_broadcastsi128_si256
+#define V_PREV(cur, prev) _mm256_permute2x128_si256((prev), (cur), 0x21)
+#define V_LAST(x) _mm256_extracti128_si256((x), 1)
+#define V_ENC _mm256_aesenc_epi128
+#define V_ENCLAST _mm256_aesenclast_epi128
+#define V_DEC _mm256_aesdec_epi128
+#define V_DECLAST _mm256_aesdeclast_epi128
+#define V_CTR_OFFSETS _mm256_set_epi64x(0, 1, 0, 0)
+
+#include "aes_vaes_core.h"
+
+#undef V_CTR_OFFSETS
+#undef V_DECLAST
+#undef V_DEC
+#undef V_ENCLAST
+#undef V_ENC
+#undef V_LAST
+#undef V_PREV
+#undef V_BROADCAST
+#undef V_BSWAP
+#undef V_BSRLI
+#undef V_BSLLI
+#undef V_SRLI64
+#undef V_SLLI64
+#undef V_ADD64
+#undef V_XOR
+#undef V_STOREU
+#undef V_LOADU
+#undef V_TARGET
+#undef V_FN
+#undef V_WIDTH
+#undef V_VEC
+
+static int vaes256_supported(void) {
+	return aes_backend_aesni.supported() && cpu_has(CPU_FEATURE_VAES | CPU_FEATURE_AVX2);
+}
+
+const struct aes_backend_t aes_backend_vaes256 = {
+	.name = "vaes256",
+	.supported = vaes256_supported,
+	.cbc_decrypt = vaes_cbc_decrypt_256,
+	.ctr = vaes_ctr_256,
+	.xts = vaes_xts_256,
+};
+
+//-----------------------------------------------------------------------------
+// 512-bit vectors, 32 blocks per iteration
+//-----------------------------------------------------------------------------
+
+#define V_VEC __m512i
+#define V_WIDTH 4
+#define V_FN(name) name##_512
+#define V_TARGET __attribute__((target("aes,vaes,avx512f,avx512bw")))
+#define V_LOADU(p) _mm512_loadu_si512((const void*)(p))
+#define V_STOREU(p, x) _mm512_storeu_si512((void*)(p), (x))
+#define V_XOR _mm512_xor_si512
+#define V_ADD64 _mm512_add_epi64
+#define V_SLLI64 _mm512_slli_epi64
+#define V_SRLI64 _mm512_srli_epi64
+#define V_BSLLI _mm512_bslli_epi128
+#define V_BSRLI _mm512_bsrli_epi128
+#define V_BSWAP _mm512_shuffle_epi8
+#define V_BROADCAST _mm512_broadcast_i32x4
+#define V_PREV(cur, prev) _mm512_alignr_epi64((cur), (prev), 6)
+#define V_LAST(x) _mm512_extracti32x4_epi32((x), 3)
+#define V_ENC _mm512_aesenc_epi128
+#define V_ENCLAST _mm512_aesenclast_epi128
+#define V_DEC _mm512_aesdec_epi128
+#define V_DECLAST _mm512_aesdeclast_epi128
+#define V_CTR_OFFSETS _mm512_set_epi64(0, 3, 0, 2, 0, 1, 0, 0)
+
+#include "aes_vaes_core.h"
+
+#undef V_CTR_OFFSETS
+#undef V_DECLAST
+#undef V_DEC
+#undef V_ENCLAST
+#undef V_ENC
+#undef V_LAST
+#undef V_PREV
+#undef V_BROADCAST
+#undef V_BSWAP
+#undef V_BSRLI
+#undef V_BSLLI
+#undef V_SRLI64
+#undef V_SLLI64
+#undef V_ADD64
+#undef V_XOR
+#undef V_STOREU
+#undef V_LOADU
+#undef V_TARGET
+#undef V_FN
+#undef V_WIDTH
+#undef V_VEC
+
+static int vaes512_supported(void) {
+	return aes_backend_aesni.supported() && cpu_has(CPU_FEATURE_VAES | CPU_FEATURE_AVX512);
+}
+
+const struct aes_backend_t aes_backend_vaes512 = {
+	.name = "vaes512",
+	.supported = vaes512_supported,
+	.cbc_decrypt = vaes_cbc_decrypt_512,
+	.ctr = vaes_ctr_512,
+	.xts = vaes_xts_512,
+};
+
+#else
+
+static int vaes_supported(void) {
+	return 0;
+}
+
+const struct aes_backend_t aes_backend_vaes256 = {
+	.name = "vaes256",
+	.supported = vaes_supported,
+};
+
+const struct aes_backend_t aes_backend_vaes512 = {
+	.name = "vaes512",
+	.supported = vaes_supported,
+};
+
+#endif
@@ -0,0 +1,226 @@
+//
+// VAES bulk mode kernels, instantiated by aes_vaes.c once per vector width.
+//
+// Expects:
+//   V_VEC                  vector type
+//   V_WIDTH                number of blocks per vector
+//   V_FN(name)             name mangling for this instantiation
+//   V_TARGET               function attributes for this instantiation
+//   V_LOADU, V_STOREU      unaligned load and store
+//   V_XOR, V_ADD64         bitwise xor, 64-bit element addition
+//   V_SLLI64, V_SRLI64     64-bit element shifts
+//   V_BSLLI, V_BSRLI       byte shifts within each block
+//   V_BSWAP                byte shuffle within each block
+//   V_BROADCAST            copies a __m128i into every block
+//   V_PREV(cur, prev)      blocks preceding those of cur, the first one
+//                          being the last block of prev
+//   V_LAST                 last block as a __m128i
+//   V_ENC, V_ENCLAST, V_DEC, V_DECLAST  AES rounds
+//   V_CTR_OFFSETS          counter offsets of the blocks of a vector
+//
+// Each iteration keeps 8 vectors in flight, that is 16 blocks with 256-bit
+// and 32 blocks with 512-bit vectors. The remaining blocks are left to the
+// AES-NI code.
+//
+
+#define V_BATCH (8 * V_WIDTH)
+
+#define V_LOAD8(p) \
+	c0 = V_LOADU((p) + 0 * V_WIDTH * AES_BLOCK_SIZE); c1 = V_LOADU((p) + 1 * V_WIDTH * AES_BLOCK_SIZE); \
+	c2 = V_LOADU((p) + 2 * V_WIDTH * AES_BLOCK_SIZE); c3 = V_LOADU((p) + 3 * V_WIDTH * AES_BLOCK_SIZE); \
+	c4 = V_LOADU((p) + 4 * V_WIDTH * AES_BLOCK_SIZE); c5 = V_LOADU((p) + 5 * V_WIDTH * AES_BLOCK_SIZE); \
+	c6 = V_LOADU((p) + 6 * V_WIDTH * AES_BLOCK_SIZE); c7 = V_LOADU((p) + 7 * V_WIDTH * AES_BLOCK_SIZE)
+
+#define V_STORE8(p) \
+	V_STOREU((p) + 0 * V_WIDTH * AES_BLOCK_SIZE, x0); V_STOREU((p) + 1 * V_WIDTH * AES_BLOCK_SIZE, x1); \
+	V_STOREU((p) + 2 * V_WIDTH * AES_BLOCK_SIZE, x2); V_STOREU((p) + 3 * V_WIDTH * AES_BLOCK_SIZE, x3); \
+	V_STOREU((p) + 4 * V_WIDTH * AES_BLOCK_SIZE, x4); V_STOREU((p) + 5 * V_WIDTH * AES_BLOCK_SIZE, x5); \
+	V_STOREU((p) + 6 * V_WIDTH * AES_BLOCK_SIZE, x6); V_STOREU((p) + 7 * V_WIDTH * AES_BLOCK_SIZE, x7)
+
+#define V_ROUND8(op, key) \
+	x0 = op(x0, key); x1 = op(x1, key); x2 = op(x2, key); x3 = op(x3, key); \
+	x4 = op(x4, key); x5 = op(x5, key); x6 = op(x6, key); x7 = op(x7, key)
+
+#define V_CIPHER8(round, last) \
+	for (i = 1; i < ctx->nr; ++i) { \
+		V_ROUND8(round, k[i]); \
+	} \
+	V_ROUND8(last, k[ctx->nr])
+
+static V_TARGET void V_FN(vaes_load_keys)(const struct aes_context_t* const ctx, V_VEC k[15]) {
+	const __m128i* const rk = (const __m128i*)ctx->rk;
+	int i;
+
+	for (i = 0; i <= ctx->nr; ++i)
+		k[i] = V_BROADCAST(_mm_loadu_si128(rk + i));
+}
+
+//
+// Multiplies the tweak of every block by x^V_WIDTH, which advances each one
+// by a whole vector
+//
+static V_TARGET V_VEC V_FN(vaes_xts_mulx)(const V_VEC t) {
+	V_VEC c, h, r;
+
+	c = V_SRLI64(t, 64 - V_WIDTH);
+	r = V_XOR(V_SLLI64(t, V_WIDTH), V_BSLLI(c, 8));
+
+	// reduction of the bits shifted out of the block, times x^7 + x^2 + x + 1
+	h = V_BSRLI(c, 8);
+	r = V_XOR(r, V_XOR(h, V_SLLI64(h, 1)));
+	return V_XOR(r, V_XOR(V_SLLI64(h, 2), V_SLLI64(h, 7)));
+}
+
+static V_TARGET void V_FN(vaes_cbc_decrypt)(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	V_VEC k[15];
+	V_VEC prev;
+	V_VEC c0, c1, c2, c3, c4, c5, c6, c7;
+	V_VEC x0, x1, x2, x3, x4, x5, x6, x7;
+	int i;
+
+	if (nblocks >= V_BATCH) {
+		V_FN(vaes_load_keys)(ctx, k);
+
+		prev = V_BROADCAST(_mm_loadu_si128((const __m128i*)iv));
+		while (nblocks >= V_BATCH) {
+			V_LOAD8(src);
+
+			x0 = V_XOR(c0, k[0]); x1 = V_XOR(c1, k[0]); x2 = V_XOR(c2, k[0]); x3 = V_XOR(c3, k[0]);
+			x4 = V_XOR(c4, k[0]); x5 = V_XOR(c5, k[0]); x6 = V_XOR(c6, k[0]); x7 = V_XOR(c7, k[0]);
+			V_CIPHER8(V_DEC, V_DECLAST);
+
+			x0 = V_XOR(x0, V_PREV(c0, prev)); x1 = V_XOR(x1, V_PREV(c1, c0));
+			x2 = V_XOR(x2, V_PREV(c2, c1)); x3 = V_XOR(x3, V_PREV(c3, c2));
+			x4 = V_XOR(x4, V_PREV(c4, c3)); x5 = V_XOR(x5, V_PREV(c5, c4));
+			x6 = V_XOR(x6, V_PREV(c6, c5)); x7 = V_XOR(x7, V_PREV(c7, c6));
+			V_STORE8(dst);
+			prev = c7;
+
+			src += V_BATCH * AES_BLOCK_SIZE;
+			dst += V_BATCH * AES_BLOCK_SIZE;
+			nblocks -= V_BATCH;
+		}
+		_mm_storeu_si128((__m128i*)iv, V_LAST(prev));
+	}
+
+	if (nblocks > 0)
+		aes_backend_aesni.cbc_decrypt(ctx, iv, src, dst, nblocks);
+}
+
+static V_TARGET void V_FN(vaes_ctr)(const struct aes_context_t* const ctx, uint8_t counter[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	V_VEC k[15];
+	V_VEC bswap, step, ctr;
+	V_VEC c0, c1, c2, c3, c4, c5, c6, c7;
+	V_VEC x0, x1, x2, x3, x4, x5, x6, x7;
+	uint64_t hi, lo;
+	int i;
+
+	if (nblocks >= V_BATCH) {
+		V_FN(vaes_load_keys)(ctx, k);
+
+		bswap = V_BROADCAST(_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+		step = V_BROADCAST(_mm_set_epi64x(0, V_WIDTH));
+
+		while (nblocks >= V_BATCH) {
+			hi = vaes_load_be64(counter);
+			lo = vaes_load_be64(counter + 8);
+
+			if (lo > UINT64_MAX - (V_BATCH - 1)) {
+				// the carry into the upper half is rare enough for the one block at a time code
+				aes_backend_aesni.ctr(ctx, counter, src, dst, V_BATCH);
+			} else {
+				// the counters are added in little endian order and swapped back per block
+				ctr = V_ADD64(V_BROADCAST(_mm_set_epi64x(hi, lo)), V_CTR_OFFSETS);
+				x0 = V_BSWAP(ctr, bswap); ctr = V_ADD64(ctr, step);
+				x1 = V_BSWAP(ctr, bswap); ctr = V_ADD64(ctr, step);
+				x2 = V_BSWAP(ctr, bswap); ctr = V_ADD64(ctr, step);
+				x3 = V_BSWAP(ctr, bswap); ctr = V_ADD64(ctr, step);
+				x4 = V_BSWAP(ctr, bswap); ctr = V_ADD64(ctr, step);
+				x5 = V_BSWAP(ctr, bswap); ctr = V_ADD64(ctr, step);
+				x6 = V_BSWAP(ctr, bswap); ctr = V_ADD64(ctr, step);
+				x7 = V_BSWAP(ctr, bswap);
+
+				V_ROUND8(V_XOR, k[0]);
+				V_CIPHER8(V_ENC, V_ENCLAST);
+
+				V_LOAD8(src);
+				x0 = V_XOR(x0, c0); x1 = V_XOR(x1, c1); x2 = V_XOR(x2, c2); x3 = V_XOR(x3, c3);
+				x4 = V_XOR(x4, c4); x5 = V_XOR(x5, c5); x6 = V_XOR(x6, c6); x7 = V_XOR(x7, c7);
+				V_STORE8(dst);
+
+				lo += V_BATCH;
+				if (lo == 0)
+					hi++;
+				vaes_store_be64(counter, hi);
+				vaes_store_be64(counter + 8, lo);
+			}
+
+			src += V_BATCH * AES_BLOCK_SIZE;
+			dst += V_BATCH * AES_BLOCK_SIZE;
+			nblocks -= V_BATCH;
+		}
+	}
+
+	if (nblocks > 0)
+		aes_backend_aesni.ctr(ctx, counter, src, dst, nblocks);
+}
+
+static V_TARGET void V_FN(vaes_xts)(const struct aes_context_t* const ctx, uint8_t tweak[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	uint8_t tweaks[V_WIDTH * AES_BLOCK_SIZE];
+	V_VEC k[15];
+	V_VEC t;
+	V_VEC c0, c1, c2, c3, c4, c5, c6, c7;
+	V_VEC t0, t1, t2, t3, t4, t5, t6, t7;
+	V_VEC x0, x1, x2, x3, x4, x5, x6, x7;
+	int i;
+
+	if (nblocks >= V_BATCH) {
+		V_FN(vaes_load_keys)(ctx, k);
+
+		memcpy(tweaks, tweak, AES_BLOCK_SIZE);
+		for (i = 1; i < V_WIDTH; ++i) {
+			memcpy(tweaks + i * AES_BLOCK_SIZE, tweaks + (i - 1) * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+			aes_xts_mulx(tweaks + i * AES_BLOCK_SIZE);
+		}
+		t = V_LOADU(tweaks);
+
+		while (nblocks >= V_BATCH) {
+			t0 = t; t1 = V_FN(vaes_xts_mulx)(t0);
+			t2 = V_FN(vaes_xts_mulx)(t1); t3 = V_FN(vaes_xts_mulx)(t2);
+			t4 = V_FN(vaes_xts_mulx)(t3); t5 = V_FN(vaes_xts_mulx)(t4);
+			t6 = V_FN(vaes_xts_mulx)(t5); t7 = V_FN(vaes_xts_mulx)(t6);
+			t = V_FN(vaes_xts_mulx)(t7);
+
+			V_LOAD8(src);
+			x0 = V_XOR(c0, V_XOR(t0, k[0])); x1 = V_XOR(c1, V_XOR(t1, k[0]));
+			x2 = V_XOR(c2, V_XOR(t2, k[0])); x3 = V_XOR(c3, V_XOR(t3, k[0]));
+			x4 = V_XOR(c4, V_XOR(t4, k[0])); x5 = V_XOR(c5, V_XOR(t5, k[0]));
+			x6 = V_XOR(c6, V_XOR(t6, k[0])); x7 = V_XOR(c7, V_XOR(t7, k[0]));
+
+			if (ctx->mode == AES_DECRYPT) {
+				V_CIPHER8(V_DEC, V_DECLAST);
+			} else {
+				V_CIPHER8(V_ENC, V_ENCLAST);
+			}
+
+			x0 = V_XOR(x0, t0); x1 = V_XOR(x1, t1); x2 = V_XOR(x2, t2); x3 = V_XOR(x3, t3);
+			x4 = V_XOR(x4, t4); x5 = V_XOR(x5, t5); x6 = V_XOR(x6, t6); x7 = V_XOR(x7, t7);
+			V_STORE8(dst);
+
+			src += V_BATCH * AES_BLOCK_SIZE;
+			dst += V_BATCH * AES_BLOCK_SIZE;
+			nblocks -= V_BATCH;
+		}
+		V_STOREU(tweaks, t);
+		memcpy(tweak, tweaks, AES_BLOCK_SIZE);
+	}
+
+	if (nblocks > 0)
+		aes_backend_aesni.xts(ctx, tweak, src, dst, nblocks);
+}
+
+#undef V_CIPHER8
+#undef V_ROUND8
+#undef V_STORE8
+#undef V_LOAD8
+#undef V_BATCH
@@ -0,0 +1,431 @@
+//
+// Vector permute AES backend.
+//
+// Byte substitution is computed instead of looked up: the state is mapped
+// into the tower field GF((2^4)^2) = GF(16)[Y] / (Y^2 + Y + 8), with
+// GF(16) = GF(2)[z] / (z^4 + z + 1), where inversion only needs a handful
+// of GF(16) operations. Every GF(16) operation is a 16-entry table indexed
+// by a nibble, i.e. a single byte shuffle, and the only memory accesses are
+// to the fixed tables below, so the run time does not depend on the data.
+//
+// Products of two variable nibbles go through log/exp tables: logs are
+// added with unsigned saturation, reduced modulo 15 with a min, and log(0)
+// is 0xF0 so that any product with zero ends up with the high bit set,
+// which makes the shuffle return zero.
+//
+// The nibble tables would work unchanged with AltiVec vperm, only the SSSE3
+// flavour is implemented here.
+//
+
+#include "crypto_backend.h"
+
+#if defined(CPU_X86)
+
+#include <immintrin.h>
+
+#define VPERM_TARGET __attribute__((target("ssse3")))
+
+//
+// Number of blocks processed side by side by the bulk modes
+//
+#define VPERM_BLOCKS 4
+
+struct vperm_sbox_t {
+	uint8_t in_lo[16]; // low nibble to tower field
+	uint8_t in_hi[16]; // high nibble to tower field
+	uint8_t out_hi[16]; // Y coefficient back to the AES field
+	uint8_t out_lo[16]; // constant coefficient back to the AES field
+};
+
+// S-box: tower field basis in, affine transformation out
+static const struct vperm_sbox_t vperm_enc_sbox __attribute__((aligned(16))) = {
+	{ 0x00, 0x01, 0x20, 0x21, 0x46, 0x47, 0x66, 0x67, 0x4C, 0x4D, 0x6C, 0x6D, 0x0A, 0x0B, 0x2A, 0x2B },
+	{ 0x00, 0x3C, 0xD5, 0xE9, 0x34, 0x08, 0xE1, 0xDD, 0xE5, 0xD9, 0x30, 0x0C, 0xD1, 0xED, 0x04, 0x38 },
+	{ 0x00, 0x52, 0x3E, 0x6C, 0x65, 0x37, 0x5B, 0x09, 0x60, 0x32, 0x5E, 0x0C, 0x05, 0x57, 0x3B, 0x69 },
+	{ 0x63, 0x7C, 0xD1, 0xCE, 0xC8, 0xD7, 0x7A, 0x65, 0x55, 0x4A, 0xE7, 0xF8, 0xFE, 0xE1, 0x4C, 0x53 },
+};
+
+// inverse S-box: inverse affine transformation in, AES field basis out
+static const struct vperm_sbox_t vperm_dec_sbox __attribute__((aligned(16))) = {
+	{ 0x47, 0x1F, 0xD8, 0x80, 0xDF, 0x87, 0x40, 0x18, 0x6F, 0x37, 0xF0, 0xA8, 0xF7, 0xAF, 0x68, 0x30 },
+	{ 0x00, 0x76, 0x79, 0x0F, 0xF9, 0x8F, 0x80, 0xF6, 0x92, 0xE4, 0xEB, 0x9D, 0x6B, 0x1D, 0x12, 0x64 },
+	{ 0x00, 0xA2, 0x02, 0xA0, 0xB8, 0x1A, 0xBA, 0x18, 0xDB, 0x79, 0xD9, 0x7B, 0x63, 0xC1, 0x61, 0xC3 },
+	{ 0x00, 0x01, 0x5C, 0x5D, 0xE0, 0xE1, 0xBC, 0xBD, 0x50, 0x51, 0x0C, 0x0D, 0xB0, 0xB1, 0xEC, 0xED },
+};
+
+// GF(16) tables
+static const uint8_t vperm_log[16] __attribute__((aligned(16))) = {
+	0xF0, 0x00, 0x01, 0x04, 0x02, 0x08, 0x05, 0x0A, 0x03, 0x0E, 0x09, 0x07, 0x06, 0x0D, 0x0B, 0x0C
+};
+
+static const uint8_t vperm_log_inverse[16] __attribute__((aligned(16))) = {
+	0xF0, 0x00, 0x0E, 0x0B, 0x0D, 0x07, 0x0A, 0x05, 0x0C, 0x01, 0x06, 0x08, 0x09, 0x02, 0x04, 0x03
+};
+
+static const uint8_t vperm_exp[16] __attribute__((aligned(16))) = {
+	0x01, 0x02, 0x04, 0x08, 0x03, 0x06, 0x0C, 0x0B, 0x05, 0x0A, 0x07, 0x0E, 0x0F, 0x0D, 0x09, 0x00
+};
+
+static const uint8_t vperm_square[16] __attribute__((aligned(16))) = {
+	0x00, 0x01, 0x04, 0x05, 0x03, 0x02, 0x07, 0x06, 0x0C, 0x0D, 0x08, 0x09, 0x0F, 0x0E, 0x0B, 0x0A
+};
+
+static const uint8_t vperm_lambda_square[16] __attribute__((aligned(16))) = {
+	0x00, 0x08, 0x06, 0x0E, 0x0B, 0x03, 0x0D, 0x05, 0x0A, 0x02, 0x0C, 0x04, 0x01, 0x09, 0x07, 0x0F
+};
+
+static int vperm_supported(void) {
+	return cpu_has(CPU_FEATURE_SSSE3);
+}
+
+static VPERM_TARGET inline __m128i vperm_lookup(const uint8_t table[16], const __m128i index) {
+	return _mm_shuffle_epi8(_mm_load_si128((const __m128i*)table), index);
+}
+
+//
+// Product of two GF(16) elements given by their logs
+//
+static VPERM_TARGET inline __m128i vperm_mul_log(const __m128i log_x, const __m128i log_y) {
+	const __m128i s = _mm_adds_epu8(log_x, log_y);
+
+	return vperm_lookup(vperm_exp, _mm_min_epu8(s, _mm_sub_epi8(s, _mm_set1_epi8(15))));
+}
+
+static VPERM_TARGET inline __m128i vperm_sub_bytes(const __m128i x, const struct vperm_sbox_t* const sbox) {
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	__m128i t, a, b, log_a, log_delta;
+
+	// x = a * Y + b in the tower field
+	t = _mm_xor_si128(vperm_lookup(sbox->in_lo, _mm_and_si128(x, nibble)), vperm_lookup(sbox->in_hi, _mm_and_si128(_mm_srli_epi16(x, 4), nibble)));
+	a = _mm_and_si128(_mm_srli_epi16(t, 4), nibble);
+	b = _mm_and_si128(t, nibble);
+
+	// 1 / x = (a * Y + a + b) / delta, delta = 8 * a^2 + a * b + b^2
+	log_a = vperm_lookup(vperm_log, a);
+	t = vperm_mul_log(log_a, vperm_lookup(vperm_log, b));
+	t = _mm_xor_si128(t, _mm_xor_si128(vperm_lookup(vperm_lambda_square, a), vperm_lookup(vperm_square, b)));
+	log_delta = vperm_lookup(vperm_log_inverse, t);
+
+	b = vperm_mul_log(vperm_lookup(vperm_log, _mm_xor_si128(a, b)), log_delta);
+	a = vperm_mul_log(log_a, log_delta);
+
+	return _mm_xor_si128(vperm_lookup(sbox->out_hi, a), vperm_lookup(sbox->out_lo, b));
+}
+
+static VPERM_TARGET inline __m128i vperm_xtime(const __m128i x) {
+	const __m128i carry = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+
+	return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(carry, _mm_set1_epi8(0x1B)));
+}
+
+static VPERM_TARGET inline __m128i vperm_mix_columns(const __m128i x) {
+	const __m128i rot1 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+	const __m128i rot2 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m128i t = _mm_shuffle_epi8(x, rot1);
+	const __m128i u = _mm_xor_si128(x, t);
+
+	// 2 * a0 + 3 * a1 + a2 + a3 = 2 * (a0 + a1) + a1 + (a2 + a3)
+	return _mm_xor_si128(_mm_xor_si128(vperm_xtime(u), t), _mm_shuffle_epi8(u, rot2));
+}
+
+static VPERM_TARGET inline __m128i vperm_inv_mix_columns(const __m128i x) {
+	const __m128i rot2 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m128i u = vperm_xtime(vperm_xtime(_mm_xor_si128(x, _mm_shuffle_epi8(x, rot2))));
+
+	// InvMixColumns(x) = MixColumns(x + 4 * (x + rot2(x)))
+	return vperm_mix_columns(_mm_xor_si128(x, u));
+}
+
+static VPERM_TARGET inline __m128i vperm_encrypt_round(const __m128i x, const __m128i k) {
+	const __m128i shift_rows = _mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11);
+
+	return _mm_xor_si128(vperm_mix_columns(_mm_shuffle_epi8(vperm_sub_bytes(x, &vperm_enc_sbox), shift_rows)), k);
+}
+
+static VPERM_TARGET inline __m128i vperm_encrypt_last(const __m128i x, const __m128i k) {
+	const __m128i shift_rows = _mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11);
+
+	return _mm_xor_si128(_mm_shuffle_epi8(vperm_sub_bytes(x, &vperm_enc_sbox), shift_rows), k);
+}
+
+static VPERM_TARGET inline __m128i vperm_decrypt_round(const __m128i x, const __m128i k) {
+	const __m128i inv_shift_rows = _mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+
+	return _mm_xor_si128(vperm_inv_mix_columns(_mm_shuffle_epi8(vperm_sub_bytes(x, &vperm_dec_sbox), inv_shift_rows)), k);
+}
+
+static VPERM_TARGET inline __m128i vperm_decrypt_last(const __m128i x, const __m128i k) {
+	const __m128i inv_shift_rows = _mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+
+	return _mm_xor_si128(_mm_shuffle_epi8(vperm_sub_bytes(x, &vperm_dec_sbox), inv_shift_rows), k);
+}
+
+static VPERM_TARGET uint32_t vperm_sub_word(const uint32_t w) {
+	return (uint32_t)_mm_cvtsi128_si32(vperm_sub_bytes(_mm_cvtsi32_si128((int)w), &vperm_enc_sbox));
+}
+
+//
+// FIPS-197 key expansion with the table free S-box
+//
+static VPERM_TARGET int vperm_expand_key(uint32_t* const rk, const uint8_t* const key, const unsigned int key_size) {
+	const int nk = key_size >> 5;
+	uint32_t rcon = 0x01;
+	uint32_t t;
+	int i, n;
+
+	switch (key_size) {
+		case 128: n = 44; break;
+		case 192: n = 52; break;
+		case 256: n = 60; break;
+		default:
+			return -1;
+	}
+
+	for (i = 0; i < nk; ++i)
+		rk[i] = (uint32_t)key[4 * i] | ((uint32_t)key[4 * i + 1] << 8) | ((uint32_t)key[4 * i + 2] << 16) | ((uint32_t)key[4 * i + 3] << 24);
+
+	for (i = nk; i < n; ++i) {
+		t = rk[i - 1];
+		if (i % nk == 0) {
+			t = vperm_sub_word((t >> 8) | (t << 24)) ^ rcon;
+			rcon = ((rcon << 1) ^ ((rcon >> 7) * 0x1B)) & 0xFF;
+		} else if (nk == 8 && i % nk == 4) {
+			t = vperm_sub_word(t);
+		}
+		rk[i] = rk[i - nk] ^ t;
+	}
+
+	return 0;
+}
+
+static VPERM_TARGET void vperm_invert_key(uint32_t* const drk, const uint32_t* const erk, const int nr) {
+	const __m128i* const ek = (const __m128i*)erk;
+	__m128i* const dk = (__m128i*)drk;
+	int i;
+
+	_mm_storeu_si128(dk, _mm_loadu_si128(ek + nr));
+	for (i = 1; i < nr; ++i)
+		_mm_storeu_si128(dk + i, vperm_inv_mix_columns(_mm_loadu_si128(ek + nr - i)));
+	_mm_storeu_si128(dk + nr, _mm_loadu_si128(ek));
+}
+
+static VPERM_TARGET __m128i vperm_encrypt_block(const struct aes_context_t* const ctx, __m128i x) {
+	const __m128i* const rk = (const __m128i*)ctx->rk;
+	int i;
+
+	x = _mm_xor_si128(x, _mm_loadu_si128(rk));
+	for (i = 1; i < ctx->nr; ++i)
+		x = vperm_encrypt_round(x, _mm_loadu_si128(rk + i));
+	return vperm_encrypt_last(x, _mm_loadu_si128(rk + ctx->nr));
+}
+
+//
+// Runs VPERM_BLOCKS independent blocks through the cipher in the direction
+// of the context, the shuffles of different blocks overlap
+//
+static VPERM_TARGET void vperm_crypt_blocks(const struct aes_context_t* const ctx, __m128i x[VPERM_BLOCKS]) {
+	const __m128i* const rk = (const __m128i*)ctx->rk;
+	__m128i k;
+	int i, j;
+
+	k = _mm_loadu_si128(rk);
+	for (j = 0; j < VPERM_BLOCKS; ++j)
+		x[j] = _mm_xor_si128(x[j], k);
+
+	if (ctx->mode == AES_DECRYPT) {
+		for (i = 1; i < ctx->nr; ++i) {
+			k = _mm_loadu_si128(rk + i);
+			for (j = 0; j < VPERM_BLOCKS; ++j)
+				x[j] = vperm_decrypt_round(x[j], k);
+		}
+
+		k = _mm_loadu_si128(rk + ctx->nr);
+		for (j = 0; j < VPERM_BLOCKS; ++j)
+			x[j] = vperm_decrypt_last(x[j], k);
+	} else {
+		for (i = 1; i < ctx->nr; ++i) {
+			k = _mm_loadu_si128(rk + i);
+			for (j = 0; j < VPERM_BLOCKS; ++j)
+				x[j] = vperm_encrypt_round(x[j], k);
+		}
+
+		k = _mm_loadu_si128(rk + ctx->nr);
+		for (j = 0; j < VPERM_BLOCKS; ++j)
+			x[j] = vperm_encrypt_last(x[j], k);
+	}
+}
+
+static VPERM_TARGET void vperm_ecb(const struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
+	const __m128i* const rk = (const __m128i*)ctx->rk;
+	__m128i x;
+	int i;
+
+	x = _mm_loadu_si128((const __m128i*)input);
+	if (ctx->mode == AES_DECRYPT) {
+		x = _mm_xor_si128(x, _mm_loadu_si128(rk));
+		for (i = 1; i < ctx->nr; ++i)
+			x = vperm_decrypt_round(x, _mm_loadu_si128(rk + i));
+		x = vperm_decrypt_last(x, _mm_loadu_si128(rk + ctx->nr));
+	} else {
+		x = vperm_encrypt_block(ctx, x);
+	}
+	_mm_storeu_si128((__m128i*)output, x);
+}
+
+static VPERM_TARGET void vperm_cbc_encrypt(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	__m128i x;
+
+	x = _mm_loadu_si128((const __m128i*)iv);
+	while (nblocks > 0) {
+		x = vperm_encrypt_block(ctx, _mm_xor_si128(x, _mm_loadu_si128((const __m128i*)src)));
+		_mm_storeu_si128((__m128i*)dst, x);
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+	_mm_storeu_si128((__m128i*)iv, x);
+}
+
+static VPERM_TARGET void vperm_cbc_decrypt(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	__m128i prev, c[VPERM_BLOCKS], x[VPERM_BLOCKS];
+	uint32_t n, j;
+
+	prev = _mm_loadu_si128((const __m128i*)iv);
+	while (nblocks > 0) {
+		n = (nblocks < VPERM_BLOCKS) ? nblocks : VPERM_BLOCKS;
+
+		// a short tail is padded with copies of its first block
+		for (j = 0; j < VPERM_BLOCKS; ++j)
+			x[j] = c[j] = _mm_loadu_si128((const __m128i*)src + ((j < n) ? j : 0));
+
+		vperm_crypt_blocks(ctx, x);
+
+		for (j = 0; j < n; ++j) {
+			_mm_storeu_si128((__m128i*)dst + j, _mm_xor_si128(x[j], prev));
+			prev = c[j];
+		}
+
+		src += n * AES_BLOCK_SIZE;
+		dst += n * AES_BLOCK_SIZE;
+		nblocks -= n;
+	}
+	_mm_storeu_si128((__m128i*)iv, prev);
+}
+
+static VPERM_TARGET void vperm_ctr(const struct aes_context_t* const ctx, uint8_t counter[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	__m128i x[VPERM_BLOCKS];
+	uint32_t n, j;
+
+	while (nblocks > 0) {
+		n = (nblocks < VPERM_BLOCKS) ? nblocks : VPERM_BLOCKS;
+
+		for (j = 0; j < VPERM_BLOCKS; ++j) {
+			x[j] = _mm_loadu_si128((const __m128i*)counter);
+			if (j < n)
+				aes_ctr_increment(counter);
+		}
+
+		vperm_crypt_blocks(ctx, x);
+
+		for (j = 0; j < n; ++j)
+			_mm_storeu_si128((__m128i*)dst + j, _mm_xor_si128(x[j], _mm_loadu_si128((const __m128i*)src + j)));
+
+		src += n * AES_BLOCK_SIZE;
+		dst += n * AES_BLOCK_SIZE;
+		nblocks -= n;
+	}
+}
+
+static VPERM_TARGET __m128i vperm_xts_mulx(const __m128i t) {
+	__m128i carry = _mm_srai_epi32(t, 31);
+	carry = _mm_and_si128(_mm_shuffle_epi32(carry, 0x93), _mm_set_epi32(1, 1, 1, 0x87));
+	return _mm_xor_si128(_mm_slli_epi32(t, 1), carry);
+}
+
+static VPERM_TARGET void vperm_xts(const struct aes_context_t* const ctx, uint8_t tweak[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	__m128i t, tweaks[VPERM_BLOCKS], x[VPERM_BLOCKS];
+	uint32_t n, j;
+
+	t = _mm_loadu_si128((const __m128i*)tweak);
+	while (nblocks > 0) {
+		n = (nblocks < VPERM_BLOCKS) ? nblocks : VPERM_BLOCKS;
+
+		for (j = 0; j < VPERM_BLOCKS; ++j) {
+			tweaks[j] = t;
+			x[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)src + ((j < n) ? j : 0)), t);
+			if (j < n)
+				t = vperm_xts_mulx(t);
+		}
+
+		vperm_crypt_blocks(ctx, x);
+
+		for (j = 0; j < n; ++j)
+			_mm_storeu_si128((__m128i*)dst + j, _mm_xor_si128(x[j], tweaks[j]));
+
+		src += n * AES_BLOCK_SIZE;
+		dst += n * AES_BLOCK_SIZE;
+		nblocks -= n;
+	}
+	_mm_storeu_si128((__m128i*)tweak, t);
+}
+
+static VPERM_TARGET void vperm_cbc_encrypt_lanes(struct aes_lane_cursor_t* const lanes, const uint32_t count, const int nr, uint32_t nblocks) {
+	__m128i x[VPERM_BLOCKS];
+	uint32_t l;
+	int i;
+
+	for (l = 0; l < VPERM_BLOCKS; ++l)
+		x[l] = (l < count) ? _mm_loadu_si128((const __m128i*)lanes[l].iv) : _mm_setzero_si128();
+
+	while (nblocks > 0) {
+		for (l = 0; l < count; ++l)
+			x[l] = _mm_xor_si128(x[l], _mm_xor_si128(_mm_loadu_si128((const __m128i*)lanes[l].input), _mm_loadu_si128((const __m128i*)lanes[l].rk)));
+
+		// unused lanes just run on the first key schedule
+		for (i = 1; i < nr; ++i) {
+			for (l = 0; l < VPERM_BLOCKS; ++l)
+				x[l] = vperm_encrypt_round(x[l], _mm_loadu_si128((const __m128i*)lanes[(l < count) ? l : 0].rk + i));
+		}
+
+		for (l = 0; l < VPERM_BLOCKS; ++l)
+			x[l] = vperm_encrypt_last(x[l], _mm_loadu_si128((const __m128i*)lanes[(l < count) ? l : 0].rk + nr));
+
+		for (l = 0; l < count; ++l) {
+			_mm_storeu_si128((__m128i*)lanes[l].output, x[l]);
+			lanes[l].input += AES_BLOCK_SIZE;
+			lanes[l].output += AES_BLOCK_SIZE;
+		}
+		nblocks--;
+	}
+
+	for (l = 0; l < count; ++l)
+		_mm_storeu_si128((__m128i*)lanes[l].iv, x[l]);
+}
+
+const struct aes_backend_t aes_backend_vperm = {
+	.name = "vperm",
+	.supported = vperm_supported,
+	.expand_key = vperm_expand_key,
+	.invert_key = vperm_invert_key,
+	.ecb = vperm_ecb,
+	.cbc_encrypt = vperm_cbc_encrypt,
+	.cbc_decrypt = vperm_cbc_decrypt,
+	.ctr = vperm_ctr,
+	.xts = vperm_xts,
+	.max_lanes = VPERM_BLOCKS,
+	.cbc_encrypt_lanes = vperm_cbc_encrypt_lanes,
+};
+
+#else
+
+static int vperm_supported(void) {
+	return 0;
+}
+
+const struct aes_backend_t aes_backend_vperm = {
+	.name = "vperm",
+	.supported = vperm_supported,
+};
+
+#endif
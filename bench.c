@@ -0,0 +1,493 @@
+//
+// Crypto micro-benchmarks, built and run by make bench
+//
+// Every operation is timed on every backend the host supports that implements
+// it, over message sizes from a single encrypted CDB up to multi-megabyte
+// sector runs, and the results are printed as JSON on stdout together with
+// the compiler flags of the build. Key setup is timed separately
+// and reported per operation. Cycle counts are TSC ticks, i.e. reference
+// cycles rather than core clock cycles, and are left out on other hosts.
+//
+// usage: sv_bench [min_ms]
+//   min_ms  minimum run time of every measurement, 50 ms by default
+//
+
+#include "common.h"
+#include "crypto.h"
+#include "crypto_backend.h"
+#include <stddef.h>
+
+#if defined(CPU_X86)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_MAX_SIZE (4 * 1024 * 1024)
+#define BENCH_SHA1_MESSAGES 64
+
+// compiler command line of the build, passed in by the Makefile
+#if !defined(BENCH_CFLAGS)
+#define BENCH_CFLAGS "unknown"
+#endif
+
+static const uint32_t bench_sizes[] = {
+	8, 16, 64, 256, 1024, 4096, 16384, 65536, 1024 * 1024, BENCH_MAX_SIZE,
+};
+
+static const struct aes_backend_t* const bench_aes_backends[] = {
+	&aes_backend_portable,
+	&aes_backend_compact,
+	&aes_backend_bitslice,
+	&aes_backend_vperm,
+	&aes_backend_bitslice_avx2,
+	&aes_backend_aesni,
+	&aes_backend_vaes256,
+	&aes_backend_vaes512,
+};
+
+static const struct sha1_backend_t* const bench_sha1_backends[] = {
+	&sha1_backend_portable,
+	&sha1_backend_ssse3,
+	&sha1_backend_avx2,
+	&sha1_backend_shani,
+};
+
+//
+// 3DES has no backend table of its own: everything runs on the portable
+// tables except des3_crypt_ecb_multi, which is bitsliced on AVX2 hosts and
+// falls back to the tables elsewhere. These describe which backend supplies
+// which function, so the same borrowed-function skip applies.
+//
+struct bench_des_backend_t {
+	const char* name;
+	int (*supported)(void);
+	int (*crypt_ecb)(des3_context* ctx, const unsigned char input[8], unsigned char output[8]);
+	int (*crypt_cbc)(des3_context* ctx, int mode, size_t length, unsigned char iv[8], const unsigned char* input, unsigned char* output);
+	int (*key_encrypt_cbc)(const des3_context* ctx, const unsigned char iv[8], const unsigned char* input, unsigned char* output, size_t length);
+	int (*crypt_ecb_multi)(des3_context* ctx, size_t length, const unsigned char* input, unsigned char* output);
+};
+
+static int bench_des_bitslice_avx2_supported(void) {
+#if defined(CPU_X86)
+	return cpu_has(CPU_FEATURE_AVX2);
+#else
+	return 0;
+#endif
+}
+
+static const struct bench_des_backend_t bench_des_backends[] = {
+	{ "portable", NULL, des3_crypt_ecb, des3_crypt_cbc, des3_key_encrypt_cbc, NULL },
+	{ "bitslice_avx2", bench_des_bitslice_avx2_supported, NULL, NULL, NULL, des3_crypt_ecb_multi },
+};
+
+static const uint8_t bench_key[32] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+};
+
+static uint8_t* bench_input;
+static uint8_t* bench_output;
+
+static struct aes_context_t bench_aes_enc;
+static struct aes_context_t bench_aes_dec;
+static struct aes_xts_context_t bench_aes_xts_ctx;
+static struct aes_key_t bench_aes_key;
+static struct sha1_hmac_key_t bench_hmac_key;
+static des3_context bench_des3_enc;
+
+//
+// One measured operation, size is 0 for key setup. member is the offset of
+// the backend function the operation runs on; a backend that leaves it to
+// another one is not measured, 0 measures every backend.
+//
+struct bench_op_t {
+	const char* name;
+	int (*run)(const uint32_t size);
+	size_t member;
+};
+
+#define BENCH_AES(member) offsetof(struct aes_backend_t, member)
+#define BENCH_SHA1(member) offsetof(struct sha1_backend_t, member)
+#define BENCH_DES(member) offsetof(struct bench_des_backend_t, member)
+
+static uint64_t bench_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t bench_cycles(void) {
+#if defined(CPU_X86)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+//
+// Bulk operations, return non-zero if the size does not suit the operation
+//
+
+static int bench_aes_ecb(const uint32_t size) {
+	uint32_t offset;
+
+	if (size % AES_BLOCK_SIZE != 0)
+		return -1;
+
+	for (offset = 0; offset < size; offset += AES_BLOCK_SIZE)
+		aes_crypt_ecb(&bench_aes_enc, bench_input + offset, bench_output + offset);
+
+	return 0;
+}
+
+static int bench_aes_cbc_encrypt(const uint32_t size) {
+	uint8_t iv[AES_BLOCK_SIZE] = { 0 };
+
+	return aes_crypt_cbc(&bench_aes_enc, iv, bench_input, bench_output, size);
+}
+
+static int bench_aes_cbc_decrypt(const uint32_t size) {
+	uint8_t iv[AES_BLOCK_SIZE] = { 0 };
+
+	return aes_crypt_cbc(&bench_aes_dec, iv, bench_input, bench_output, size);
+}
+
+static int bench_aes_ctr(const uint32_t size) {
+	uint8_t nonce[AES_BLOCK_SIZE] = { 0 };
+
+	return aes_crypt_ctr(&bench_aes_enc, nonce, bench_input, bench_output, size);
+}
+
+static int bench_aes_xts(const uint32_t size) {
+	// sectors of at most 2048 bytes, as read from a disc
+	const uint32_t sector_size = (size < 2048) ? size : 2048;
+
+	if (size % AES_BLOCK_SIZE != 0)
+		return -1;
+
+	return aes_crypt_xts_sectors(&bench_aes_xts_ctx, bench_input, bench_output, 0, size / sector_size, sector_size);
+}
+
+static int bench_aes_cmac(const uint32_t size) {
+	return aes_key_cmac(&bench_aes_key, bench_input, bench_output, size);
+}
+
+static int bench_sha1(const uint32_t size) {
+	sha1(bench_input, bench_output, size);
+	return 0;
+}
+
+//
+// size bytes split over BENCH_SHA1_MESSAGES independent messages, which is
+// what the multi-buffer engines of the SIMD backends are for
+//
+static int bench_sha1_multi(const uint32_t size) {
+	static struct sha1_lane_t lanes[BENCH_SHA1_MESSAGES];
+	const uint32_t length = size / BENCH_SHA1_MESSAGES;
+	uint32_t i;
+
+	if (size % BENCH_SHA1_MESSAGES != 0)
+		return -1;
+
+	for (i = 0; i < BENCH_SHA1_MESSAGES; ++i) {
+		lanes[i].input = bench_input + i * length;
+		lanes[i].length = length;
+	}
+
+	sha1_multi(lanes, BENCH_SHA1_MESSAGES);
+	return 0;
+}
+
+static int bench_sha1_hmac(const uint32_t size) {
+	struct sha1_context_t ctx;
+
+	sha1_hmac_key_starts(&ctx, &bench_hmac_key);
+	sha1_hmac_update(&ctx, bench_input, size);
+	sha1_hmac_finish(&ctx, bench_output);
+	return 0;
+}
+
+static int bench_des3_ecb(const uint32_t size) {
+	uint32_t offset;
+
+	if (size % 8 != 0)
+		return -1;
+
+	for (offset = 0; offset < size; offset += 8)
+		des3_crypt_ecb(&bench_des3_enc, bench_input + offset, bench_output + offset);
+
+	return 0;
+}
+
+static int bench_des3_ecb_multi(const uint32_t size) {
+	return des3_crypt_ecb_multi(&bench_des3_enc, size, bench_input, bench_output);
+}
+
+static int bench_des3_cbc(const uint32_t size) {
+	unsigned char iv[8] = { 0 };
+
+	return des3_crypt_cbc(&bench_des3_enc, DES_ENCRYPT, size, iv, bench_input, bench_output);
+}
+
+static int bench_des3_key_cbc(const uint32_t size) {
+	static const unsigned char iv[8] = { 0 };
+
+	return des3_key_encrypt_cbc(&bench_des3_enc, iv, bench_input, bench_output, size);
+}
+
+//
+// Key setup
+//
+
+static int bench_aes_init_enc_128(const uint32_t size) {
+	struct aes_context_t ctx;
+
+	return aes_init(&ctx, AES_ENCRYPT, bench_key, 128);
+}
+
+static int bench_aes_init_dec_128(const uint32_t size) {
+	struct aes_context_t ctx;
+
+	return aes_init(&ctx, AES_DECRYPT, bench_key, 128);
+}
+
+static int bench_aes_init_enc_256(const uint32_t size) {
+	struct aes_context_t ctx;
+
+	return aes_init(&ctx, AES_ENCRYPT, bench_key, 256);
+}
+
+static int bench_aes_key_init_128(const uint32_t size) {
+	struct aes_key_t key;
+
+	return aes_key_init(&key, bench_key, 128);
+}
+
+static int bench_aes_cmac_init_128(const uint32_t size) {
+	struct aes_cmac_context_t ctx;
+
+	return aes_cmac_init(&ctx, bench_key, 128);
+}
+
+static int bench_sha1_hmac_key_init(const uint32_t size) {
+	struct sha1_hmac_key_t key;
+
+	sha1_hmac_key_init(&key, bench_key, 20);
+	return 0;
+}
+
+static int bench_des3_set2key_enc(const uint32_t size) {
+	des3_context ctx;
+
+	return des3_set2key_enc(&ctx, bench_key);
+}
+
+static const struct bench_op_t bench_aes_ops[] = {
+	{ "aes_crypt_ecb", bench_aes_ecb, BENCH_AES(ecb) },
+	{ "aes_crypt_cbc_encrypt", bench_aes_cbc_encrypt, BENCH_AES(cbc_encrypt) },
+	{ "aes_crypt_cbc_decrypt", bench_aes_cbc_decrypt, BENCH_AES(cbc_decrypt) },
+	{ "aes_crypt_ctr", bench_aes_ctr, BENCH_AES(ctr) },
+	{ "aes_crypt_xts", bench_aes_xts, BENCH_AES(xts) },
+	{ "aes_cmac", bench_aes_cmac, BENCH_AES(cbc_encrypt) },
+};
+
+static const struct bench_op_t bench_aes_setup_ops[] = {
+	{ "aes_init_enc_128", bench_aes_init_enc_128, BENCH_AES(expand_key) },
+	{ "aes_init_dec_128", bench_aes_init_dec_128, BENCH_AES(invert_key) },
+	{ "aes_init_enc_256", bench_aes_init_enc_256, BENCH_AES(expand_key) },
+	{ "aes_key_init_128", bench_aes_key_init_128, BENCH_AES(invert_key) },
+	{ "aes_cmac_init_128", bench_aes_cmac_init_128, BENCH_AES(expand_key) },
+};
+
+static const struct bench_op_t bench_sha1_ops[] = {
+	{ "sha1", bench_sha1, BENCH_SHA1(blocks) },
+	{ "sha1_hmac", bench_sha1_hmac, BENCH_SHA1(blocks) },
+	{ "sha1_multi", bench_sha1_multi, BENCH_SHA1(blocks_lanes) },
+};
+
+static const struct bench_op_t bench_sha1_setup_ops[] = {
+	{ "sha1_hmac_key_init", bench_sha1_hmac_key_init, BENCH_SHA1(blocks) },
+};
+
+static const struct bench_op_t bench_des_ops[] = {
+	{ "des3_crypt_ecb", bench_des3_ecb, BENCH_DES(crypt_ecb) },
+	{ "des3_crypt_ecb_multi", bench_des3_ecb_multi, BENCH_DES(crypt_ecb_multi) },
+	{ "des3_crypt_cbc_encrypt", bench_des3_cbc, BENCH_DES(crypt_cbc) },
+	{ "des3_key_encrypt_cbc", bench_des3_key_cbc, BENCH_DES(key_encrypt_cbc) },
+};
+
+static const struct bench_op_t bench_des_setup_ops[] = {
+	{ "des3_set2key_enc", bench_des3_set2key_enc, BENCH_DES(crypt_ecb) },
+};
+
+static uint64_t bench_min_ns = 50 * 1000000ULL;
+static int bench_first = 1;
+
+//
+// Runs op until bench_min_ns have passed and prints one JSON record
+//
+static void bench_measure(const struct bench_op_t* const op, const char* const backend, const uint32_t size) {
+	uint64_t iterations, done, start, elapsed, cycles;
+	double seconds;
+
+	// reject unsuitable sizes and warm up
+	if (op->run(size) != 0)
+		return;
+
+	iterations = 1;
+	done = 0;
+	cycles = bench_cycles();
+	start = bench_now_ns();
+
+	for (;;) {
+		uint64_t i;
+
+		for (i = 0; i < iterations; ++i)
+			op->run(size);
+		done += iterations;
+
+		elapsed = bench_now_ns() - start;
+		if (elapsed >= bench_min_ns)
+			break;
+
+		iterations *= 2;
+	}
+
+	cycles = bench_cycles() - cycles;
+	seconds = (double)elapsed / 1e9;
+
+	printf("%s\t\t{ \"op\": \"%s\", \"backend\": \"%s\", \"size\": %u, \"ops_per_sec\": %.1f",
+		bench_first ? "" : ",\n", op->name, backend, size, (double)done / seconds);
+
+	if (size > 0)
+		printf(", \"mb_per_sec\": %.2f", (double)done * size / seconds / 1e6);
+
+	if (cycles != 0) {
+		printf(", \"cycles_per_op\": %.1f", (double)cycles / (double)done);
+		if (size > 0)
+			printf(", \"cycles_per_byte\": %.3f", (double)cycles / ((double)done * size));
+	}
+
+	printf(" }");
+	bench_first = 0;
+}
+
+//
+// Whether table, an aes_backend_t, sha1_backend_t or bench_des_backend_t, has
+// the function op runs on
+//
+static int bench_implements(const void* const table, const struct bench_op_t* const op) {
+	void (*fn)(void);
+
+	if (table == NULL || op->member == 0)
+		return 1;
+
+	memcpy(&fn, (const uint8_t*)table + op->member, sizeof(fn));
+	return fn != NULL;
+}
+
+static void bench_run(const struct bench_op_t* const ops, const uint32_t count, const struct bench_op_t* const setup_ops, const uint32_t setup_count, const void* const table, const char* const backend) {
+	uint32_t i, j;
+
+	for (i = 0; i < setup_count; ++i) {
+		if (bench_implements(table, &setup_ops[i]))
+			bench_measure(&setup_ops[i], backend, 0);
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (!bench_implements(table, &ops[i]))
+			continue;
+
+		for (j = 0; j < sizeof(bench_sizes) / sizeof(bench_sizes[0]); ++j)
+			bench_measure(&ops[i], backend, bench_sizes[j]);
+	}
+}
+
+//
+// Contexts are prepared again for every backend, as the key schedule may be
+// built by the backend itself
+//
+static void bench_prepare(void) {
+	aes_init(&bench_aes_enc, AES_ENCRYPT, bench_key, 128);
+	aes_init(&bench_aes_dec, AES_DECRYPT, bench_key, 128);
+	aes_xts_init(&bench_aes_xts_ctx, AES_ENCRYPT, bench_key + 16, 128, bench_key, 128);
+	aes_key_init(&bench_aes_key, bench_key, 128);
+	sha1_hmac_key_init(&bench_hmac_key, bench_key, 20);
+	des3_set2key_enc(&bench_des3_enc, bench_key);
+}
+
+#define BENCH_COUNT(ops) (sizeof(ops) / sizeof(ops[0]))
+
+int main(int argc, char* argv[]) {
+	uint32_t i;
+
+	if (argc > 1)
+		bench_min_ns = strtoull(argv[1], NULL, 10) * 1000000ULL;
+
+	bench_input = (uint8_t*)malloc(BENCH_MAX_SIZE);
+	bench_output = (uint8_t*)malloc(BENCH_MAX_SIZE);
+	if (bench_input == NULL || bench_output == NULL) {
+		fprintf(stderr, "sv_bench :: out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < BENCH_MAX_SIZE; ++i)
+		bench_input[i] = (uint8_t)(i * 131 + 7);
+
+	crypto_init();
+
+	printf("{\n");
+	printf("\t\"compiler_version\": \"%s\",\n", __VERSION__);
+	printf("\t\"cflags\": \"%s\",\n", BENCH_CFLAGS);
+	printf("\t\"cpu_features\": \"0x%08X\",\n", cpu_features());
+	printf("\t\"default_aes_backend\": \"%s\",\n", aes_backend_name());
+	printf("\t\"default_sha1_backend\": \"%s\",\n", sha1_backend_name());
+	printf("\t\"min_ms\": %llu,\n", (unsigned long long)(bench_min_ns / 1000000ULL));
+	printf("\t\"results\": [\n");
+
+	for (i = 0; i < BENCH_COUNT(bench_aes_backends); ++i) {
+		const struct aes_backend_t* const backend = bench_aes_backends[i];
+		if (backend->supported != NULL && !backend->supported())
+			continue;
+
+		setenv("SV_AES_BACKEND", backend->name, 1);
+		crypto_init();
+		bench_prepare();
+
+		bench_run(bench_aes_ops, BENCH_COUNT(bench_aes_ops), bench_aes_setup_ops, BENCH_COUNT(bench_aes_setup_ops), backend, aes_backend_name());
+	}
+
+	unsetenv("SV_AES_BACKEND");
+
+	for (i = 0; i < BENCH_COUNT(bench_sha1_backends); ++i) {
+		const struct sha1_backend_t* const backend = bench_sha1_backends[i];
+		if (backend->supported != NULL && !backend->supported())
+			continue;
+
+		setenv("SV_SHA1_BACKEND", backend->name, 1);
+		crypto_init();
+		bench_prepare();
+
+		bench_run(bench_sha1_ops, BENCH_COUNT(bench_sha1_ops), bench_sha1_setup_ops, BENCH_COUNT(bench_sha1_setup_ops), backend, sha1_backend_name());
+	}
+
+	unsetenv("SV_SHA1_BACKEND");
+
+	crypto_init();
+	bench_prepare();
+
+	for (i = 0; i < BENCH_COUNT(bench_des_backends); ++i) {
+		const struct bench_des_backend_t* const backend = &bench_des_backends[i];
+		if (backend->supported != NULL && !backend->supported())
+			continue;
+
+		bench_run(bench_des_ops, BENCH_COUNT(bench_des_ops), bench_des_setup_ops, BENCH_COUNT(bench_des_setup_ops), backend, backend->name);
+	}
+
+	printf("\n\t]\n}\n");
+
+	free(bench_input);
+	free(bench_output);
+
+	return 0;
+}
@@ -0,0 +1,69 @@
+#include "cpu_features.h"
+
+#if defined(CPU_X86)
+#include <cpuid.h>
+
+static uint64_t read_xcr0(void) {
+	uint32_t eax, edx;
+
+	__asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return ((uint64_t)edx << 32) | eax;
+}
+#endif
+
+static uint32_t detect_features(void) {
+	uint32_t features = 0;
+
+#if defined(CPU_X86)
+	unsigned int eax, ebx, ecx, edx;
+	uint64_t xcr0;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+		return 0;
+
+	if (edx & (1 << 26))
+		features |= CPU_FEATURE_SSE2;
+	if (ecx & (1 << 9))
+		features |= CPU_FEATURE_SSSE3;
+	if (ecx & (1 << 19))
+		features |= CPU_FEATURE_SSE41;
+	if (ecx & (1 << 25))
+		features |= CPU_FEATURE_AESNI;
+
+	// AVX state must be enabled by the OS as well
+	xcr0 = 0;
+	if ((ecx & (1 << 27)) && (ecx & (1 << 28)))
+		xcr0 = read_xcr0();
+
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0)
+		return features;
+
+	if (ebx & (1 << 29))
+		features |= CPU_FEATURE_SHA;
+
+	if ((xcr0 & 0x6) == 0x6) {
+		if (ebx & (1 << 5))
+			features |= CPU_FEATURE_AVX2;
+		if (ecx & (1 << 9))
+			features |= CPU_FEATURE_VAES;
+
+		// opmask and upper ZMM state
+		if ((ebx & (1 << 16)) && (ebx & (1 << 30)) && (xcr0 & 0xE0) == 0xE0)
+			features |= CPU_FEATURE_AVX512;
+	}
+#endif
+
+	return features;
+}
+
+uint32_t cpu_features(void) {
+	static int detected = 0;
+	static uint32_t features = 0;
+
+	if (!detected) {
+		features = detect_features();
+		detected = 1;
+	}
+
+	return features;
+}
@@ -0,0 +1,32 @@
+#ifndef __CPU_FEATURES_H__
+#define __CPU_FEATURES_H__
+
+#include "common.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#endif
+
+enum {
+	CPU_FEATURE_SSE2 = 1 << 0,
+	CPU_FEATURE_SSSE3 = 1 << 1,
+	CPU_FEATURE_SSE41 = 1 << 2,
+	CPU_FEATURE_AESNI = 1 << 3,
+	CPU_FEATURE_AVX2 = 1 << 4,
+	CPU_FEATURE_VAES = 1 << 5,
+	CPU_FEATURE_AVX512 = 1 << 6, // AVX512F and AVX512BW
+	CPU_FEATURE_SHA = 1 << 7,
+};
+
+//
+// \brief  Query the instruction set extensions of the host CPU
+//
+// \return CPU_FEATURE_* bit mask, detected once and cached
+//
+uint32_t cpu_features(void);
+
+static inline int cpu_has(const uint32_t features) {
+	return (cpu_features() & features) == features;
+}
+
+#endif
@@ -36,6 +36,10 @@
 //
 
 #include "crypto.h"
+#include "crypto_backend.h"
+
+#include <pthread.h>
+#include <sys/random.h>
 
 //
 // 32-bit integer manipulation macros (little endian)
@@ -336,114 +340,135 @@ static const uint32_t rcon[10] = {
 	0x0000001B, 0x00000036,
 };
 
-int aes_init(struct aes_context_t* const ctx, const int mode, const uint8_t* const key, const uint32_t key_size) {
-	if (mode != AES_DECRYPT && mode != AES_ENCRYPT)
-		return ERROR_INVALID_MODE;
+//
+// Currently selected implementation, see crypto_init()
+//
+static const struct aes_backend_t* aes_backend = &aes_backend_portable;
+static const struct sha1_backend_t* sha1_backend = &sha1_backend_portable;
+
+static int aes_portable_expand_key(uint32_t* const rk_out, const uint8_t* const key, const unsigned int key_size) {
+	uint32_t* rk = rk_out;
+
+	int i;
+
+	for (i = 0; i < (key_size >> 5); ++i) {
+		GET_UINT32_LE(rk[i], key, i << 2);
+	}
 
 	switch (key_size) {
-		case 128: ctx->nr = 10; break;
-		case 192: ctx->nr = 12; break;
-		case 256: ctx->nr = 14; break;
+		case 128:
+			for (i = 0; i < 10; ++i, rk += 4) {
+				rk[4] = rk[0] ^ rcon[i] ^
+					((uint32_t)fsb[(rk[3] >> 8) & 0xFF]) ^
+					((uint32_t)fsb[(rk[3] >> 16) & 0xFF] << 8) ^
+					((uint32_t)fsb[(rk[3] >> 24) & 0xFF] << 16) ^
+					((uint32_t)fsb[(rk[3]) & 0xFF] << 24);
+				rk[5] = rk[1] ^ rk[4];
+				rk[6] = rk[2] ^ rk[5];
+				rk[7] = rk[3] ^ rk[6];
+			}
+			break;
+
+		case 192:
+			for (i = 0; i < 8; ++i, rk += 6) {
+				rk[6] = rk[0] ^ rcon[i] ^
+					((uint32_t)fsb[(rk[5] >> 8) & 0xFF]) ^
+					((uint32_t)fsb[(rk[5] >> 16) & 0xFF] << 8) ^
+					((uint32_t)fsb[(rk[5] >> 24) & 0xFF] << 16) ^
+					((uint32_t)fsb[(rk[5]) & 0xFF] << 24);
+				rk[7] = rk[1] ^ rk[6];
+				rk[8] = rk[2] ^ rk[7];
+				rk[9] = rk[3] ^ rk[8];
+				rk[10] = rk[4] ^ rk[9];
+				rk[11] = rk[5] ^ rk[10];
+			}
+			break;
+
+		case 256:
+			for (i = 0; i < 7; ++i, rk += 8) {
+				rk[8] = rk[0] ^ rcon[i] ^
+					((uint32_t)fsb[(rk[7] >>  8) & 0xFF]) ^
+					((uint32_t)fsb[(rk[7] >> 16) & 0xFF] << 8) ^
+					((uint32_t)fsb[(rk[7] >> 24) & 0xFF] << 16) ^
+					((uint32_t)fsb[(rk[7]) & 0xFF] << 24);
+				rk[9] = rk[1] ^ rk[8];
+				rk[10] = rk[2] ^ rk[9];
+				rk[11] = rk[3] ^ rk[10];
+				rk[12] = rk[4] ^
+					((uint32_t)fsb[(rk[11]) & 0xFF]) ^
+					((uint32_t)fsb[(rk[11] >>  8) & 0xFF] << 8) ^
+					((uint32_t)fsb[(rk[11] >> 16) & 0xFF] << 16) ^
+					((uint32_t)fsb[(rk[11] >> 24) & 0xFF] << 24);
+				rk[13] = rk[5] ^ rk[12];
+				rk[14] = rk[6] ^ rk[13];
+				rk[15] = rk[7] ^ rk[14];
+			}
+			break;
+
 		default:
-			return ERROR_INVALID_KEY_SIZE;
+			break;
 	}
 
-	if (mode == AES_ENCRYPT) {
-		uint32_t* rk;
-
-		int i;
-	
-		ctx->rk = rk = ctx->buf;
+	return 0;
+}
 
-		for (i = 0; i < (key_size >> 5); ++i) {
-			GET_UINT32_LE(rk[i], key, i << 2);
-		}
+static void aes_portable_invert_key(uint32_t* const drk, const uint32_t* const erk, const int nr) {
+	uint32_t* rk = drk;
+	const uint32_t* sk = erk + nr * 4;
 
-		switch (ctx->nr) {
-			case 10:
-				for (i = 0; i < 10; ++i, rk += 4) {
-					rk[4] = rk[0] ^ rcon[i] ^
-						((uint32_t)fsb[(rk[3] >> 8) & 0xFF]) ^
-						((uint32_t)fsb[(rk[3] >> 16) & 0xFF] << 8) ^
-						((uint32_t)fsb[(rk[3] >> 24) & 0xFF] << 16) ^
-						((uint32_t)fsb[(rk[3]) & 0xFF] << 24);
-					rk[5] = rk[1] ^ rk[4];
-					rk[6] = rk[2] ^ rk[5];
-					rk[7] = rk[3] ^ rk[6];
-				}
-				break;
+	int i, j;
 
-			case 12:
-				for (i = 0; i < 8; ++i, rk += 6) {
-					rk[6] = rk[0] ^ rcon[i] ^
-						((uint32_t)fsb[(rk[5] >> 8) & 0xFF]) ^
-						((uint32_t)fsb[(rk[5] >> 16) & 0xFF] << 8) ^
-						((uint32_t)fsb[(rk[5] >> 24) & 0xFF] << 16) ^
-						((uint32_t)fsb[(rk[5]) & 0xFF] << 24);
-					rk[7] = rk[1] ^ rk[6];
-					rk[8] = rk[2] ^ rk[7];
-					rk[9] = rk[3] ^ rk[8];
-					rk[10] = rk[4] ^ rk[9];
-					rk[11] = rk[5] ^ rk[10];
-				}
-				break;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
 
-			case 14:
-				for (i = 0; i < 7; ++i, rk += 8) {
-					rk[8] = rk[0] ^ rcon[i] ^
-						((uint32_t)fsb[(rk[7] >>  8) & 0xFF]) ^
-						((uint32_t)fsb[(rk[7] >> 16) & 0xFF] << 8) ^
-						((uint32_t)fsb[(rk[7] >> 24) & 0xFF] << 16) ^
-						((uint32_t)fsb[(rk[7]) & 0xFF] << 24);
-					rk[9] = rk[1] ^ rk[8];
-					rk[10] = rk[2] ^ rk[9];
-					rk[11] = rk[3] ^ rk[10];
-					rk[12] = rk[4] ^
-						((uint32_t)fsb[(rk[11]) & 0xFF]) ^
-						((uint32_t)fsb[(rk[11] >>  8) & 0xFF] << 8) ^
-						((uint32_t)fsb[(rk[11] >> 16) & 0xFF] << 16) ^
-						((uint32_t)fsb[(rk[11] >> 24) & 0xFF] << 24);
-					rk[13] = rk[5] ^ rk[12];
-					rk[14] = rk[6] ^ rk[13];
-					rk[15] = rk[7] ^ rk[14];
-				}
-				break;
+	sk -= 8;
+	for (i = nr - 1; i > 0; --i) {
+		for (j = 0; j < 4; ++j, ++sk)
+			*rk++ = rt0[fsb[(*sk) & 0xFF]] ^ rt1[fsb[(*sk >> 8) & 0xFF]] ^ rt2[fsb[(*sk >> 16) & 0xFF]] ^ rt3[fsb[(*sk >> 24) & 0xFF]];
+		sk -= 8;
+	}
 
-			default:
-				break;
-		}
-	} else {
-		int result;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+	*rk++ = *sk++;
+}
 
-		struct aes_context_t tmp_ctx;
+static void aes_expand_key(uint32_t* const rk, const uint8_t* const key, const unsigned int key_size) {
+	if (aes_backend->expand_key == NULL || aes_backend->expand_key(rk, key, key_size) != 0)
+		aes_portable_expand_key(rk, key, key_size);
+}
 
-		uint32_t* rk;
-		uint32_t* sk;
-		int i, j;
+static void aes_invert_key(uint32_t* const drk, const uint32_t* const erk, const int nr) {
+	if (aes_backend->invert_key != NULL)
+		aes_backend->invert_key(drk, erk, nr);
+	else
+		aes_portable_invert_key(drk, erk, nr);
+}
 
-		result = aes_init(&tmp_ctx, AES_ENCRYPT, key, key_size);
-		if (result != 0)
-			return result;
+int aes_init(struct aes_context_t* const ctx, const int mode, const uint8_t* const key, const uint32_t key_size) {
+	if (mode != AES_DECRYPT && mode != AES_ENCRYPT)
+		return ERROR_INVALID_MODE;
 
-		ctx->rk = rk = ctx->buf;
-		sk = tmp_ctx.rk + tmp_ctx.nr * 4;
+	switch (key_size) {
+		case 128: ctx->nr = 10; break;
+		case 192: ctx->nr = 12; break;
+		case 256: ctx->nr = 14; break;
+		default:
+			return ERROR_INVALID_KEY_SIZE;
+	}
 
-		*rk++ = *sk++;
-		*rk++ = *sk++;
-		*rk++ = *sk++;
-		*rk++ = *sk++;
+	ctx->rk = ctx->buf;
 
-		sk -= 8;
-		for (i = ctx->nr - 1; i > 0; --i) {
-			for (j = 0; j < 4; ++j, ++sk)
-				*rk++ = rt0[fsb[(*sk) & 0xFF]] ^ rt1[fsb[(*sk >> 8) & 0xFF]] ^ rt2[fsb[(*sk >> 16) & 0xFF]] ^ rt3[fsb[(*sk >> 24) & 0xFF]];
-			sk -= 8;
-		}
+	if (mode == AES_ENCRYPT) {
+		aes_expand_key(ctx->buf, key, key_size);
+	} else {
+		uint32_t erk[68];
 
-		*rk++ = *sk++;
-		*rk++ = *sk++;
-		*rk++ = *sk++;
-		*rk++ = *sk++;
+		aes_expand_key(erk, key, key_size);
+		aes_invert_key(ctx->buf, erk, ctx->nr);
 	}
 
 	ctx->mode = mode;
@@ -451,8 +476,8 @@ int aes_init(struct aes_context_t* const ctx, const int mode, const uint8_t* con
 	return 0;
 }
 
-int aes_crypt_ecb(struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
-	uint32_t* rk;
+static void aes_portable_ecb(const struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
+	const uint32_t* rk;
 
 	uint32_t x0, x1, x2, x3;
 	uint32_t y0, y1, y2, y3;
@@ -583,6 +608,326 @@ int aes_crypt_ecb(struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK
 	PUT_UINT32_LE(x1, output, 4);
 	PUT_UINT32_LE(x2, output, 8);
 	PUT_UINT32_LE(x3, output, 12);
+}
+
+static void aes_portable_cbc_encrypt(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	int i;
+
+	while (nblocks > 0) {
+		for (i = 0; i < AES_BLOCK_SIZE; ++i)
+			dst[i] = src[i] ^ iv[i];
+
+		aes_portable_ecb(ctx, dst, dst);
+		memcpy(iv, dst, 16);
+
+		src += AES_BLOCK_SIZE;
+		dst += AES_BLOCK_SIZE;
+		nblocks--;
+	}
+}
+
+//
+// Number of blocks the portable decryption kernel keeps in flight
+//
+#define AES_PORTABLE_LANES 4
+
+#define AES_RROUND_LANE(rk, x0, x1, x2, x3, y0, y1, y2, y3) { \
+		(x0) = (rk)[0] ^ rt0[(y0) & 0xFF] ^ rt1[(y3 >> 8) & 0xFF] ^ rt2[(y2 >> 16) & 0xFF] ^ rt3[(y1 >> 24) & 0xFF]; \
+		(x1) = (rk)[1] ^ rt0[(y1) & 0xFF] ^ rt1[(y0 >> 8) & 0xFF] ^ rt2[(y3 >> 16) & 0xFF] ^ rt3[(y2 >> 24) & 0xFF]; \
+		(x2) = (rk)[2] ^ rt0[(y2) & 0xFF] ^ rt1[(y1 >> 8) & 0xFF] ^ rt2[(y0 >> 16) & 0xFF] ^ rt3[(y3 >> 24) & 0xFF]; \
+		(x3) = (rk)[3] ^ rt0[(y3) & 0xFF] ^ rt1[(y2 >> 8) & 0xFF] ^ rt2[(y1 >> 16) & 0xFF] ^ rt3[(y0 >> 24) & 0xFF]; \
+	}
+
+#define AES_RLAST_LANE(rk, x0, x1, x2, x3, y0, y1, y2, y3) { \
+		(x0) = (rk)[0] ^ ((uint32_t)rsb[(y0) & 0xFF]) ^ ((uint32_t)rsb[(y3 >> 8) & 0xFF] << 8) ^ \
+			((uint32_t)rsb[(y2 >> 16) & 0xFF] << 16) ^ ((uint32_t)rsb[(y1 >> 24) & 0xFF] << 24); \
+		(x1) = (rk)[1] ^ ((uint32_t)rsb[(y1) & 0xFF]) ^ ((uint32_t)rsb[(y0 >> 8) & 0xFF] << 8) ^ \
+			((uint32_t)rsb[(y3 >> 16) & 0xFF] << 16) ^ ((uint32_t)rsb[(y2 >> 24) & 0xFF] << 24); \
+		(x2) = (rk)[2] ^ ((uint32_t)rsb[(y2) & 0xFF]) ^ ((uint32_t)rsb[(y1 >> 8) & 0xFF] << 8) ^ \
+			((uint32_t)rsb[(y0 >> 16) & 0xFF] << 16) ^ ((uint32_t)rsb[(y3 >> 24) & 0xFF] << 24); \
+		(x3) = (rk)[3] ^ ((uint32_t)rsb[(y3) & 0xFF]) ^ ((uint32_t)rsb[(y2 >> 8) & 0xFF] << 8) ^ \
+			((uint32_t)rsb[(y1 >> 16) & 0xFF] << 16) ^ ((uint32_t)rsb[(y0 >> 24) & 0xFF] << 24); \
+	}
+
+#define AES_FROUND_LANE(rk, x0, x1, x2, x3, y0, y1, y2, y3) { \
+		(x0) = (rk)[0] ^ ft0[(y0) & 0xFF] ^ ft1[(y1 >> 8) & 0xFF] ^ ft2[(y2 >> 16) & 0xFF] ^ ft3[(y3 >> 24) & 0xFF]; \
+		(x1) = (rk)[1] ^ ft0[(y1) & 0xFF] ^ ft1[(y2 >> 8) & 0xFF] ^ ft2[(y3 >> 16) & 0xFF] ^ ft3[(y0 >> 24) & 0xFF]; \
+		(x2) = (rk)[2] ^ ft0[(y2) & 0xFF] ^ ft1[(y3 >> 8) & 0xFF] ^ ft2[(y0 >> 16) & 0xFF] ^ ft3[(y1 >> 24) & 0xFF]; \
+		(x3) = (rk)[3] ^ ft0[(y3) & 0xFF] ^ ft1[(y0 >> 8) & 0xFF] ^ ft2[(y1 >> 16) & 0xFF] ^ ft3[(y2 >> 24) & 0xFF]; \
+	}
+
+#define AES_FLAST_LANE(rk, x0, x1, x2, x3, y0, y1, y2, y3) { \
+		(x0) = (rk)[0] ^ ((uint32_t)fsb[(y0) & 0xFF]) ^ ((uint32_t)fsb[(y1 >> 8) & 0xFF] << 8) ^ \
+			((uint32_t)fsb[(y2 >> 16) & 0xFF] << 16) ^ ((uint32_t)fsb[(y3 >> 24) & 0xFF] << 24); \
+		(x1) = (rk)[1] ^ ((uint32_t)fsb[(y1) & 0xFF]) ^ ((uint32_t)fsb[(y2 >> 8) & 0xFF] << 8) ^ \
+			((uint32_t)fsb[(y3 >> 16) & 0xFF] << 16) ^ ((uint32_t)fsb[(y0 >> 24) & 0xFF] << 24); \
+		(x2) = (rk)[2] ^ ((uint32_t)fsb[(y2) & 0xFF]) ^ ((uint32_t)fsb[(y3 >> 8) & 0xFF] << 8) ^ \
+			((uint32_t)fsb[(y0 >> 16) & 0xFF] << 16) ^ ((uint32_t)fsb[(y1 >> 24) & 0xFF] << 24); \
+		(x3) = (rk)[3] ^ ((uint32_t)fsb[(y3) & 0xFF]) ^ ((uint32_t)fsb[(y0 >> 8) & 0xFF] << 8) ^ \
+			((uint32_t)fsb[(y1 >> 16) & 0xFF] << 16) ^ ((uint32_t)fsb[(y2 >> 24) & 0xFF] << 24); \
+	}
+
+#define AES_LOAD_LANE(input, b, rk, x0, x1, x2, x3) { \
+		GET_UINT32_LE(x0, input, (b) * AES_BLOCK_SIZE + 0); (x0) ^= (rk)[0]; \
+		GET_UINT32_LE(x1, input, (b) * AES_BLOCK_SIZE + 4); (x1) ^= (rk)[1]; \
+		GET_UINT32_LE(x2, input, (b) * AES_BLOCK_SIZE + 8); (x2) ^= (rk)[2]; \
+		GET_UINT32_LE(x3, input, (b) * AES_BLOCK_SIZE + 12); (x3) ^= (rk)[3]; \
+	}
+
+#define AES_STORE_LANE(output, b, x0, x1, x2, x3) { \
+		PUT_UINT32_LE(x0, output, (b) * AES_BLOCK_SIZE + 0); \
+		PUT_UINT32_LE(x1, output, (b) * AES_BLOCK_SIZE + 4); \
+		PUT_UINT32_LE(x2, output, (b) * AES_BLOCK_SIZE + 8); \
+		PUT_UINT32_LE(x3, output, (b) * AES_BLOCK_SIZE + 12); \
+	}
+
+//
+// Decrypts AES_PORTABLE_LANES independent blocks with the rounds of all lanes
+// interleaved, so the table lookups of one block overlap with the others
+//
+static void aes_portable_decrypt_lanes(const struct aes_context_t* const ctx, const uint8_t* const input, uint8_t* const output) {
+	const uint32_t* rk = ctx->rk;
+
+	uint32_t a0, a1, a2, a3, b0, b1, b2, b3, c0, c1, c2, c3, d0, d1, d2, d3;
+	uint32_t e0, e1, e2, e3, f0, f1, f2, f3, g0, g1, g2, g3, h0, h1, h2, h3;
+
+	int i;
+
+	AES_LOAD_LANE(input, 0, rk, a0, a1, a2, a3);
+	AES_LOAD_LANE(input, 1, rk, b0, b1, b2, b3);
+	AES_LOAD_LANE(input, 2, rk, c0, c1, c2, c3);
+	AES_LOAD_LANE(input, 3, rk, d0, d1, d2, d3);
+	rk += 4;
+
+	for (i = (ctx->nr >> 1) - 1; i > 0; --i) {
+		AES_RROUND_LANE(rk, e0, e1, e2, e3, a0, a1, a2, a3);
+		AES_RROUND_LANE(rk, f0, f1, f2, f3, b0, b1, b2, b3);
+		AES_RROUND_LANE(rk, g0, g1, g2, g3, c0, c1, c2, c3);
+		AES_RROUND_LANE(rk, h0, h1, h2, h3, d0, d1, d2, d3);
+		rk += 4;
+
+		AES_RROUND_LANE(rk, a0, a1, a2, a3, e0, e1, e2, e3);
+		AES_RROUND_LANE(rk, b0, b1, b2, b3, f0, f1, f2, f3);
+		AES_RROUND_LANE(rk, c0, c1, c2, c3, g0, g1, g2, g3);
+		AES_RROUND_LANE(rk, d0, d1, d2, d3, h0, h1, h2, h3);
+		rk += 4;
+	}
+
+	AES_RROUND_LANE(rk, e0, e1, e2, e3, a0, a1, a2, a3);
+	AES_RROUND_LANE(rk, f0, f1, f2, f3, b0, b1, b2, b3);
+	AES_RROUND_LANE(rk, g0, g1, g2, g3, c0, c1, c2, c3);
+	AES_RROUND_LANE(rk, h0, h1, h2, h3, d0, d1, d2, d3);
+	rk += 4;
+
+	AES_RLAST_LANE(rk, a0, a1, a2, a3, e0, e1, e2, e3);
+	AES_RLAST_LANE(rk, b0, b1, b2, b3, f0, f1, f2, f3);
+	AES_RLAST_LANE(rk, c0, c1, c2, c3, g0, g1, g2, g3);
+	AES_RLAST_LANE(rk, d0, d1, d2, d3, h0, h1, h2, h3);
+
+	AES_STORE_LANE(output, 0, a0, a1, a2, a3);
+	AES_STORE_LANE(output, 1, b0, b1, b2, b3);
+	AES_STORE_LANE(output, 2, c0, c1, c2, c3);
+	AES_STORE_LANE(output, 3, d0, d1, d2, d3);
+}
+
+//
+// Encrypts AES_PORTABLE_LANES blocks, every lane with its own key schedule
+//
+static void aes_portable_encrypt_lanes(const uint32_t* const rk[AES_PORTABLE_LANES], const int nr, const uint8_t* const input, uint8_t* const output) {
+	const uint32_t* ra = rk[0];
+	const uint32_t* rb = rk[1];
+	const uint32_t* rc = rk[2];
+	const uint32_t* rd = rk[3];
+
+	uint32_t a0, a1, a2, a3, b0, b1, b2, b3, c0, c1, c2, c3, d0, d1, d2, d3;
+	uint32_t e0, e1, e2, e3, f0, f1, f2, f3, g0, g1, g2, g3, h0, h1, h2, h3;
+
+	int i;
+
+	AES_LOAD_LANE(input, 0, ra, a0, a1, a2, a3);
+	AES_LOAD_LANE(input, 1, rb, b0, b1, b2, b3);
+	AES_LOAD_LANE(input, 2, rc, c0, c1, c2, c3);
+	AES_LOAD_LANE(input, 3, rd, d0, d1, d2, d3);
+	ra += 4; rb += 4; rc += 4; rd += 4;
+
+	for (i = (nr >> 1) - 1; i > 0; --i) {
+		AES_FROUND_LANE(ra, e0, e1, e2, e3, a0, a1, a2, a3);
+		AES_FROUND_LANE(rb, f0, f1, f2, f3, b0, b1, b2, b3);
+		AES_FROUND_LANE(rc, g0, g1, g2, g3, c0, c1, c2, c3);
+		AES_FROUND_LANE(rd, h0, h1, h2, h3, d0, d1, d2, d3);
+		ra += 4; rb += 4; rc += 4; rd += 4;
+
+		AES_FROUND_LANE(ra, a0, a1, a2, a3, e0, e1, e2, e3);
+		AES_FROUND_LANE(rb, b0, b1, b2, b3, f0, f1, f2, f3);
+		AES_FROUND_LANE(rc, c0, c1, c2, c3, g0, g1, g2, g3);
+		AES_FROUND_LANE(rd, d0, d1, d2, d3, h0, h1, h2, h3);
+		ra += 4; rb += 4; rc += 4; rd += 4;
+	}
+
+	AES_FROUND_LANE(ra, e0, e1, e2, e3, a0, a1, a2, a3);
+	AES_FROUND_LANE(rb, f0, f1, f2, f3, b0, b1, b2, b3);
+	AES_FROUND_LANE(rc, g0, g1, g2, g3, c0, c1, c2, c3);
+	AES_FROUND_LANE(rd, h0, h1, h2, h3, d0, d1, d2, d3);
+	ra += 4; rb += 4; rc += 4; rd += 4;
+
+	AES_FLAST_LANE(ra, a0, a1, a2, a3, e0, e1, e2, e3);
+	AES_FLAST_LANE(rb, b0, b1, b2, b3, f0, f1, f2, f3);
+	AES_FLAST_LANE(rc, c0, c1, c2, c3, g0, g1, g2, g3);
+	AES_FLAST_LANE(rd, d0, d1, d2, d3, h0, h1, h2, h3);
+
+	AES_STORE_LANE(output, 0, a0, a1, a2, a3);
+	AES_STORE_LANE(output, 1, b0, b1, b2, b3);
+	AES_STORE_LANE(output, 2, c0, c1, c2, c3);
+	AES_STORE_LANE(output, 3, d0, d1, d2, d3);
+}
+
+static void aes_portable_cbc_encrypt_lanes(struct aes_lane_cursor_t* const lanes, const uint32_t count, const int nr, uint32_t nblocks) {
+	const uint32_t* rk[AES_PORTABLE_LANES];
+	uint8_t block[AES_PORTABLE_LANES * AES_BLOCK_SIZE];
+	uint32_t l;
+	int i;
+
+	// unused lanes just encrypt zeroes with the first key
+	memset(block, 0, sizeof(block));
+	for (l = 0; l < AES_PORTABLE_LANES; ++l)
+		rk[l] = lanes[(l < count) ? l : 0].rk;
+
+	for (l = 0; l < count; ++l)
+		memcpy(block + l * AES_BLOCK_SIZE, lanes[l].iv, AES_BLOCK_SIZE);
+
+	while (nblocks > 0) {
+		for (l = 0; l < count; ++l) {
+			for (i = 0; i < AES_BLOCK_SIZE; ++i)
+				block[l * AES_BLOCK_SIZE + i] ^= lanes[l].input[i];
+		}
+
+		aes_portable_encrypt_lanes(rk, nr, block, block);
+
+		for (l = 0; l < count; ++l) {
+			memcpy(lanes[l].output, block + l * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+			lanes[l].input += AES_BLOCK_SIZE;
+			lanes[l].output += AES_BLOCK_SIZE;
+		}
+		nblocks--;
+	}
+
+	for (l = 0; l < count; ++l)
+		memcpy(lanes[l].iv, block + l * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+}
+
+static void aes_portable_cbc_decrypt(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	uint8_t plain[AES_PORTABLE_LANES * AES_BLOCK_SIZE];
+	uint8_t tail[AES_PORTABLE_LANES * AES_BLOCK_SIZE];
+
+	while (nblocks >= AES_PORTABLE_LANES) {
+		aes_portable_decrypt_lanes(ctx, src, plain);
+		aes_cbc_decrypt_chain(iv, src, dst, plain, AES_PORTABLE_LANES);
+
+		src += AES_PORTABLE_LANES * AES_BLOCK_SIZE;
+		dst += AES_PORTABLE_LANES * AES_BLOCK_SIZE;
+		nblocks -= AES_PORTABLE_LANES;
+	}
+
+	if (nblocks > 0) {
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, src, nblocks * AES_BLOCK_SIZE);
+
+		aes_portable_decrypt_lanes(ctx, tail, plain);
+		aes_cbc_decrypt_chain(iv, src, dst, plain, nblocks);
+	}
+}
+
+static void aes_portable_ctr(const struct aes_context_t* const ctx, uint8_t counter[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	const uint32_t* rk[AES_PORTABLE_LANES];
+	uint8_t stream[AES_PORTABLE_LANES * AES_BLOCK_SIZE];
+	uint32_t count;
+	int l;
+
+	for (l = 0; l < AES_PORTABLE_LANES; ++l)
+		rk[l] = ctx->rk;
+
+	// a short last batch just encrypts stale counters in the unused lanes
+	memset(stream, 0, sizeof(stream));
+
+	while (nblocks > 0) {
+		count = (nblocks < AES_PORTABLE_LANES) ? nblocks : AES_PORTABLE_LANES;
+
+		aes_ctr_fill(stream, counter, count);
+		aes_portable_encrypt_lanes(rk, ctx->nr, stream, stream);
+		aes_xor_bytes(dst, src, stream, count * AES_BLOCK_SIZE);
+
+		src += count * AES_BLOCK_SIZE;
+		dst += count * AES_BLOCK_SIZE;
+		nblocks -= count;
+	}
+}
+
+static void aes_portable_xts(const struct aes_context_t* const ctx, uint8_t tweak[AES_BLOCK_SIZE], const uint8_t* src, uint8_t* dst, uint32_t nblocks) {
+	const uint32_t* rk[AES_PORTABLE_LANES];
+	uint8_t tweaks[AES_PORTABLE_LANES * AES_BLOCK_SIZE];
+	uint8_t block[AES_PORTABLE_LANES * AES_BLOCK_SIZE];
+	uint32_t count, b;
+	int l;
+
+	for (l = 0; l < AES_PORTABLE_LANES; ++l)
+		rk[l] = ctx->rk;
+
+	// a short last batch just runs stale blocks through the unused lanes
+	memset(block, 0, sizeof(block));
+
+	while (nblocks > 0) {
+		count = (nblocks < AES_PORTABLE_LANES) ? nblocks : AES_PORTABLE_LANES;
+
+		for (b = 0; b < count; ++b) {
+			memcpy(tweaks + b * AES_BLOCK_SIZE, tweak, AES_BLOCK_SIZE);
+			aes_xts_mulx(tweak);
+		}
+
+		aes_xor_bytes(block, src, tweaks, count * AES_BLOCK_SIZE);
+		if (ctx->mode == AES_DECRYPT)
+			aes_portable_decrypt_lanes(ctx, block, block);
+		else
+			aes_portable_encrypt_lanes(rk, ctx->nr, block, block);
+		aes_xor_bytes(dst, block, tweaks, count * AES_BLOCK_SIZE);
+
+		src += count * AES_BLOCK_SIZE;
+		dst += count * AES_BLOCK_SIZE;
+		nblocks -= count;
+	}
+}
+
+const struct aes_backend_t aes_backend_portable = {
+	.name = "portable",
+	.supported = NULL,
+	.expand_key = aes_portable_expand_key,
+	.invert_key = aes_portable_invert_key,
+	.ecb = aes_portable_ecb,
+	.cbc_encrypt = aes_portable_cbc_encrypt,
+	.cbc_decrypt = aes_portable_cbc_decrypt,
+	.ctr = aes_portable_ctr,
+	.xts = aes_portable_xts,
+	.max_lanes = AES_PORTABLE_LANES,
+	.cbc_encrypt_lanes = aes_portable_cbc_encrypt_lanes,
+};
+
+int aes_key_init(struct aes_key_t* const key, const uint8_t* const raw_key, const unsigned int key_size) {
+	int result;
+
+	result = aes_init(&key->enc, AES_ENCRYPT, raw_key, key_size);
+	if (result != 0)
+		return result;
+
+	// the decryption schedule is derived from the expanded encryption one
+	key->dec.rk = key->dec.buf;
+	key->dec.nr = key->enc.nr;
+	key->dec.mode = AES_DECRYPT;
+	aes_invert_key(key->dec.buf, key->enc.rk, key->enc.nr);
+
+	return 0;
+}
+
+int aes_crypt_ecb(const struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
+	aes_backend->ecb(ctx, input, output);
 
 	return 0;
 }
@@ -619,43 +964,25 @@ int aes_decrypt_ecb(const uint8_t* const key, const int key_size, const uint8_t
 	return 0;
 }
 
-int aes_crypt_cbc(struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length) {
-	if (length % AES_BLOCK_SIZE != 0)
-		return ERROR_INVALID_DATA_SIZE;
-
-	const uint8_t* src = input;
-	uint8_t* dst = output;
-	uint32_t size = length;
-	int i;
-
-	if (ctx->mode == AES_DECRYPT) {
-		uint8_t temp[AES_BLOCK_SIZE];
-		while (size > 0) {
-			memcpy(temp, src, AES_BLOCK_SIZE);
-			aes_crypt_ecb(ctx, src, dst);
-
-			for (i = 0; i < AES_BLOCK_SIZE; ++i)
-				dst[i] = dst[i] ^ iv[i];
+int aes_key_encrypt_ecb(const struct aes_key_t* const key, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
+	return aes_crypt_ecb(&key->enc, input, output);
+}
 
-			memcpy(iv, temp, AES_BLOCK_SIZE);
+int aes_key_decrypt_ecb(const struct aes_key_t* const key, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]) {
+	return aes_crypt_ecb(&key->dec, input, output);
+}
 
-			src += AES_BLOCK_SIZE;
-			dst += AES_BLOCK_SIZE;
-			size -= AES_BLOCK_SIZE;
-		}
-	} else {
-		while (size > 0) {
-			for (i = 0; i < AES_BLOCK_SIZE; ++i)
-				dst[i] = src[i] ^ iv[i];
+int aes_crypt_cbc(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length) {
+	if (length % AES_BLOCK_SIZE != 0)
+		return ERROR_INVALID_DATA_SIZE;
 
-			aes_crypt_ecb(ctx, dst, dst);
-			memcpy(iv, dst, 16);
+	if (length == 0)
+		return 0;
 
-			src += AES_BLOCK_SIZE;
-			dst += AES_BLOCK_SIZE;
-			size -= AES_BLOCK_SIZE;
-		}
-	}
+	if (ctx->mode == AES_DECRYPT)
+		aes_backend->cbc_decrypt(ctx, iv, input, output, length / AES_BLOCK_SIZE);
+	else
+		aes_backend->cbc_encrypt(ctx, iv, input, output, length / AES_BLOCK_SIZE);
 
 	return 0;
 }
@@ -700,37 +1027,202 @@ int aes_decrypt_cbc(const uint8_t* const key, const int key_size, const uint8_t
 	return 0;
 }
 
-int aes_crypt_ctr(struct aes_context_t* const ctx, uint8_t nonce[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length) {
-	uint8_t counter[AES_BLOCK_SIZE];
-	uint8_t stream_block[AES_BLOCK_SIZE];
+int aes_key_encrypt_cbc(const struct aes_key_t* const key, const uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length) {
+	uint8_t temp[AES_BLOCK_SIZE];
 
-	const uint8_t* src = input;
-	uint8_t* dst = output;
-	uint32_t size = length;
-	uint32_t left;
-	int i;
+	memcpy(temp, iv, AES_BLOCK_SIZE);
+
+	return aes_crypt_cbc(&key->enc, temp, input, output, length);
+}
+
+int aes_key_decrypt_cbc(const struct aes_key_t* const key, const uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length) {
+	uint8_t temp[AES_BLOCK_SIZE];
+
+	memcpy(temp, iv, AES_BLOCK_SIZE);
+
+	return aes_crypt_cbc(&key->dec, temp, input, output, length);
+}
 
-	memcpy(counter, nonce, AES_BLOCK_SIZE);
-	
-	for (left = size; left > 0; ) {
-		aes_crypt_ecb(ctx, counter, stream_block);
+int aes_crypt_cbc_multi(struct aes_cbc_lane_t* const lanes, const uint32_t count) {
+	struct aes_lane_cursor_t active[AES_MAX_LANES];
+	uint32_t remaining[AES_MAX_LANES];
 
-		size = (left < AES_BLOCK_SIZE) ? left : AES_BLOCK_SIZE;
-		for (i = 0; i < size; ++i)
-			dst[i] = src[i] ^ stream_block[i];
+	const uint32_t max_lanes = aes_backend->max_lanes;
+	uint32_t i, next, nactive, nblocks;
+	int nr;
 
-		src += size;
-		dst += size;
-		left -= size;
+	for (i = 0; i < count; ++i) {
+		if (lanes[i].ctx->mode != AES_ENCRYPT)
+			return ERROR_INVALID_MODE;
+		if (lanes[i].length % AES_BLOCK_SIZE != 0)
+			return ERROR_INVALID_DATA_SIZE;
+		if (lanes[i].ctx->nr != 10 && lanes[i].ctx->nr != 12 && lanes[i].ctx->nr != 14)
+			return ERROR_INVALID_KEY_SIZE;
+	}
 
-		for (i = AES_BLOCK_SIZE - 1; i >= 0; --i) {
-			counter[i]++;
-			if (counter[i] != 0)
+	// lanes running together must share the number of rounds
+	for (nr = 10; nr <= 14; nr += 2) {
+		next = 0;
+		nactive = 0;
+
+		for (;;) {
+			// refill free lanes
+			while (nactive < max_lanes && next < count) {
+				struct aes_cbc_lane_t* const lane = &lanes[next++];
+				if (lane->ctx->nr != nr || lane->length == 0)
+					continue;
+
+				active[nactive].rk = lane->ctx->rk;
+				active[nactive].iv = lane->iv;
+				active[nactive].input = lane->input;
+				active[nactive].output = lane->output;
+				remaining[nactive] = lane->length / AES_BLOCK_SIZE;
+				nactive++;
+			}
+
+			if (nactive == 0)
 				break;
+
+			// run until the shortest lane is done
+			nblocks = remaining[0];
+			for (i = 1; i < nactive; ++i) {
+				if (remaining[i] < nblocks)
+					nblocks = remaining[i];
+			}
+
+			aes_backend->cbc_encrypt_lanes(active, nactive, nr, nblocks);
+
+			for (i = 0; i < nactive; ++i)
+				remaining[i] -= nblocks;
+
+			// retire finished lanes, their iv is already updated
+			for (i = 0; i < nactive; ) {
+				if (remaining[i] == 0) {
+					nactive--;
+					active[i] = active[nactive];
+					remaining[i] = remaining[nactive];
+				} else {
+					++i;
+				}
+			}
 		}
 	}
 
-	memcpy(nonce, counter, AES_BLOCK_SIZE);
+	return 0;
+}
+
+//
+// Long CTR and XTS inputs are split across worker threads, every thread gets
+// at least AES_THREAD_BLOCKS blocks
+//
+#define AES_MAX_THREADS 8
+#define AES_THREAD_BLOCKS (256 * 1024 / AES_BLOCK_SIZE)
+
+// Number of worker threads, set by crypto_init()
+static uint32_t aes_threads = 1;
+
+//
+// Runs count jobs of job_size bytes each, the calling thread takes the first
+// one and any job whose thread could not be started
+//
+static void aes_run_parallel(void* (*const worker)(void*), void* const jobs, const size_t job_size, const uint32_t count) {
+	pthread_t threads[AES_MAX_THREADS];
+	int started[AES_MAX_THREADS];
+	uint8_t* const job = (uint8_t*)jobs;
+	uint32_t t;
+
+	for (t = 1; t < count; ++t)
+		started[t] = (pthread_create(&threads[t], NULL, worker, job + t * job_size) == 0);
+
+	worker(job);
+
+	for (t = 1; t < count; ++t) {
+		if (started[t])
+			pthread_join(threads[t], NULL);
+		else
+			worker(job + t * job_size);
+	}
+}
+
+struct aes_ctr_job_t {
+	const struct aes_context_t* ctx;
+	uint8_t counter[AES_BLOCK_SIZE];
+	const uint8_t* input;
+	uint8_t* output;
+	uint32_t nblocks;
+};
+
+//
+// Big endian 128-bit counter addition
+//
+static void aes_ctr_add(uint8_t counter[AES_BLOCK_SIZE], uint32_t value) {
+	uint32_t sum;
+	int i;
+
+	for (i = AES_BLOCK_SIZE - 1; i >= 0 && value != 0; --i) {
+		sum = counter[i] + (value & 0xFF);
+		counter[i] = (uint8_t)sum;
+		value = (value >> 8) + (sum >> 8);
+	}
+}
+
+static void* aes_ctr_worker(void* const arg) {
+	struct aes_ctr_job_t* const job = (struct aes_ctr_job_t*)arg;
+
+	aes_backend->ctr(job->ctx, job->counter, job->input, job->output, job->nblocks);
+
+	return NULL;
+}
+
+//
+// Every chunk starts at its own counter offset
+//
+static void aes_ctr_parallel(const struct aes_context_t* const ctx, uint8_t counter[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t nblocks) {
+	struct aes_ctr_job_t jobs[AES_MAX_THREADS];
+	uint32_t count, offset, t;
+
+	count = nblocks / AES_THREAD_BLOCKS;
+	if (count > aes_threads)
+		count = aes_threads;
+
+	offset = 0;
+	for (t = 0; t < count; ++t) {
+		jobs[t].ctx = ctx;
+		memcpy(jobs[t].counter, counter, AES_BLOCK_SIZE);
+		aes_ctr_add(jobs[t].counter, offset);
+		jobs[t].input = input + offset * AES_BLOCK_SIZE;
+		jobs[t].output = output + offset * AES_BLOCK_SIZE;
+		jobs[t].nblocks = (t == count - 1) ? nblocks - offset : nblocks / count;
+		offset += jobs[t].nblocks;
+	}
+
+	aes_run_parallel(aes_ctr_worker, jobs, sizeof(jobs[0]), count);
+
+	// the last chunk ends where the whole input does
+	memcpy(counter, jobs[count - 1].counter, AES_BLOCK_SIZE);
+}
+
+int aes_crypt_ctr(const struct aes_context_t* const ctx, uint8_t nonce[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length) {
+	uint8_t stream_block[AES_BLOCK_SIZE];
+
+	const uint32_t nblocks = length / AES_BLOCK_SIZE;
+	const uint32_t left = length % AES_BLOCK_SIZE;
+	const uint32_t offset = nblocks * AES_BLOCK_SIZE;
+	uint32_t i;
+
+	if (nblocks >= 2 * AES_THREAD_BLOCKS && aes_threads > 1)
+		aes_ctr_parallel(ctx, nonce, input, output, nblocks);
+	else if (nblocks > 0)
+		aes_backend->ctr(ctx, nonce, input, output, nblocks);
+
+	if (left > 0) {
+		aes_backend->ecb(ctx, nonce, stream_block);
+
+		for (i = 0; i < left; ++i)
+			output[offset + i] = input[offset + i] ^ stream_block[i];
+
+		aes_ctr_increment(nonce);
+	}
 
 	return 0;
 }
@@ -755,6 +1247,14 @@ int aes_ctr(const uint8_t* const key, const int key_size, const uint8_t nonce[AE
 	return 0;
 }
 
+int aes_key_ctr(const struct aes_key_t* const key, const uint8_t nonce[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length) {
+	uint8_t temp[AES_BLOCK_SIZE];
+
+	memcpy(temp, nonce, AES_BLOCK_SIZE);
+
+	return aes_crypt_ctr(&key->enc, temp, input, output, length);
+}
+
 int aes_xts_init(struct aes_xts_context_t* const ctx, const int mode, const uint8_t* const tweak_key, const int tweak_key_size, const uint8_t* const data_key, const int data_key_size) {
 	int result;
 
@@ -774,13 +1274,11 @@ int aes_xts_init(struct aes_xts_context_t* const ctx, const int mode, const uint
 	return 0;
 }
 
-int aes_crypt_xts(struct aes_xts_context_t* const ctx, const uint8_t* const input, uint8_t* const output, const uint64_t sector_index, const uint32_t sector_size) {
+int aes_crypt_xts(const struct aes_xts_context_t* const ctx, const uint8_t* const input, uint8_t* const output, const uint64_t sector_index, const uint32_t sector_size) {
 	uint8_t tweak[AES_BLOCK_SIZE];
-	uint8_t block[AES_BLOCK_SIZE];
 
 	uint64_t nonce;
-	uint32_t carry_in, carry_out;
-	int i, j;
+	int i;
 
 	if (sector_size % AES_BLOCK_SIZE != 0)
 		return ERROR_INVALID_DATA_SIZE;
@@ -793,31 +1291,71 @@ int aes_crypt_xts(struct aes_xts_context_t* const ctx, const uint8_t* const inpu
 		nonce >>= 8;
 	}
 
-	aes_crypt_ecb(&ctx->tweak_ctx, tweak, tweak);
+	aes_backend->ecb(&ctx->tweak_ctx, tweak, tweak);
+
+	if (sector_size > 0)
+		aes_backend->xts(&ctx->data_ctx, tweak, input, output, sector_size / AES_BLOCK_SIZE);
 
-	for (i = 0; i < sector_size; i += AES_BLOCK_SIZE) {
-		for (j = 0; j < AES_BLOCK_SIZE; ++j)
-			block[j] = input[i + j] ^ tweak[j];
+	return 0;
+}
+
+struct aes_xts_job_t {
+	const struct aes_xts_context_t* ctx;
+	const uint8_t* input;
+	uint8_t* output;
+	uint64_t first_sector;
+	uint32_t sector_count;
+	uint32_t sector_size;
+};
 
-		aes_crypt_ecb(&ctx->data_ctx, block, block);
+static void* aes_xts_worker(void* const arg) {
+	struct aes_xts_job_t* const job = (struct aes_xts_job_t*)arg;
+	uint32_t i;
 
-		for (j = 0; j < AES_BLOCK_SIZE; ++j)
-			output[i + j] = block[j] ^ tweak[j];
+	for (i = 0; i < job->sector_count; ++i)
+		aes_crypt_xts(job->ctx, job->input + (size_t)i * job->sector_size, job->output + (size_t)i * job->sector_size, job->first_sector + i, job->sector_size);
 
-		carry_in = 0; carry_out = 0;
-		for (j = 0; j < AES_BLOCK_SIZE; ++j) {
-			carry_out = (tweak[j] >> 7) & 1;
-			tweak[j] = ((tweak[j] << 1) + carry_in) & 0xFF;
-			carry_in = carry_out;
-		}
-		if (carry_out)
-			tweak[0] ^= 0x87;
+	return NULL;
+}
+
+int aes_crypt_xts_sectors(const struct aes_xts_context_t* const ctx, const uint8_t* const input, uint8_t* const output, const uint64_t first_sector, const uint32_t sector_count, const uint32_t sector_size) {
+	struct aes_xts_job_t jobs[AES_MAX_THREADS];
+	uint32_t sector_blocks, count, offset, t;
+
+	if (sector_size % AES_BLOCK_SIZE != 0)
+		return ERROR_INVALID_DATA_SIZE;
+
+	if (sector_count == 0 || sector_size == 0)
+		return 0;
+
+	sector_blocks = sector_size / AES_BLOCK_SIZE;
+
+	count = 1;
+	if (aes_threads > 1 && (uint64_t)sector_count * sector_blocks >= 2 * AES_THREAD_BLOCKS) {
+		count = (uint32_t)(((uint64_t)sector_count * sector_blocks) / AES_THREAD_BLOCKS);
+		if (count > aes_threads)
+			count = aes_threads;
+		if (count > sector_count)
+			count = sector_count;
+	}
+
+	offset = 0;
+	for (t = 0; t < count; ++t) {
+		jobs[t].ctx = ctx;
+		jobs[t].input = input + (size_t)offset * sector_size;
+		jobs[t].output = output + (size_t)offset * sector_size;
+		jobs[t].first_sector = first_sector + offset;
+		jobs[t].sector_count = (t == count - 1) ? sector_count - offset : sector_count / count;
+		jobs[t].sector_size = sector_size;
+		offset += jobs[t].sector_count;
 	}
 
+	aes_run_parallel(aes_xts_worker, jobs, sizeof(jobs[0]), count);
+
 	return 0;
 }
 
-int aes_encrypt_xts(const uint8_t* const tweak_key, const int tweak_key_size, const uint8_t* const data_key, const int data_key_size, const uint8_t* const input, uint8_t* const output, const uint32_t sector_index, const uint32_t sector_size) {
+int aes_encrypt_xts(const uint8_t* const tweak_key, const int tweak_key_size, const uint8_t* const data_key, const int data_key_size, const uint8_t* const input, uint8_t* const output, const uint64_t sector_index, const uint32_t sector_size) {
 	int result;
 
 	struct aes_xts_context_t ctx;
@@ -830,84 +1368,779 @@ int aes_encrypt_xts(const uint8_t* const tweak_key, const int tweak_key_size, co
 	if (result != 0)
 		return result;
 
-	return 0;
+	return 0;
+}
+
+int aes_decrypt_xts(const uint8_t* const tweak_key, const int tweak_key_size, const uint8_t* const data_key, const int data_key_size, const uint8_t* const input, uint8_t* const output, const uint64_t sector_index, const uint32_t sector_size) {
+	int result;
+
+	struct aes_xts_context_t ctx;
+
+	result = aes_xts_init(&ctx, AES_DECRYPT, tweak_key, tweak_key_size, data_key, data_key_size);
+	if (result != 0)
+		return result;
+
+	result = aes_crypt_xts(&ctx, input, output, sector_index, sector_size);
+	if (result != 0)
+		return result;
+
+	return 0;
+}
+
+static void gf_mulx(uint8_t* const pad) {
+	uint32_t carry;
+	int i;
+
+	carry = pad[0] & 0x80;
+	for (i = 0; i < AES_BLOCK_SIZE - 1; ++i)
+		pad[i] = (pad[i] << 1) | (pad[i + 1] >> 7);
+	pad[AES_BLOCK_SIZE - 1] <<= 1;
+	if (carry)
+		pad[AES_BLOCK_SIZE - 1] ^= 0x87;
+}
+
+//
+// CMAC messages are chained through the CBC encryption kernels in chunks of
+// AES_CMAC_CHUNK_BLOCKS, the ciphertext only lands in a scratch buffer
+//
+#define AES_CMAC_CHUNK_BLOCKS 32
+
+//
+// Number of messages aes_cmac_verify_multi keeps in flight
+//
+#define AES_CMAC_VERIFY_GROUP 16
+
+static void aes_cmac_subkeys(const struct aes_context_t* const ctx, uint8_t k1[AES_BLOCK_SIZE], uint8_t k2[AES_BLOCK_SIZE]) {
+	memset(k1, 0, AES_BLOCK_SIZE);
+	aes_backend->ecb(ctx, k1, k1);
+	gf_mulx(k1);
+
+	memcpy(k2, k1, AES_BLOCK_SIZE);
+	gf_mulx(k2);
+}
+
+static void aes_cmac_blocks(const struct aes_context_t* const ctx, uint8_t state[AES_BLOCK_SIZE], const uint8_t* input, uint32_t nblocks) {
+	uint8_t scratch[AES_CMAC_CHUNK_BLOCKS * AES_BLOCK_SIZE];
+	uint32_t count;
+
+	while (nblocks > 0) {
+		count = (nblocks < AES_CMAC_CHUNK_BLOCKS) ? nblocks : AES_CMAC_CHUNK_BLOCKS;
+		aes_backend->cbc_encrypt(ctx, state, input, scratch, count);
+
+		input += count * AES_BLOCK_SIZE;
+		nblocks -= count;
+	}
+}
+
+//
+// Last message block, complete ones are masked with K1 and padded ones with K2
+//
+static void aes_cmac_last_block(const uint8_t k1[AES_BLOCK_SIZE], const uint8_t k2[AES_BLOCK_SIZE], const uint8_t* const input, const uint32_t length, uint8_t block[AES_BLOCK_SIZE]) {
+	int i;
+
+	if (length == AES_BLOCK_SIZE) {
+		for (i = 0; i < AES_BLOCK_SIZE; ++i)
+			block[i] = input[i] ^ k1[i];
+	} else {
+		memset(block, 0, AES_BLOCK_SIZE);
+		memcpy(block, input, length);
+		block[length] = 0x80;
+
+		for (i = 0; i < AES_BLOCK_SIZE; ++i)
+			block[i] ^= k2[i];
+	}
+}
+
+//
+// Number of message bytes in front of the last block, which may be partial
+// or, for an empty message, missing
+//
+static uint32_t aes_cmac_prefix_length(const uint32_t length) {
+	return (length == 0) ? 0 : ((length - 1) / AES_BLOCK_SIZE) * AES_BLOCK_SIZE;
+}
+
+static void aes_cmac_ctx(const struct aes_context_t* const ctx, const uint8_t* const input, uint8_t* const output, const uint32_t length) {
+	uint8_t k1[AES_BLOCK_SIZE];
+	uint8_t k2[AES_BLOCK_SIZE];
+	uint8_t state[AES_BLOCK_SIZE];
+	uint8_t block[AES_BLOCK_SIZE];
+
+	const uint32_t prefix = aes_cmac_prefix_length(length);
+
+	aes_cmac_subkeys(ctx, k1, k2);
+
+	memset(state, 0, AES_BLOCK_SIZE);
+	aes_cmac_blocks(ctx, state, input, prefix / AES_BLOCK_SIZE);
+
+	aes_cmac_last_block(k1, k2, input + prefix, length - prefix, block);
+	aes_backend->cbc_encrypt(ctx, state, block, output, 1);
+}
+
+int aes_cmac(const uint8_t* const key, const int key_size, const uint8_t* const input, uint8_t* const output, const uint32_t length) {
+	int result;
+
+	struct aes_context_t ctx;
+
+	result = aes_init(&ctx, AES_ENCRYPT, key, key_size);
+	if (result != 0)
+		return result;
+
+	aes_cmac_ctx(&ctx, input, output, length);
+
+	return 0;
+}
+
+int aes_key_cmac(const struct aes_key_t* const key, const uint8_t* const input, uint8_t* const output, const uint32_t length) {
+	aes_cmac_ctx(&key->enc, input, output, length);
+
+	return 0;
+}
+
+int aes_cmac_init(struct aes_cmac_context_t* const ctx, const uint8_t* const key, const int key_size) {
+	int result;
+
+	result = aes_init(&ctx->cipher, AES_ENCRYPT, key, key_size);
+	if (result != 0)
+		return result;
+
+	aes_cmac_subkeys(&ctx->cipher, ctx->k1, ctx->k2);
+
+	return aes_cmac_starts(ctx);
+}
+
+int aes_cmac_starts(struct aes_cmac_context_t* const ctx) {
+	memset(ctx->state, 0, AES_BLOCK_SIZE);
+	ctx->block_length = 0;
+
+	return 0;
+}
+
+int aes_cmac_update(struct aes_cmac_context_t* const ctx, const uint8_t* input, uint32_t length) {
+	uint32_t fill, nblocks;
+
+	if (length == 0)
+		return 0;
+
+	// top up the pending block, it is only processed once more data follows
+	if (ctx->block_length > 0) {
+		fill = AES_BLOCK_SIZE - ctx->block_length;
+		if (fill > length)
+			fill = length;
+
+		memcpy(ctx->block + ctx->block_length, input, fill);
+		ctx->block_length += fill;
+		input += fill;
+		length -= fill;
+
+		if (length == 0)
+			return 0;
+
+		aes_cmac_blocks(&ctx->cipher, ctx->state, ctx->block, 1);
+		ctx->block_length = 0;
+	}
+
+	// everything but the last block, which may turn out to be the final one
+	nblocks = aes_cmac_prefix_length(length) / AES_BLOCK_SIZE;
+	aes_cmac_blocks(&ctx->cipher, ctx->state, input, nblocks);
+	input += nblocks * AES_BLOCK_SIZE;
+	length -= nblocks * AES_BLOCK_SIZE;
+
+	memcpy(ctx->block, input, length);
+	ctx->block_length = length;
+
+	return 0;
+}
+
+int aes_cmac_finish(struct aes_cmac_context_t* const ctx, uint8_t output[AES_BLOCK_SIZE]) {
+	uint8_t block[AES_BLOCK_SIZE];
+
+	aes_cmac_last_block(ctx->k1, ctx->k2, ctx->block, ctx->block_length, block);
+	aes_backend->cbc_encrypt(&ctx->cipher, ctx->state, block, output, 1);
+
+	return aes_cmac_starts(ctx);
+}
+
+int aes_tag_equal(const uint8_t* const a, const uint8_t* const b, const uint32_t length) {
+	uint8_t diff = 0;
+	uint32_t i;
+
+	for (i = 0; i < length; ++i)
+		diff |= a[i] ^ b[i];
+
+	return diff == 0;
+}
+
+int aes_cmac_verify_multi(struct aes_cmac_verify_t* const items, const uint32_t count) {
+	struct aes_cbc_lane_t lanes[AES_CMAC_VERIFY_GROUP];
+	uint8_t scratch[AES_CMAC_VERIFY_GROUP][AES_CMAC_CHUNK_BLOCKS * AES_BLOCK_SIZE];
+	uint8_t last[AES_CMAC_VERIFY_GROUP][AES_BLOCK_SIZE];
+	uint8_t tags[AES_CMAC_VERIFY_GROUP][AES_BLOCK_SIZE];
+	uint32_t done[AES_CMAC_VERIFY_GROUP];
+	uint32_t prefix[AES_CMAC_VERIFY_GROUP];
+
+	uint32_t first, group, g, n, pending;
+	int invalid = 0;
+	int result;
+
+	for (first = 0; first < count; first += group) {
+		struct aes_cmac_verify_t* const item = items + first;
+
+		group = count - first;
+		if (group > AES_CMAC_VERIFY_GROUP)
+			group = AES_CMAC_VERIFY_GROUP;
+
+		for (g = 0; g < group; ++g) {
+			lanes[g].ctx = &item[g].key->cipher;
+			memset(lanes[g].iv, 0, AES_BLOCK_SIZE);
+			prefix[g] = aes_cmac_prefix_length(item[g].length) / AES_BLOCK_SIZE;
+			done[g] = 0;
+		}
+
+		// CBC-MAC of everything but the last blocks, one chunk of every message per pass
+		do {
+			pending = 0;
+			for (g = 0; g < group; ++g) {
+				n = prefix[g] - done[g];
+				if (n > AES_CMAC_CHUNK_BLOCKS)
+					n = AES_CMAC_CHUNK_BLOCKS;
+
+				lanes[g].input = item[g].message + done[g] * AES_BLOCK_SIZE;
+				lanes[g].output = scratch[g];
+				lanes[g].length = n * AES_BLOCK_SIZE;
+				done[g] += n;
+				pending += n;
+			}
+
+			if (pending > 0) {
+				result = aes_crypt_cbc_multi(lanes, group);
+				if (result != 0)
+					return result;
+			}
+		} while (pending > 0);
+
+		// the masked last blocks produce the tags
+		for (g = 0; g < group; ++g) {
+			aes_cmac_last_block(item[g].key->k1, item[g].key->k2, item[g].message + prefix[g] * AES_BLOCK_SIZE, item[g].length - prefix[g] * AES_BLOCK_SIZE, last[g]);
+
+			lanes[g].input = last[g];
+			lanes[g].output = tags[g];
+			lanes[g].length = AES_BLOCK_SIZE;
+		}
+
+		result = aes_crypt_cbc_multi(lanes, group);
+		if (result != 0)
+			return result;
+
+		for (g = 0; g < group; ++g) {
+			item[g].valid = aes_tag_equal(tags[g], item[g].tag, AES_BLOCK_SIZE);
+			if (!item[g].valid)
+				invalid++;
+		}
+	}
+
+	return invalid;
+}
+
+//-----------------------------------------------------------------------------
+// Backend self-tests
+//-----------------------------------------------------------------------------
+
+//
+// FIPS-197 appendix C: the same plaintext under 128, 192 and 256-bit keys
+//
+static const uint8_t aes_kat_key[32] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+};
+
+static const uint8_t aes_kat_plain[AES_BLOCK_SIZE] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF,
+};
+
+static const uint8_t aes_kat_cipher[3][AES_BLOCK_SIZE] = {
+	{ 0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A },
+	{ 0xDD, 0xA9, 0x7C, 0xA4, 0x86, 0x4C, 0xDF, 0xE0, 0x6E, 0xAF, 0x70, 0xA0, 0xEC, 0x0D, 0x71, 0x91 },
+	{ 0x8E, 0xA2, 0xB7, 0xCA, 0x51, 0x67, 0x45, 0xBF, 0xEA, 0xFC, 0x49, 0x90, 0x4B, 0x49, 0x60, 0x89 },
+};
+
+//
+// SP 800-38A F.2.1 and F.5.1, CBC and CTR with AES-128
+//
+static const uint8_t aes_kat_mode_key[16] = {
+	0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C,
+};
+
+static const uint8_t aes_kat_mode_plain[4 * AES_BLOCK_SIZE] = {
+	0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+	0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+	0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11, 0xE5, 0xFB, 0xC1, 0x19, 0x1A, 0x0A, 0x52, 0xEF,
+	0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B, 0x17, 0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10,
+};
+
+static const uint8_t aes_kat_cbc_iv[AES_BLOCK_SIZE] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+};
+
+static const uint8_t aes_kat_cbc_cipher[4 * AES_BLOCK_SIZE] = {
+	0x76, 0x49, 0xAB, 0xAC, 0x81, 0x19, 0xB2, 0x46, 0xCE, 0xE9, 0x8E, 0x9B, 0x12, 0xE9, 0x19, 0x7D,
+	0x50, 0x86, 0xCB, 0x9B, 0x50, 0x72, 0x19, 0xEE, 0x95, 0xDB, 0x11, 0x3A, 0x91, 0x76, 0x78, 0xB2,
+	0x73, 0xBE, 0xD6, 0xB8, 0xE3, 0xC1, 0x74, 0x3B, 0x71, 0x16, 0xE6, 0x9E, 0x22, 0x22, 0x95, 0x16,
+	0x3F, 0xF1, 0xCA, 0xA1, 0x68, 0x1F, 0xAC, 0x09, 0x12, 0x0E, 0xCA, 0x30, 0x75, 0x86, 0xE1, 0xA7,
+};
+
+static const uint8_t aes_kat_ctr_counter[AES_BLOCK_SIZE] = {
+	0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF,
+};
+
+static const uint8_t aes_kat_ctr_cipher[4 * AES_BLOCK_SIZE] = {
+	0x87, 0x4D, 0x61, 0x91, 0xB6, 0x20, 0xE3, 0x26, 0x1B, 0xEF, 0x68, 0x64, 0x99, 0x0D, 0xB6, 0xCE,
+	0x98, 0x06, 0xF6, 0x6B, 0x79, 0x70, 0xFD, 0xFF, 0x86, 0x17, 0x18, 0x7B, 0xB9, 0xFF, 0xFD, 0xFF,
+	0x5A, 0xE4, 0xDF, 0x3E, 0xDB, 0xD5, 0xD3, 0x5E, 0x5B, 0x4F, 0x09, 0x02, 0x0D, 0xB0, 0x3E, 0xAB,
+	0x1E, 0x03, 0x1D, 0xDA, 0x2F, 0xBE, 0x03, 0xD1, 0x79, 0x21, 0x70, 0xA0, 0xF3, 0x00, 0x9C, 0xEE,
+};
+
+//
+// IEEE 1619 XTS-AES-128 vector 1: all-zero keys and data, sector 0. The
+// backends get the tweak already encrypted, AES-128 of zero under zero.
+//
+static const uint8_t aes_kat_xts_tweak[AES_BLOCK_SIZE] = {
+	0x66, 0xE9, 0x4B, 0xD4, 0xEF, 0x8A, 0x2C, 0x3B, 0x88, 0x4C, 0xFA, 0x59, 0xCA, 0x34, 0x2B, 0x2E,
+};
+
+static const uint8_t aes_kat_xts_cipher[2 * AES_BLOCK_SIZE] = {
+	0x91, 0x7C, 0xF6, 0x9E, 0xBD, 0x68, 0xB2, 0xEC, 0x9B, 0x9F, 0xE9, 0xA3, 0xEA, 0xDD, 0xA6, 0x92,
+	0xCD, 0x43, 0xD2, 0xF5, 0x95, 0x98, 0xED, 0x85, 0x8C, 0x02, 0xC2, 0x65, 0x2F, 0xBF, 0x92, 0x2E,
+};
+
+//
+// Long enough for the widest batch of every bulk backend plus a tail, these
+// are compared against the portable code once that passed the vectors
+//
+#define AES_SELFTEST_BLOCKS 67
+
+//
+// Key schedule as the backend under test would build it
+//
+static void aes_selftest_key(const struct aes_backend_t* const backend, struct aes_context_t* const ctx, const int mode, const uint8_t* const key, const unsigned int key_size) {
+	uint32_t erk[68];
+
+	ctx->nr = 6 + (key_size >> 5);
+	ctx->rk = ctx->buf;
+	ctx->mode = mode;
+
+	if (backend->expand_key == NULL || backend->expand_key(erk, key, key_size) != 0)
+		aes_portable_expand_key(erk, key, key_size);
+
+	if (mode == AES_ENCRYPT)
+		memcpy(ctx->buf, erk, sizeof(erk));
+	else if (backend->invert_key != NULL)
+		backend->invert_key(ctx->buf, erk, ctx->nr);
+	else
+		aes_portable_invert_key(ctx->buf, erk, ctx->nr);
+}
+
+//
+// Runs every operation the backend implements, returns 0 if all of them
+// give the expected results
+//
+static int aes_backend_selftest(const struct aes_backend_t* const backend) {
+	const struct aes_backend_t* const portable = &aes_backend_portable;
+	uint8_t input[AES_SELFTEST_BLOCKS * AES_BLOCK_SIZE];
+	uint8_t expected[AES_SELFTEST_BLOCKS * AES_BLOCK_SIZE];
+	uint8_t output[AES_SELFTEST_BLOCKS * AES_BLOCK_SIZE];
+	uint8_t iv[2][AES_BLOCK_SIZE];
+	struct aes_context_t enc, dec;
+	struct aes_lane_cursor_t lanes[2];
+	uint32_t i;
+	int k;
+
+	for (i = 0; i < sizeof(input); ++i)
+		input[i] = (uint8_t)(i * 73 + 11);
+
+	if (backend->ecb != NULL) {
+		for (k = 0; k < 3; ++k) {
+			aes_selftest_key(backend, &enc, AES_ENCRYPT, aes_kat_key, 128 + 64 * k);
+			aes_selftest_key(backend, &dec, AES_DECRYPT, aes_kat_key, 128 + 64 * k);
+
+			backend->ecb(&enc, aes_kat_plain, output);
+			if (memcmp(output, aes_kat_cipher[k], AES_BLOCK_SIZE) != 0)
+				return -1;
+
+			backend->ecb(&dec, aes_kat_cipher[k], output);
+			if (memcmp(output, aes_kat_plain, AES_BLOCK_SIZE) != 0)
+				return -1;
+		}
+	}
+
+	aes_selftest_key(backend, &enc, AES_ENCRYPT, aes_kat_mode_key, 128);
+	aes_selftest_key(backend, &dec, AES_DECRYPT, aes_kat_mode_key, 128);
+
+	if (backend->cbc_encrypt != NULL) {
+		memcpy(iv[0], aes_kat_cbc_iv, AES_BLOCK_SIZE);
+		backend->cbc_encrypt(&enc, iv[0], aes_kat_mode_plain, output, 4);
+		if (memcmp(output, aes_kat_cbc_cipher, sizeof(aes_kat_cbc_cipher)) != 0)
+			return -1;
+	}
+
+	if (backend->cbc_decrypt != NULL) {
+		memcpy(iv[0], aes_kat_cbc_iv, AES_BLOCK_SIZE);
+		backend->cbc_decrypt(&dec, iv[0], aes_kat_cbc_cipher, output, 4);
+		if (memcmp(output, aes_kat_mode_plain, sizeof(aes_kat_mode_plain)) != 0)
+			return -1;
+
+		memset(iv[0], 0, AES_BLOCK_SIZE);
+		memset(iv[1], 0, AES_BLOCK_SIZE);
+		portable->cbc_decrypt(&dec, iv[0], input, expected, AES_SELFTEST_BLOCKS);
+		backend->cbc_decrypt(&dec, iv[1], input, output, AES_SELFTEST_BLOCKS);
+		if (memcmp(output, expected, sizeof(output)) != 0 || memcmp(iv[0], iv[1], AES_BLOCK_SIZE) != 0)
+			return -1;
+	}
+
+	if (backend->ctr != NULL) {
+		memcpy(iv[0], aes_kat_ctr_counter, AES_BLOCK_SIZE);
+		backend->ctr(&enc, iv[0], aes_kat_mode_plain, output, 4);
+		if (memcmp(output, aes_kat_ctr_cipher, sizeof(aes_kat_ctr_cipher)) != 0)
+			return -1;
+
+		memcpy(iv[0], aes_kat_ctr_counter, AES_BLOCK_SIZE);
+		memcpy(iv[1], aes_kat_ctr_counter, AES_BLOCK_SIZE);
+		portable->ctr(&enc, iv[0], input, expected, AES_SELFTEST_BLOCKS);
+		backend->ctr(&enc, iv[1], input, output, AES_SELFTEST_BLOCKS);
+		if (memcmp(output, expected, sizeof(output)) != 0 || memcmp(iv[0], iv[1], AES_BLOCK_SIZE) != 0)
+			return -1;
+	}
+
+	if (backend->xts != NULL) {
+		memset(expected, 0, 2 * AES_BLOCK_SIZE);
+		aes_selftest_key(backend, &enc, AES_ENCRYPT, expected, 128);
+
+		memcpy(iv[0], aes_kat_xts_tweak, AES_BLOCK_SIZE);
+		backend->xts(&enc, iv[0], expected, output, 2);
+		if (memcmp(output, aes_kat_xts_cipher, sizeof(aes_kat_xts_cipher)) != 0)
+			return -1;
+
+		memcpy(iv[0], aes_kat_xts_tweak, AES_BLOCK_SIZE);
+		memcpy(iv[1], aes_kat_xts_tweak, AES_BLOCK_SIZE);
+		portable->xts(&dec, iv[0], input, expected, AES_SELFTEST_BLOCKS);
+		backend->xts(&dec, iv[1], input, output, AES_SELFTEST_BLOCKS);
+		if (memcmp(output, expected, sizeof(output)) != 0 || memcmp(iv[0], iv[1], AES_BLOCK_SIZE) != 0)
+			return -1;
+
+		aes_selftest_key(backend, &enc, AES_ENCRYPT, aes_kat_mode_key, 128);
+	}
+
+	if (backend->cbc_encrypt_lanes != NULL) {
+		for (k = 0; k < 2; ++k) {
+			memcpy(iv[k], aes_kat_cbc_iv, AES_BLOCK_SIZE);
+			lanes[k].rk = enc.rk;
+			lanes[k].iv = iv[k];
+			lanes[k].input = aes_kat_mode_plain;
+			lanes[k].output = output + k * sizeof(aes_kat_cbc_cipher);
+		}
+
+		backend->cbc_encrypt_lanes(lanes, 2, enc.nr, 4);
+		if (memcmp(output, aes_kat_cbc_cipher, sizeof(aes_kat_cbc_cipher)) != 0 ||
+			memcmp(output + sizeof(aes_kat_cbc_cipher), aes_kat_cbc_cipher, sizeof(aes_kat_cbc_cipher)) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+//
+// RFC 4493 examples 1-4 (SP 800-38B D.1), CMAC-AES-128 of the first 0, 16,
+// 40 and 64 bytes of the SP 800-38A message. The empty message is padded and
+// masked with K2, the baseline code masked an unpadded zero block with K1.
+//
+static const uint32_t aes_kat_cmac_length[4] = { 0, 16, 40, 64 };
+
+static const uint8_t aes_kat_cmac_tag[4][AES_BLOCK_SIZE] = {
+	{ 0xBB, 0x1D, 0x69, 0x29, 0xE9, 0x59, 0x37, 0x28, 0x7F, 0xA3, 0x7D, 0x12, 0x9B, 0x75, 0x67, 0x46 },
+	{ 0x07, 0x0A, 0x16, 0xB4, 0x6B, 0x4D, 0x41, 0x44, 0xF7, 0x9B, 0xDD, 0x9D, 0xD0, 0x4A, 0x28, 0x7C },
+	{ 0xDF, 0xA6, 0x67, 0x47, 0xDE, 0x9A, 0xE6, 0x30, 0x30, 0xCA, 0x32, 0x61, 0x14, 0x97, 0xC8, 0x27 },
+	{ 0x51, 0xF0, 0xBE, 0xBF, 0x7E, 0x3B, 0x9D, 0x92, 0xFC, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3C, 0xFE },
+};
+
+//
+// Runs the one-shot and the streaming CMAC on the selected backends,
+// returns 0 if both give the expected tags
+//
+static int aes_cmac_selftest(void) {
+	struct aes_cmac_context_t ctx;
+	uint8_t output[AES_BLOCK_SIZE];
+	int k;
+
+	if (aes_cmac_init(&ctx, aes_kat_mode_key, 128) != 0)
+		return -1;
+
+	for (k = 0; k < 4; ++k) {
+		aes_cmac(aes_kat_mode_key, 128, aes_kat_mode_plain, output, aes_kat_cmac_length[k]);
+		if (memcmp(output, aes_kat_cmac_tag[k], AES_BLOCK_SIZE) != 0)
+			return -1;
+
+		// odd split, so the pending block is carried across updates
+		aes_cmac_update(&ctx, aes_kat_mode_plain, aes_kat_cmac_length[k] / 3);
+		aes_cmac_update(&ctx, aes_kat_mode_plain + aes_kat_cmac_length[k] / 3, aes_kat_cmac_length[k] - aes_kat_cmac_length[k] / 3);
+		aes_cmac_finish(&ctx, output);
+		if (memcmp(output, aes_kat_cmac_tag[k], AES_BLOCK_SIZE) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+//
+// FIPS 180-1 appendix B, the 56-byte message already padded to two blocks
+//
+static const uint8_t sha1_kat_message[2 * SHA1_BLOCK_SIZE] = {
+	'a', 'b', 'c', 'd', 'b', 'c', 'd', 'e', 'c', 'd', 'e', 'f', 'd', 'e', 'f', 'g',
+	'e', 'f', 'g', 'h', 'f', 'g', 'h', 'i', 'g', 'h', 'i', 'j', 'h', 'i', 'j', 'k',
+	'i', 'j', 'k', 'l', 'j', 'k', 'l', 'm', 'k', 'l', 'm', 'n', 'l', 'm', 'n', 'o',
+	'm', 'n', 'o', 'p', 'n', 'o', 'p', 'q', 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xC0,
+};
+
+static const uint32_t sha1_kat_digest[5] = {
+	0x84983E44, 0x1C3BD26E, 0xBAAE4AA1, 0xF95129E5, 0xE54670F1,
+};
+
+static const uint32_t sha1_iv[5];
+
+static int sha1_backend_selftest(const struct sha1_backend_t* const backend) {
+	uint32_t state[SHA1_MAX_LANES][5];
+	struct sha1_lane_cursor_t lanes[SHA1_MAX_LANES];
+	uint32_t l;
+
+	if (backend->blocks != NULL) {
+		memcpy(state[0], sha1_iv, sizeof(sha1_iv));
+		backend->blocks(state[0], sha1_kat_message, 2);
+		if (memcmp(state[0], sha1_kat_digest, sizeof(sha1_kat_digest)) != 0)
+			return -1;
+	}
+
+	if (backend->blocks_lanes != NULL) {
+		for (l = 0; l < backend->max_lanes; ++l) {
+			memcpy(state[l], sha1_iv, sizeof(sha1_iv));
+			lanes[l].state = state[l];
+			lanes[l].data = sha1_kat_message;
+		}
+
+		backend->blocks_lanes(lanes, backend->max_lanes, 2);
+
+		for (l = 0; l < backend->max_lanes; ++l) {
+			if (memcmp(state[l], sha1_kat_digest, sizeof(sha1_kat_digest)) != 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Backend selection
+//-----------------------------------------------------------------------------
+
+//
+// SV_AES_BACKEND and SV_SHA1_BACKEND name the backend to use instead of the
+// fastest one; the operations it leaves out then come from the backends after
+// it in the priority list, as they would without the override
+//
+#define AES_BACKEND_ENV "SV_AES_BACKEND"
+#define SHA1_BACKEND_ENV "SV_SHA1_BACKEND"
+
+#if defined(AES_COMPACT)
+#define AES_COMPACT_AUTO 1
+#else
+#define AES_COMPACT_AUTO 0
+#endif
+
+//
+// A backend takes part if the CPU supports it and it passes its self-test.
+// The portable backends always take part, last, to fill in what is missing.
+//
+static int aes_backend_usable(const struct aes_backend_t* const backend, const char* const forced) {
+	if (backend == &aes_backend_portable)
+		return 1;
+	if (backend == &aes_backend_compact && !AES_COMPACT_AUTO && (forced == NULL || strcmp(backend->name, forced) != 0))
+		return 0;
+	if (backend->supported != NULL && !backend->supported())
+		return 0;
+
+	if (aes_backend_selftest(backend) != 0) {
+		fprintf(stderr, "crypto_init: AES backend %s failed its self-test, disabled\n", backend->name);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int sha1_backend_usable(const struct sha1_backend_t* const backend) {
+	if (backend == &sha1_backend_portable)
+		return 1;
+	if (backend->supported != NULL && !backend->supported())
+		return 0;
+
+	if (sha1_backend_selftest(backend) != 0) {
+		fprintf(stderr, "crypto_init: SHA-1 backend %s failed its self-test, disabled\n", backend->name);
+		return 0;
+	}
+
+	return 1;
 }
 
-int aes_decrypt_xts(const uint8_t* const tweak_key, const int tweak_key_size, const uint8_t* const data_key, const int data_key_size, const uint8_t* const input, uint8_t* const output, const uint32_t sector_index, const uint32_t sector_size) {
-	int result;
+//
+// Backends may leave operations out (the VAES and bitsliced ones only do
+// the bulk modes), the missing ones are taken from the next supported backend in
+// the priority list
+//
+#define AES_BACKEND_FILL(member) \
+	if (aes_active.member == NULL) \
+		aes_active.member = backend->member
+
+void crypto_init(void) {
+	static const struct aes_backend_t* const aes_backends[] = {
+		&aes_backend_vaes512,
+		&aes_backend_vaes256,
+		&aes_backend_aesni,
+		&aes_backend_bitslice_avx2,
+		&aes_backend_compact,
+		&aes_backend_portable,
+		// constant time but slower than the T-tables, only used when forced
+		&aes_backend_vperm,
+		&aes_backend_bitslice,
+	};
+#define AES_BACKEND_COUNT ((int)(sizeof(aes_backends) / sizeof(aes_backends[0])))
+	static struct aes_backend_t aes_active;
+	static const struct sha1_backend_t* const sha1_backends[] = {
+		&sha1_backend_shani,
+		&sha1_backend_avx2,
+		&sha1_backend_ssse3,
+		&sha1_backend_portable,
+	};
+#define SHA1_BACKEND_COUNT ((int)(sizeof(sha1_backends) / sizeof(sha1_backends[0])))
+	static struct sha1_backend_t sha1_active;
+
+	const struct aes_backend_t* backend;
+	const char* forced;
+	long cpus;
+	int i, first;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		aes_threads = 1;
+	else if (cpus > AES_MAX_THREADS)
+		aes_threads = AES_MAX_THREADS;
+	else
+		aes_threads = (uint32_t)cpus;
+
+	// the portable code is the reference for the others
+	if (aes_backend_selftest(&aes_backend_portable) != 0 || sha1_backend_selftest(&sha1_backend_portable) != 0) {
+		fprintf(stderr, "crypto_init: portable self-test failed\n");
+		abort();
+	}
 
-	struct aes_xts_context_t ctx;
+	forced = getenv(AES_BACKEND_ENV);
+	if (forced != NULL && *forced == '\0')
+		forced = NULL;
 
-	result = aes_xts_init(&ctx, AES_DECRYPT, tweak_key, tweak_key_size, data_key, data_key_size);
-	if (result != 0)
-		return result;
+	memset(&aes_active, 0, sizeof(aes_active));
 
-	result = aes_crypt_xts(&ctx, input, output, sector_index, sector_size);
-	if (result != 0)
-		return result;
+	// everything in front of the forced backend is left out
+	first = 0;
+	if (forced != NULL) {
+		while (first < AES_BACKEND_COUNT && strcmp(aes_backends[first]->name, forced) != 0)
+			++first;
 
-	return 0;
-}
+		if (first == AES_BACKEND_COUNT || !aes_backend_usable(aes_backends[first], forced)) {
+			fprintf(stderr, "crypto_init: %s=%s is not available, ignored\n", AES_BACKEND_ENV, forced);
+			first = 0;
+			forced = NULL;
+		}
+	}
 
-static void gf_mulx(uint8_t* const pad) {
-	uint32_t carry;
-	int i;
+	// the list is walked up to the portable code, the backends behind it
+	// only take part when forced; portable fills in whatever is still missing
+	for (i = first; i <= AES_BACKEND_COUNT; ++i) {
+		backend = i < AES_BACKEND_COUNT ? aes_backends[i] : &aes_backend_portable;
 
-	carry = pad[0] & 0x80;
-	for (i = 0; i < AES_BLOCK_SIZE - 1; ++i)
-		pad[i] = (pad[i] << 1) | (pad[i + 1] >> 7);
-	pad[AES_BLOCK_SIZE - 1] <<= 1;
-	if (carry)
-		pad[AES_BLOCK_SIZE - 1] ^= 0x87;
-}
+		if (!aes_backend_usable(backend, forced))
+			continue;
 
-int aes_cmac(const uint8_t* const key, const int key_size, const uint8_t* const input, uint8_t* const output, const uint32_t length) {
-	int result;
+		if (aes_active.name == NULL)
+			aes_active.name = backend->name;
 
-	struct aes_context_t ctx;
+		AES_BACKEND_FILL(expand_key);
+		AES_BACKEND_FILL(invert_key);
+		AES_BACKEND_FILL(ecb);
+		AES_BACKEND_FILL(cbc_encrypt);
+		AES_BACKEND_FILL(cbc_decrypt);
+		AES_BACKEND_FILL(ctr);
+		AES_BACKEND_FILL(xts);
 
-	uint8_t cbc[AES_BLOCK_SIZE];
+		if (aes_active.cbc_encrypt_lanes == NULL) {
+			aes_active.max_lanes = backend->max_lanes;
+			aes_active.cbc_encrypt_lanes = backend->cbc_encrypt_lanes;
+		}
 
-	int i;
+		if (backend == &aes_backend_portable)
+			break;
+	}
 
-	result = aes_init(&ctx, AES_ENCRYPT, key, key_size);
-	if (result != 0)
-		return result;
+	aes_backend = &aes_active;
 
-	memset(cbc, 0, AES_BLOCK_SIZE);
+	if (aes_cmac_selftest() != 0) {
+		fprintf(stderr, "crypto_init: AES-CMAC self-test failed\n");
+		abort();
+	}
 
-	const uint8_t* src = input;
-	uint8_t* dst = output;
-	uint32_t size = length;
+	forced = getenv(SHA1_BACKEND_ENV);
+	if (forced != NULL && *forced == '\0')
+		forced = NULL;
 
-	while (size >= AES_BLOCK_SIZE) {
-		for (i = 0; i < AES_BLOCK_SIZE; ++i)
-			cbc[i] ^= *src++;
+	memset(&sha1_active, 0, sizeof(sha1_active));
 
-		if (size > AES_BLOCK_SIZE)
-			aes_crypt_ecb(&ctx, cbc, cbc);
+	first = 0;
+	if (forced != NULL) {
+		while (first < SHA1_BACKEND_COUNT && strcmp(sha1_backends[first]->name, forced) != 0)
+			++first;
 
-		size -= AES_BLOCK_SIZE;
+		if (first == SHA1_BACKEND_COUNT || !sha1_backend_usable(sha1_backends[first])) {
+			fprintf(stderr, "crypto_init: %s=%s is not available, ignored\n", SHA1_BACKEND_ENV, forced);
+			first = 0;
+		}
 	}
 
-	uint8_t pad[AES_BLOCK_SIZE];
-	memset(pad, 0, AES_BLOCK_SIZE);
-	aes_crypt_ecb(&ctx, pad, pad);
-	gf_mulx(pad);
+	for (i = first; i < SHA1_BACKEND_COUNT; ++i) {
+		if (!sha1_backend_usable(sha1_backends[i]))
+			continue;
 
-	if (size != 0) {
-		for (i = 0; i < size; ++i)
-			cbc[i] ^= *src++;
-		cbc[size] ^= 0x80;
-		gf_mulx(pad);
+		if (sha1_active.name == NULL)
+			sha1_active.name = sha1_backends[i]->name;
+		if (sha1_active.blocks == NULL)
+			sha1_active.blocks = sha1_backends[i]->blocks;
+
+		if (sha1_active.blocks_lanes == NULL) {
+			sha1_active.max_lanes = sha1_backends[i]->max_lanes;
+			sha1_active.blocks_lanes = sha1_backends[i]->blocks_lanes;
+		}
 	}
 
-	for (i = 0; i < AES_BLOCK_SIZE; ++i)
-		pad[i] ^= cbc[i];
+	sha1_backend = &sha1_active;
+}
 
-	aes_crypt_ecb(&ctx, pad, dst);
+#undef AES_BACKEND_FILL
+#undef AES_BACKEND_COUNT
+#undef SHA1_BACKEND_COUNT
 
-	return 0;
+const char* aes_backend_name(void) {
+	return aes_backend->name;
+}
+
+const char* sha1_backend_name(void) {
+	return sha1_backend->name;
 }
 
 //-----------------------------------------------------------------------------
@@ -932,7 +2165,7 @@ void sha1_starts(struct sha1_context_t* const ctx) {
 	ctx->total[1] = 0;
 }
 
-void sha1_transform(struct sha1_context_t* const ctx, const uint8_t data[SHA1_BLOCK_SIZE]) {
+static void sha1_portable_block(uint32_t state[5], const uint8_t data[SHA1_BLOCK_SIZE]) {
 	uint32_t w[16];
 
 	uint32_t a, b, c, d, e;
@@ -969,11 +2202,11 @@ void sha1_transform(struct sha1_context_t* const ctx, const uint8_t data[SHA1_BL
 			b = S(b, 30); \
 		}
 
-	a = ctx->state[0];
-	b = ctx->state[1];
-	c = ctx->state[2];
-	d = ctx->state[3];
-	e = ctx->state[4];
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
 
 	#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
 	#define K 0x5A827999
@@ -1083,11 +2316,39 @@ void sha1_transform(struct sha1_context_t* const ctx, const uint8_t data[SHA1_BL
 #undef K
 #undef F
 
-	ctx->state[0] += a;
-	ctx->state[1] += b;
-	ctx->state[2] += c;
-	ctx->state[3] += d;
-	ctx->state[4] += e;
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static void sha1_portable_blocks(uint32_t state[5], const uint8_t* data, uint32_t nblocks) {
+	while (nblocks-- > 0) {
+		sha1_portable_block(state, data);
+		data += SHA1_BLOCK_SIZE;
+	}
+}
+
+static void sha1_portable_blocks_lanes(struct sha1_lane_cursor_t* const lanes, const uint32_t count, uint32_t nblocks) {
+	uint32_t l;
+
+	for (l = 0; l < count; ++l) {
+		sha1_portable_blocks(lanes[l].state, lanes[l].data, nblocks);
+		lanes[l].data += nblocks * SHA1_BLOCK_SIZE;
+	}
+}
+
+const struct sha1_backend_t sha1_backend_portable = {
+	.name = "portable",
+	.supported = NULL,
+	.blocks = sha1_portable_blocks,
+	.max_lanes = 1,
+	.blocks_lanes = sha1_portable_blocks_lanes,
+};
+
+void sha1_transform(struct sha1_context_t* const ctx, const uint8_t data[SHA1_BLOCK_SIZE]) {
+	sha1_backend->blocks(ctx->state, data, 1);
 }
 
 void sha1_update(struct sha1_context_t* const ctx, const uint8_t* const input, const uint32_t length) {
@@ -1111,10 +2372,12 @@ void sha1_update(struct sha1_context_t* const ctx, const uint8_t* const input, c
 		left = 0;
 	}
 
-	while (size >= SHA1_BLOCK_SIZE) {
-		sha1_transform(ctx, src);
-		src += SHA1_BLOCK_SIZE;
-		size -= SHA1_BLOCK_SIZE;
+	if (size >= SHA1_BLOCK_SIZE) {
+		const uint32_t nblocks = size / SHA1_BLOCK_SIZE;
+
+		sha1_backend->blocks(ctx->state, src, nblocks);
+		src += nblocks * SHA1_BLOCK_SIZE;
+		size -= nblocks * SHA1_BLOCK_SIZE;
 	}
 
 	if (size != 0)
@@ -1150,8 +2413,145 @@ void sha1(const uint8_t* const input, uint8_t output[SHA1_HASH_SIZE], const uint
 	sha1_finish(&ctx, output);
 }
 
-void sha1_hmac_starts(struct sha1_context_t* const ctx, const uint8_t* const key, const uint32_t key_size) {
+//
+// Multi-buffer job, the whole blocks are hashed straight from the message,
+// the padded last one or two blocks from tail
+//
+struct sha1_multi_job_t {
+	struct sha1_lane_t* lane;
+	uint32_t state[5];
+	uint32_t remaining; // blocks left in the current buffer
+	uint32_t tail_blocks; // padded blocks still to be started
+	uint8_t tail[2 * SHA1_BLOCK_SIZE];
+};
+
+static const uint32_t sha1_iv[5] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0,
+};
+
+//
+// The job continues from state after prefix bytes (a multiple of the block
+// size) have been hashed
+//
+static void sha1_multi_start(struct sha1_multi_job_t* const job, struct sha1_lane_cursor_t* const cursor, struct sha1_lane_t* const lane, const uint32_t state[5], const uint32_t prefix) {
+	const uint32_t left = lane->length % SHA1_BLOCK_SIZE;
+	const uint64_t bits = ((uint64_t)prefix + lane->length) << 3;
+
+	job->lane = lane;
+	memcpy(job->state, state, sizeof(job->state));
+	job->remaining = lane->length / SHA1_BLOCK_SIZE;
+	job->tail_blocks = (left < 56) ? 1 : 2;
+
+	memset(job->tail, 0, sizeof(job->tail));
+	memcpy(job->tail, lane->input + lane->length - left, left);
+	job->tail[left] = 0x80;
+	PUT_UINT32_BE((uint32_t)(bits >> 32), job->tail, job->tail_blocks * SHA1_BLOCK_SIZE - 8);
+	PUT_UINT32_BE((uint32_t)bits, job->tail, job->tail_blocks * SHA1_BLOCK_SIZE - 4);
+
+	cursor->state = job->state;
+	cursor->data = lane->input;
+}
+
+//
+// Switches to the padded blocks once the message blocks are done, returns 0
+// when the job is finished
+//
+static int sha1_multi_next(struct sha1_multi_job_t* const job, struct sha1_lane_cursor_t* const cursor) {
+	if (job->remaining != 0)
+		return 1;
+
+	if (job->tail_blocks == 0)
+		return 0;
+
+	cursor->data = job->tail;
+	job->remaining = job->tail_blocks;
+	job->tail_blocks = 0;
+
+	return 1;
+}
+
+//
+// Lane scheduler shared by sha1_multi and sha1_hmac_multi, the output of a
+// lane is only written once its input has been consumed
+//
+static void sha1_multi_run(struct sha1_lane_t* const lanes, const uint32_t count, const uint32_t state[5], const uint32_t prefix) {
+	struct sha1_multi_job_t jobs[SHA1_MAX_LANES];
+	struct sha1_multi_job_t* job[SHA1_MAX_LANES]; // jobs of the active lanes first
+	struct sha1_lane_cursor_t active[SHA1_MAX_LANES];
+	struct sha1_multi_job_t* done;
+
+	const uint32_t max_lanes = sha1_backend->max_lanes;
+	uint32_t i, next, nactive, nblocks;
+
+	for (i = 0; i < SHA1_MAX_LANES; ++i)
+		job[i] = &jobs[i];
+
+	next = 0;
+	nactive = 0;
+
+	for (;;) {
+		// refill free lanes
+		while (nactive < max_lanes && next < count) {
+			sha1_multi_start(job[nactive], &active[nactive], &lanes[next++], state, prefix);
+			sha1_multi_next(job[nactive], &active[nactive]);
+			nactive++;
+		}
+
+		if (nactive == 0)
+			break;
+
+		// run until the shortest lane reaches the end of its buffer
+		nblocks = job[0]->remaining;
+		for (i = 1; i < nactive; ++i) {
+			if (job[i]->remaining < nblocks)
+				nblocks = job[i]->remaining;
+		}
+
+		if (nactive == 1) {
+			sha1_backend->blocks(active[0].state, active[0].data, nblocks);
+			active[0].data += nblocks * SHA1_BLOCK_SIZE;
+		} else {
+			sha1_backend->blocks_lanes(active, nactive, nblocks);
+		}
+
+		for (i = 0; i < nactive; ++i)
+			job[i]->remaining -= nblocks;
+
+		// retire finished lanes, their job moves behind the active ones
+		for (i = 0; i < nactive; ) {
+			if (sha1_multi_next(job[i], &active[i])) {
+				++i;
+				continue;
+			}
+
+			done = job[i];
+			PUT_UINT32_BE(done->state[0], done->lane->output, 0);
+			PUT_UINT32_BE(done->state[1], done->lane->output, 4);
+			PUT_UINT32_BE(done->state[2], done->lane->output, 8);
+			PUT_UINT32_BE(done->state[3], done->lane->output, 12);
+			PUT_UINT32_BE(done->state[4], done->lane->output, 16);
+
+			nactive--;
+			job[i] = job[nactive];
+			job[nactive] = done;
+			active[i] = active[nactive];
+		}
+	}
+}
+
+void sha1_multi(struct sha1_lane_t* const lanes, const uint32_t count) {
+	sha1_multi_run(lanes, count, sha1_iv, 0);
+}
+
+//
+// Outer hashes of sha1_hmac_multi run in groups of this many messages
+//
+#define SHA1_HMAC_GROUP 64
+
+void sha1_hmac_key_init(struct sha1_hmac_key_t* const hmac_key, const uint8_t* const key, const uint32_t key_size) {
 	uint8_t sum[SHA1_HASH_SIZE];
+	uint8_t ipad[SHA1_BLOCK_SIZE];
+	uint8_t opad[SHA1_BLOCK_SIZE];
 
 	const uint8_t* new_key = key;
 	uint32_t new_key_size = key_size;
@@ -1164,16 +2564,31 @@ void sha1_hmac_starts(struct sha1_context_t* const ctx, const uint8_t* const key
 		new_key_size = SHA1_HASH_SIZE;
 	}
 
-	memset(ctx->ipad, 0x36, SHA1_BLOCK_SIZE);
-	memset(ctx->opad, 0x5C, SHA1_BLOCK_SIZE);
+	memset(ipad, 0x36, SHA1_BLOCK_SIZE);
+	memset(opad, 0x5C, SHA1_BLOCK_SIZE);
 
 	for (i = 0; i < new_key_size; ++i) {
-		ctx->ipad[i] = ctx->ipad[i] ^ new_key[i];
-		ctx->opad[i] = ctx->opad[i] ^ new_key[i];
+		ipad[i] = ipad[i] ^ new_key[i];
+		opad[i] = opad[i] ^ new_key[i];
 	}
 
-	sha1_starts(ctx);
-	sha1_update(ctx, ctx->ipad, SHA1_BLOCK_SIZE);
+	memcpy(hmac_key->inner, sha1_iv, sizeof(hmac_key->inner));
+	sha1_backend->blocks(hmac_key->inner, ipad, 1);
+
+	memcpy(hmac_key->outer, sha1_iv, sizeof(hmac_key->outer));
+	sha1_backend->blocks(hmac_key->outer, opad, 1);
+}
+
+void sha1_hmac_key_starts(struct sha1_context_t* const ctx, const struct sha1_hmac_key_t* const hmac_key) {
+	ctx->hmac = *hmac_key;
+
+	sha1_hmac_reset(ctx);
+}
+
+void sha1_hmac_starts(struct sha1_context_t* const ctx, const uint8_t* const key, const uint32_t key_size) {
+	sha1_hmac_key_init(&ctx->hmac, key, key_size);
+
+	sha1_hmac_reset(ctx);
 }
 
 void sha1_hmac_update(struct sha1_context_t* const ctx, const uint8_t* const input, const uint32_t length) {
@@ -1184,15 +2599,21 @@ void sha1_hmac_finish(struct sha1_context_t* const ctx, uint8_t output[SHA1_HASH
 	uint8_t temp[SHA1_HASH_SIZE];
 
 	sha1_finish(ctx, temp);
-	sha1_starts(ctx);
-	sha1_update(ctx, ctx->opad, SHA1_BLOCK_SIZE);
+
+	// continue after the key ^ opad block
+	memcpy(ctx->state, ctx->hmac.outer, sizeof(ctx->state));
+	ctx->total[0] = SHA1_BLOCK_SIZE;
+	ctx->total[1] = 0;
+
 	sha1_update(ctx, temp, SHA1_HASH_SIZE);
 	sha1_finish(ctx, output);
 }
 
 void sha1_hmac_reset(struct sha1_context_t* const ctx) {
-	sha1_starts(ctx);
-	sha1_update(ctx, ctx->ipad, SHA1_BLOCK_SIZE);
+	// continue after the key ^ ipad block
+	memcpy(ctx->state, ctx->hmac.inner, sizeof(ctx->state));
+	ctx->total[0] = SHA1_BLOCK_SIZE;
+	ctx->total[1] = 0;
 }
 
 void sha1_hmac(const uint8_t* const key, const uint32_t key_size, const uint8_t* const input, uint8_t output[SHA1_HASH_SIZE], const uint32_t length) {
@@ -1203,32 +2624,156 @@ void sha1_hmac(const uint8_t* const key, const uint32_t key_size, const uint8_t*
 	sha1_hmac_finish(&ctx, output);
 }
 
+void sha1_hmac_multi(const struct sha1_hmac_key_t* const hmac_key, struct sha1_lane_t* const lanes, const uint32_t count) {
+	struct sha1_lane_t outer[SHA1_HMAC_GROUP];
+	uint32_t first, group, i;
+
+	sha1_multi_run(lanes, count, hmac_key->inner, SHA1_BLOCK_SIZE);
+
+	// the inner digests are the messages of the outer hashes
+	for (first = 0; first < count; first += group) {
+		group = count - first;
+		if (group > SHA1_HMAC_GROUP)
+			group = SHA1_HMAC_GROUP;
+
+		for (i = 0; i < group; ++i) {
+			outer[i].input = lanes[first + i].output;
+			outer[i].length = SHA1_HASH_SIZE;
+		}
+
+		sha1_multi_run(outer, group, hmac_key->outer, SHA1_BLOCK_SIZE);
+
+		for (i = 0; i < group; ++i)
+			memcpy(lanes[first + i].output, outer[i].output, SHA1_HASH_SIZE);
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Random numbers generation
 //-----------------------------------------------------------------------------
 
-static uint32_t xor_shift(void) {
-	static uint32_t x = 123456789;
-	static uint32_t y = 362436069;
-	static uint32_t z = 521288629;
-	static uint32_t w = 88675123;
+//
+// Keystream bytes produced per refill of the pool, the first RNG_KEY_SIZE of
+// them become the next key
+//
+#define RNG_POOL_SIZE 1024
+#define RNG_KEY_SIZE 32
 
-	uint32_t t;
-	t = x ^ (x << 11);
-	x = y; y = z; z = w;
-	w = w ^ (w >> 19) ^ t ^ (t >> 8);
+//
+// Fresh system entropy is mixed into the key every RNG_RESEED_REFILLS refills
+//
+#define RNG_RESEED_REFILLS 1024
+
+struct rng_state_t {
+	struct aes_context_t ctx;
+	uint8_t counter[AES_BLOCK_SIZE];
+	uint8_t pool[RNG_POOL_SIZE]; // bytes before offset are zero
+	uint32_t offset;
+	uint32_t refills;
+	int seeded;
+};
+
+static __thread struct rng_state_t rng_state = { .offset = RNG_POOL_SIZE };
+
+static int rng_entropy(uint8_t* const data, const uint32_t length) {
+	uint32_t done = 0;
+	ssize_t n;
+	int fd;
 
-	return w;
+	while (done < length) {
+		n = getrandom(data + done, length - done, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		done += (uint32_t)n;
+	}
+
+	if (done == length)
+		return 0;
+
+	// kernels before 3.17 have no getrandom
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return ERROR_NO_ENTROPY;
+
+	while (done < length) {
+		n = read(fd, data + done, length - done);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		done += (uint32_t)n;
+	}
+
+	close(fd);
+
+	return (done == length) ? 0 : ERROR_NO_ENTROPY;
 }
 
-int generate_random_bytes(uint8_t* const data, const uint32_t length) {
-	uint8_t* ptr = data;
-	uint32_t rnd;
+//
+// Encrypt the zeroed pool with the current key and rekey from the start of
+// the keystream, so the bytes already handed out cannot be recomputed later
+//
+static int rng_refill(struct rng_state_t* const rng) {
+	uint8_t seed[RNG_KEY_SIZE];
 	uint32_t i;
+	int result;
+
+	if (!rng->seeded) {
+		result = rng_entropy(seed, RNG_KEY_SIZE);
+		if (result != 0)
+			return result;
+
+		aes_init(&rng->ctx, AES_ENCRYPT, seed, RNG_KEY_SIZE * 8);
+		rng->seeded = 1;
+	}
+
+	aes_backend->ctr(&rng->ctx, rng->counter, rng->pool, rng->pool, RNG_POOL_SIZE / AES_BLOCK_SIZE);
+
+	// a failed reseed is not fatal, the generator stays as good as it was
+	if (++rng->refills == RNG_RESEED_REFILLS) {
+		if (rng_entropy(seed, RNG_KEY_SIZE) == 0) {
+			for (i = 0; i < RNG_KEY_SIZE; ++i)
+				rng->pool[i] ^= seed[i];
+		}
+		rng->refills = 0;
+	}
+
+	aes_init(&rng->ctx, AES_ENCRYPT, rng->pool, RNG_KEY_SIZE * 8);
+
+	memset(rng->pool, 0, RNG_KEY_SIZE);
+	memset(seed, 0, RNG_KEY_SIZE);
+
+	rng->offset = RNG_KEY_SIZE;
+
+	return 0;
+}
+
+int generate_random_bytes(uint8_t* const data, const uint32_t length) {
+	struct rng_state_t* const rng = &rng_state;
+	uint32_t done = 0;
+	uint32_t n;
+	int result;
+
+	while (done < length) {
+		if (rng->offset == RNG_POOL_SIZE) {
+			result = rng_refill(rng);
+			if (result != 0)
+				return result;
+		}
+
+		n = RNG_POOL_SIZE - rng->offset;
+		if (n > length - done)
+			n = length - done;
 
-	for (i = 0; i < length; ++i) {
-		rnd = xor_shift() & 0xFF;
-		*ptr++ = rnd;
+		memcpy(data + done, rng->pool + rng->offset, n);
+		memset(rng->pool + rng->offset, 0, n);
+
+		rng->offset += n;
+		done += n;
 	}
 
 	return 0;
@@ -1931,25 +3476,246 @@ int des3_crypt_cbc( des3_context *ctx,
     return( 0 );
 }
 
+//-----------------------------------------------------------------------------
+// Bitsliced 3DES
+//-----------------------------------------------------------------------------
+
+// only the AVX2 width beats the tables, narrower vectors are slower than
+// des3_crypt_ecb block by block
+#if defined(CPU_X86)
+
+typedef uint64_t des_bs_vec256_t __attribute__((vector_size(32)));
+
+//
+// S-boxes in the order DES_ROUND looks them up, the first four take their
+// input from X, the others from X rotated right by 4
+//
+static const uint32_t* const des_bs_sb[8] = {
+	SB8, SB6, SB4, SB2, SB7, SB5, SB3, SB1,
+};
+
+static const int des_bs_shift[8] = {
+	0, 8, 16, 24, 0, 8, 16, 24,
+};
+
+//
+// Circuit description derived from the tables by des_bs_init():
+// des_bs_outbit  the four bits of Y an S-box (with P applied) can change
+// des_bs_rowfn   for every output bit and column, the set of rows (bit r
+//                for row r) in which the output bit is 1
+// des_bs_ip/fp   source bit of every bit after the initial/final
+//                permutation, X in the upper and Y in the lower 32 bits
+//
+static uint8_t des_bs_outbit[8][4];
+static uint8_t des_bs_rowfn[8][4][16];
+static uint8_t des_bs_ip[64];
+static uint8_t des_bs_fp[64];
+static int des_bs_ready = 0;
+
+static int des_bs_bit_index(const uint32_t X, const uint32_t Y) {
+	const uint64_t v = ((uint64_t)X << 32) | Y;
+
+	return __builtin_ctzll(v);
+}
+
+static void des_bs_init(void) {
+	uint32_t X, Y, T, bits;
+	int s, o, b, r, c, idx;
+
+	if (des_bs_ready)
+		return;
+
+	for (s = 0; s < 8; ++s) {
+		bits = 0;
+		for (idx = 0; idx < 64; ++idx)
+			bits |= des_bs_sb[s][idx];
+
+		for (o = 0; o < 4; ++o) {
+			des_bs_outbit[s][o] = (uint8_t)__builtin_ctz(bits);
+			bits &= bits - 1;
+
+			for (c = 0; c < 16; ++c) {
+				des_bs_rowfn[s][o][c] = 0;
+				for (r = 0; r < 4; ++r) {
+					idx = ((r >> 1) << 5) | (c << 1) | (r & 1);
+					if (des_bs_sb[s][idx] & (1U << des_bs_outbit[s][o]))
+						des_bs_rowfn[s][o][c] |= (uint8_t)(1 << r);
+				}
+			}
+		}
+	}
+
+	// both permutations are linear, so pushing single bits through the
+	// macros gives the bit mapping
+	for (b = 0; b < 64; ++b) {
+		X = (b >= 32) ? (1U << (b - 32)) : 0;
+		Y = (b < 32) ? (1U << b) : 0;
+		DES_IP(X, Y);
+		des_bs_ip[des_bs_bit_index(X, Y)] = (uint8_t)b;
+
+		X = (b >= 32) ? (1U << (b - 32)) : 0;
+		Y = (b < 32) ? (1U << b) : 0;
+		DES_FP(Y, X);
+		des_bs_fp[b] = (uint8_t)des_bs_bit_index(Y, X);
+	}
+
+	des_bs_ready = 1;
+}
+
+//
+// 64x64 bit matrix transpose: bit i of m[j] moves to bit j of m[i]
+//
+static void des_bs_transpose(uint64_t m[64]) {
+	uint64_t mask = 0x00000000FFFFFFFFULL;
+	uint64_t t;
+	int j, k;
+
+	for (j = 32; j != 0; j >>= 1, mask ^= mask << j) {
+		for (k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+			t = ((m[k] >> j) ^ m[k | j]) & mask;
+			m[k] ^= t << j;
+			m[k | j] ^= t;
+		}
+	}
+}
+
+#define DS_VEC des_bs_vec256_t
+#define DS_LANES 4
+#define DS_FN(name) name##_256
+#define DS_TARGET __attribute__((target("avx2")))
+
+#include "des_bitslice_core.h"
+
+#undef DS_TARGET
+#undef DS_FN
+#undef DS_LANES
+#undef DS_VEC
+
+// bytes per batch of des3_bs_ecb_256
+#define DES_BS_BATCH (256 * 8)
+
+#endif
+
+int des3_crypt_ecb_multi( des3_context *ctx,
+                          size_t length,
+                          const unsigned char *input,
+                          unsigned char *output )
+{
+	if (length % 8)
+		return POLARSSL_ERR_DES_INVALID_INPUT_LENGTH;
+
+#if defined(CPU_X86)
+	if (cpu_has(CPU_FEATURE_AVX2)) {
+		unsigned char batch[DES_BS_BATCH];
+
+		des_bs_init();
+
+		while (length >= DES_BS_BATCH) {
+			des3_bs_ecb_256(ctx->sk, input, output);
+			input += DES_BS_BATCH;
+			output += DES_BS_BATCH;
+			length -= DES_BS_BATCH;
+		}
+
+		// a padded batch costs about as much as half of it block by block
+		if (2 * length >= DES_BS_BATCH) {
+			memset(batch, 0, DES_BS_BATCH);
+			memcpy(batch, input, length);
+			des3_bs_ecb_256(ctx->sk, batch, batch);
+			memcpy(output, batch, length);
+			return 0;
+		}
+	}
+#endif
+
+	while (length > 0) {
+		des3_crypt_ecb(ctx, input, output);
+		input += 8;
+		output += 8;
+		length -= 8;
+	}
+
+	return 0;
+}
+
+/*
+ * 3DES-CBC encryption with a prepared key, the IP/FP permutations and the
+ * three DES passes run back to back and the chaining value stays in the two
+ * 32-bit halves from one block to the next
+ */
+int des3_key_encrypt_cbc( const des3_context *ctx,
+                          const unsigned char iv[8],
+                          const unsigned char *input,
+                          unsigned char *output,
+                          size_t length )
+{
+    int i;
+    uint32_t X, Y, T, CX, CY;
+    const uint32_t *SK;
+
+    if( length % 8 )
+        return( POLARSSL_ERR_DES_INVALID_INPUT_LENGTH );
+
+    GET_UINT32_BE( CX, iv, 0 );
+    GET_UINT32_BE( CY, iv, 4 );
+
+    while( length > 0 )
+    {
+        GET_UINT32_BE( X, input, 0 );
+        GET_UINT32_BE( Y, input, 4 );
+
+        X ^= CX;
+        Y ^= CY;
+
+        SK = ctx->sk;
+
+        DES_IP( X, Y );
+
+        for( i = 0; i < 8; i++ )
+        {
+            DES_ROUND( Y, X );
+            DES_ROUND( X, Y );
+        }
+
+        for( i = 0; i < 8; i++ )
+        {
+            DES_ROUND( X, Y );
+            DES_ROUND( Y, X );
+        }
+
+        for( i = 0; i < 8; i++ )
+        {
+            DES_ROUND( Y, X );
+            DES_ROUND( X, Y );
+        }
+
+        DES_FP( Y, X );
+
+        CX = Y;
+        CY = X;
+
+        PUT_UINT32_BE( CX, output, 0 );
+        PUT_UINT32_BE( CY, output, 4 );
+
+        input  += 8;
+        output += 8;
+        length -= 8;
+    }
+
+    return( 0 );
+}
+
 int des3_encrypt_cbc(const unsigned char key[DES_KEY_SIZE * 2], unsigned char iv[8], const unsigned char *input, unsigned char *output, size_t length)
 {
 	int result;
 
 	des3_context ctx;
 
-	uint8_t temp[8];
-
 	result = des3_set2key_enc( &ctx, key );
 	if (result != 0)
 		return result;
 
-	memcpy(temp, iv, 8);
-
-	result =  des3_crypt_cbc( &ctx, DES_ENCRYPT, length, temp, input, output );
-	if (result != 0)
-		return result;
-
-	return 0;
+	return des3_key_encrypt_cbc( &ctx, iv, input, output, length );
 }
 
 int des3_decrypt_cbc(const unsigned char key[DES_KEY_SIZE * 2], unsigned char iv[8], const unsigned char *input, unsigned char *output, size_t length)
@@ -69,6 +69,9 @@ enum {
 
 	// Invalid data size
 	ERROR_INVALID_DATA_SIZE = -3,
+
+	// The system entropy source cannot be read
+	ERROR_NO_ENTROPY = -4,
 };
 
 // 
@@ -79,7 +82,7 @@ enum {
 // 
 struct aes_context_t {
 	uint32_t buf[68]; // unaligned data
-	uint32_t* rk; // round keys
+	const uint32_t* rk; // round keys
 	int nr; // number of rounds
 	int mode; // AES_ENCRYPT or AES_DECRYPT
 };
@@ -93,6 +96,16 @@ struct aes_xts_context_t {
 	int mode;
 };
 
+// 
+// \brief AES prepared key, both key schedules expanded once
+// 
+// \note  rk points into buf, so contexts and keys must not be copied by value
+// 
+struct aes_key_t {
+	struct aes_context_t enc;
+	struct aes_context_t dec;
+};
+
 // 
 // \brief          AES key schedule
 // 
@@ -105,6 +118,17 @@ struct aes_xts_context_t {
 // 
 int aes_init(struct aes_context_t* const ctx, const int mode, const uint8_t* const key, const unsigned int key_size);
 
+// 
+// \brief          AES prepared key setup, expands the key for both directions
+// 
+// \param key      AES key to be initialized
+// \param raw_key  key bytes
+// \param key_size must be 128, 192 or 256
+// 
+// \return         0 if successful, or ERROR_INVALID_KEY_SIZE
+// 
+int aes_key_init(struct aes_key_t* const key, const uint8_t* const raw_key, const unsigned int key_size);
+
 // 
 // \brief        AES-ECB block encryption/decryption
 // 
@@ -114,9 +138,11 @@ int aes_init(struct aes_context_t* const ctx, const int mode, const uint8_t* con
 // 
 // \return       0 if successful
 // 
-int aes_crypt_ecb(struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]);
+int aes_crypt_ecb(const struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]);
 int aes_encrypt_ecb(const uint8_t* const key, const int key_size, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE], const uint32_t length);
 int aes_decrypt_ecb(const uint8_t* const key, const int key_size, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE], const uint32_t length);
+int aes_key_encrypt_ecb(const struct aes_key_t* const key, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]);
+int aes_key_decrypt_ecb(const struct aes_key_t* const key, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]);
 
 // 
 // \brief        AES-CBC buffer encryption/decryption
@@ -131,9 +157,36 @@ int aes_decrypt_ecb(const uint8_t* const key, const int key_size, const uint8_t
 // 
 // \return       0 if successful, or ERROR_INVALID_DATA_SIZE
 // 
-int aes_crypt_cbc(struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
+int aes_crypt_cbc(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
 int aes_encrypt_cbc(const uint8_t* const key, const int key_size, const uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
 int aes_decrypt_cbc(const uint8_t* const key, const int key_size, const uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
+int aes_key_encrypt_cbc(const struct aes_key_t* const key, const uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
+int aes_key_decrypt_cbc(const struct aes_key_t* const key, const uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
+
+//
+// \brief AES-CBC multi-buffer lane, one independent encryption stream
+//
+struct aes_cbc_lane_t {
+	const struct aes_context_t* ctx; // AES_ENCRYPT context, may be shared between lanes
+	uint8_t iv[AES_BLOCK_SIZE]; // initialization vector (updated after use)
+	const uint8_t* input; // buffer holding the input data
+	uint8_t* output; // buffer holding the output data
+	uint32_t length; // multiple of the block size
+};
+
+//
+// \brief        AES-CBC encryption of several independent streams
+//               CBC encryption is serial within a stream, so blocks of
+//               different lanes are interleaved instead to keep the AES
+//               pipeline busy
+//
+// \param lanes  streams to encrypt, keys and lengths may differ
+// \param count  number of lanes
+//
+// \return       0 if successful, ERROR_INVALID_MODE, ERROR_INVALID_DATA_SIZE
+//               or ERROR_INVALID_KEY_SIZE
+//
+int aes_crypt_cbc_multi(struct aes_cbc_lane_t* const lanes, const uint32_t count);
 
 // 
 // \brief         AES-CTR buffer encryption/decryption
@@ -146,8 +199,9 @@ int aes_decrypt_cbc(const uint8_t* const key, const int key_size, const uint8_t
 // 
 // \return        0 if successful
 // 
-int aes_crypt_ctr(struct aes_context_t* const ctx, uint8_t nonce[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
+int aes_crypt_ctr(const struct aes_context_t* const ctx, uint8_t nonce[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
 int aes_ctr(const uint8_t* const key, const int key_size, const uint8_t nonce[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
+int aes_key_ctr(const struct aes_key_t* const key, const uint8_t nonce[AES_BLOCK_SIZE], const uint8_t* const input, uint8_t* const output, const uint32_t length);
 
 // 
 // \brief AES-XTS key schedule
@@ -157,14 +211,117 @@ int aes_xts_init(struct aes_xts_context_t* const ctx, const int mode, const uint
 // 
 // \brief AES-XTS sector encryption/decryption
 // 
-int aes_crypt_xts(struct aes_xts_context_t* const ctx, const uint8_t* const input, uint8_t* const output, const uint64_t sector_index, const uint32_t sector_size);
-int aes_encrypt_xts(const uint8_t* const tweak_key, const int tweak_key_size, const uint8_t* const data_key, const int data_key_size, const uint8_t* const input, uint8_t* const output, const uint32_t sector_index, const uint32_t sector_size);
-int aes_decrypt_xts(const uint8_t* const tweak_key, const int tweak_key_size, const uint8_t* const data_key, const int data_key_size, const uint8_t* const input, uint8_t* const output, const uint32_t sector_index, const uint32_t sector_size);
+int aes_crypt_xts(const struct aes_xts_context_t* const ctx, const uint8_t* const input, uint8_t* const output, const uint64_t sector_index, const uint32_t sector_size);
+int aes_encrypt_xts(const uint8_t* const tweak_key, const int tweak_key_size, const uint8_t* const data_key, const int data_key_size, const uint8_t* const input, uint8_t* const output, const uint64_t sector_index, const uint32_t sector_size);
+int aes_decrypt_xts(const uint8_t* const tweak_key, const int tweak_key_size, const uint8_t* const data_key, const int data_key_size, const uint8_t* const input, uint8_t* const output, const uint64_t sector_index, const uint32_t sector_size);
+
+//
+// \brief               AES-XTS encryption/decryption of consecutive sectors
+//                      Long runs are split across worker threads
+//
+// \param first_sector  index of the first sector, the following ones are
+//                      numbered consecutively
+// \param sector_count  number of sectors
+// \param sector_size   size of every sector, a multiple of the block size
+//
+// \return              0 if successful, or ERROR_INVALID_DATA_SIZE
+//
+int aes_crypt_xts_sectors(const struct aes_xts_context_t* const ctx, const uint8_t* const input, uint8_t* const output, const uint64_t first_sector, const uint32_t sector_count, const uint32_t sector_size);
 
 // 
 // \brief AES-CMAC
 // 
 int aes_cmac(const uint8_t* const key, const int key_size, const uint8_t* const input, uint8_t* const output, const uint32_t length);
+int aes_key_cmac(const struct aes_key_t* const key, const uint8_t* const input, uint8_t* const output, const uint32_t length);
+
+//
+// \brief          Tag comparison whose run time does not depend on where the
+//                 tags differ
+//
+// \return         1 if the tags are equal, 0 otherwise
+//
+int aes_tag_equal(const uint8_t* const a, const uint8_t* const b, const uint32_t length);
+
+//
+// \brief AES-CMAC streaming context, the subkeys are derived once per key
+//
+// \note  the cipher context holds its own round keys, so the context must not
+//        be copied by value
+//
+struct aes_cmac_context_t {
+	struct aes_context_t cipher; // AES_ENCRYPT context
+	uint8_t k1[AES_BLOCK_SIZE]; // subkey for a complete last block
+	uint8_t k2[AES_BLOCK_SIZE]; // subkey for a padded last block
+	uint8_t state[AES_BLOCK_SIZE]; // CBC-MAC of the blocks processed so far
+	uint8_t block[AES_BLOCK_SIZE]; // pending input, held back until more data or finish
+	uint32_t block_length;
+};
+
+//
+// \brief          AES-CMAC key setup, expands the key and derives K1/K2
+//                 The context is ready for a message afterwards
+//
+// \return         0 if successful, or ERROR_INVALID_KEY_SIZE
+//
+int aes_cmac_init(struct aes_cmac_context_t* const ctx, const uint8_t* const key, const int key_size);
+
+//
+// \brief          AES-CMAC streaming, starts resets the message state and keeps
+//                 the key, update may be called any number of times with any
+//                 length, finish writes the AES_BLOCK_SIZE byte tag
+//
+// \return         0 if successful
+//
+int aes_cmac_starts(struct aes_cmac_context_t* const ctx);
+int aes_cmac_update(struct aes_cmac_context_t* const ctx, const uint8_t* const input, const uint32_t length);
+int aes_cmac_finish(struct aes_cmac_context_t* const ctx, uint8_t output[AES_BLOCK_SIZE]);
+
+//
+// \brief AES-CMAC tag to check with aes_cmac_verify_multi
+//
+struct aes_cmac_verify_t {
+	const struct aes_cmac_context_t* key; // prepared with aes_cmac_init, may be shared
+	const uint8_t* message;
+	uint32_t length;
+	const uint8_t* tag; // expected tag, AES_BLOCK_SIZE bytes
+	int valid; // set to 1 if the tag matches, 0 otherwise
+};
+
+//
+// \brief        AES-CMAC verification of many messages
+//               The messages are run through the multi-buffer CBC engine
+//               side by side and the tags are compared in constant time
+//
+// \param items  messages to check, valid is updated for each of them
+// \param count  number of items
+//
+// \return       number of tags that do not match, or ERROR_INVALID_MODE
+//
+int aes_cmac_verify_multi(struct aes_cmac_verify_t* const items, const uint32_t count);
+
+//
+// \brief Select the fastest AES and SHA-1 implementations supported by the host CPU
+//
+// \note  Every implementation runs a known-answer self-test first and is left
+//        out if it fails. The environment variables SV_AES_BACKEND and
+//        SV_SHA1_BACKEND force a backend by name (e.g. "vperm", "ssse3"),
+//        with the backends after it filling in what it does not implement.
+//        Backends that measure slower than the portable code are only used
+//        when forced.
+//        Every implementation uses the same key schedule layout, so contexts
+//        prepared before this call remain valid
+//
+void crypto_init(void);
+
+//
+// \brief  Name of the AES implementation in use
+//
+const char* aes_backend_name(void);
+
+//
+// \brief  Name of the SHA-1 implementation in use
+//
+const char* sha1_backend_name(void);
 
 //-----------------------------------------------------------------------------
 // SHA-1
@@ -175,6 +332,14 @@ enum {
 	SHA1_BLOCK_SIZE = 64,
 };
 
+//
+// \brief SHA-1 HMAC key, the states after hashing the padded key blocks
+//
+struct sha1_hmac_key_t {
+	uint32_t inner[5]; // state after the key ^ ipad block
+	uint32_t outer[5]; // state after the key ^ opad block
+};
+
 //
 // \brief SHA-1 context structure
 //
@@ -182,8 +347,7 @@ struct sha1_context_t {
 	uint32_t total[2]; // number of bytes processed
 	uint32_t state[5]; // intermediate digest state
 	uint8_t buffer[64]; // data block being processed
-	uint8_t ipad[64]; // HMAC: inner padding
-	uint8_t opad[64]; // HMAC: outer padding
+	struct sha1_hmac_key_t hmac; // HMAC: precomputed key states
 };
 
 // 
@@ -222,6 +386,47 @@ void sha1_finish(struct sha1_context_t* const ctx, uint8_t output[SHA1_HASH_SIZE
 // 
 void sha1(const uint8_t* const input, uint8_t output[SHA1_HASH_SIZE], const uint32_t length);
 
+//
+// \brief SHA-1 multi-buffer lane, one independent message
+//
+struct sha1_lane_t {
+	const uint8_t* input; // buffer holding the data
+	uint32_t length; // length of the input data
+	uint8_t output[SHA1_HASH_SIZE]; // SHA-1 checksum result
+};
+
+//
+// \brief        SHA-1 of several independent messages
+//               The messages are hashed side by side in the elements of the
+//               vector registers, which keeps the vector units busy where a
+//               single short message cannot
+//
+// \param lanes  messages to hash, the lengths may differ
+// \param count  number of lanes
+//
+void sha1_multi(struct sha1_lane_t* const lanes, const uint32_t count);
+
+//
+// \brief          SHA-1 HMAC key setup
+//                 Hashes the padded key blocks once, every MAC computed with
+//                 the key afterwards starts from the saved states
+//
+// \param hmac_key key states to be initialized
+// \param key      HMAC secret key
+// \param key_size length of the HMAC key
+//
+void sha1_hmac_key_init(struct sha1_hmac_key_t* const hmac_key, const uint8_t* const key, const uint32_t key_size);
+
+//
+// \brief          SHA-1 HMAC context setup from a prepared key
+//                 The key states are copied, so any number of contexts can
+//                 be started from the same key
+//
+// \param ctx      HMAC context to be initialized
+// \param hmac_key key prepared with sha1_hmac_key_init
+//
+void sha1_hmac_key_starts(struct sha1_context_t* const ctx, const struct sha1_hmac_key_t* const hmac_key);
+
 // 
 // \brief          SHA-1 HMAC context setup
 // 
@@ -266,10 +471,35 @@ void sha1_hmac_reset(struct sha1_context_t* const ctx);
 // 
 void sha1_hmac(const uint8_t* const key, const uint32_t key_size, const uint8_t* const input, uint8_t output[SHA1_HASH_SIZE], const uint32_t length);
 
+//
+// \brief          HMAC-SHA-1 of several independent messages under one key
+//                 The inner and the outer hashes run through the
+//                 multi-buffer engine of sha1_multi
+//
+// \param hmac_key key prepared with sha1_hmac_key_init
+// \param lanes    messages, output receives the HMAC of each of them
+// \param count    number of lanes
+//
+void sha1_hmac_multi(const struct sha1_hmac_key_t* const hmac_key, struct sha1_lane_t* const lanes, const uint32_t count);
+
 //-----------------------------------------------------------------------------
 // Random numbers generation
 //-----------------------------------------------------------------------------
 
+//
+// \brief        Fill a buffer with cryptographically secure random bytes
+//
+//               Every thread draws from its own AES-256-CTR generator seeded
+//               from getrandom(), so no locks and no allocations are needed.
+//               The keystream is produced RNG_POOL_SIZE bytes at a time, the
+//               key is replaced after every refill and bytes are wiped from
+//               the pool as soon as they are handed out.
+//
+// \param data   buffer receiving the random bytes
+// \param length number of bytes
+//
+// \return       0 if successful, or ERROR_NO_ENTROPY
+//
 int generate_random_bytes(uint8_t* const data, const uint32_t length);
 
 //-----------------------------------------------------------------------------
@@ -440,7 +670,39 @@ int des3_crypt_ecb(des3_context *ctx, const unsigned char input[8], unsigned cha
  * \return         0 if successful, or POLARSSL_ERR_DES_INVALID_INPUT_LENGTH
  */
 int des3_crypt_cbc (des3_context *ctx, int mode, size_t length, unsigned char iv[8], const unsigned char *input, unsigned char *output);
+
+/**
+ * \brief          3DES-ECB encryption/decryption of many blocks at once
+ *
+ *                 With AVX2 the blocks are bitsliced, 256 go through the
+ *                 cipher together as boolean circuits, without table
+ *                 lookups, and large batches run about twice as fast as
+ *                 des3_crypt_ecb block by block. Other hosts use the
+ *                 tables.
+ *
+ * \param ctx      3DES context
+ * \param length   length of the input data, multiple of 8
+ * \param input    buffer holding the input data
+ * \param output   buffer holding the output data
+ *
+ * \return         0 if successful, or POLARSSL_ERR_DES_INVALID_INPUT_LENGTH
+ */
+int des3_crypt_ecb_multi (des3_context *ctx, size_t length, const unsigned char *input, unsigned char *output);
 					 
+/**
+ * \brief          3DES-CBC encryption with a key prepared by des3_set2key_enc
+ *                 or des3_set3key_enc, for keys used more than once
+ *
+ * \param ctx      3DES encryption context
+ * \param iv       initialization vector (not updated)
+ * \param input    buffer holding the input data
+ * \param output   buffer holding the output data
+ * \param length   length of the input data
+ *
+ * \return         0 if successful, or POLARSSL_ERR_DES_INVALID_INPUT_LENGTH
+ */
+int des3_key_encrypt_cbc (const des3_context *ctx, const unsigned char iv[8], const unsigned char *input, unsigned char *output, size_t length);
+
 int des3_encrypt_cbc (const unsigned char key[DES_KEY_SIZE * 2], unsigned char iv[8], const unsigned char *input, unsigned char *output, size_t length);
 
 int des3_decrypt_cbc (const unsigned char key[DES_KEY_SIZE * 2], unsigned char iv[8], const unsigned char *input, unsigned char *output, size_t length);
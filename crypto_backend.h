@@ -0,0 +1,221 @@
+#ifndef __CRYPTO_BACKEND_H__
+#define __CRYPTO_BACKEND_H__
+
+#include "crypto.h"
+#include "cpu_features.h"
+
+//
+// \brief Multi-buffer CBC lane as seen by the backends, the scheduler in
+//        aes_crypt_cbc_multi advances input and output
+//
+struct aes_lane_cursor_t {
+	const uint32_t* rk;
+	uint8_t* iv;
+	const uint8_t* input;
+	uint8_t* output;
+};
+
+//
+// \brief AES implementation table
+//
+// \note  All backends share the key schedule layout produced by aes_init, so
+//        a context prepared once can be handed to whichever backend is active.
+//        expand_key and invert_key are optional; when NULL (or when
+//        expand_key returns non-zero) the portable key schedule is used.
+//        The mode functions only ever see whole blocks. Any other member may
+//        be NULL as well, crypto_init() then takes it from the next supported
+//        backend in its priority list.
+//        cbc_encrypt_lanes encrypts nblocks of up to max_lanes streams that
+//        share the same number of rounds.
+//
+struct aes_backend_t {
+	const char* name;
+
+	int (*supported)(void);
+
+	int (*expand_key)(uint32_t* const rk, const uint8_t* const key, const unsigned int key_size);
+	void (*invert_key)(uint32_t* const drk, const uint32_t* const erk, const int nr);
+
+	void (*ecb)(const struct aes_context_t* const ctx, const uint8_t input[AES_BLOCK_SIZE], uint8_t output[AES_BLOCK_SIZE]);
+	void (*cbc_encrypt)(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* input, uint8_t* output, uint32_t nblocks);
+	void (*cbc_decrypt)(const struct aes_context_t* const ctx, uint8_t iv[AES_BLOCK_SIZE], const uint8_t* input, uint8_t* output, uint32_t nblocks);
+	void (*ctr)(const struct aes_context_t* const ctx, uint8_t counter[AES_BLOCK_SIZE], const uint8_t* input, uint8_t* output, uint32_t nblocks);
+	void (*xts)(const struct aes_context_t* const ctx, uint8_t tweak[AES_BLOCK_SIZE], const uint8_t* input, uint8_t* output, uint32_t nblocks);
+
+	uint32_t max_lanes;
+	void (*cbc_encrypt_lanes)(struct aes_lane_cursor_t* const lanes, const uint32_t count, const int nr, uint32_t nblocks);
+};
+
+//
+// Upper bound of max_lanes over all backends
+//
+#define AES_MAX_LANES 8
+
+extern const struct aes_backend_t aes_backend_portable;
+extern const struct aes_backend_t aes_backend_aesni;
+extern const struct aes_backend_t aes_backend_vaes256;
+extern const struct aes_backend_t aes_backend_vaes512;
+extern const struct aes_backend_t aes_backend_vperm;
+extern const struct aes_backend_t aes_backend_bitslice;
+extern const struct aes_backend_t aes_backend_bitslice_avx2;
+extern const struct aes_backend_t aes_backend_compact;
+
+//
+// Big endian 128-bit counter increment used by the CTR implementations
+//
+static inline void aes_ctr_increment(uint8_t counter[AES_BLOCK_SIZE]) {
+	int i;
+
+	for (i = AES_BLOCK_SIZE - 1; i >= 0; --i) {
+		counter[i]++;
+		if (counter[i] != 0)
+			break;
+	}
+}
+
+static inline void aes_ctr_put_low(uint8_t block[AES_BLOCK_SIZE], const uint32_t low) {
+	block[12] = (uint8_t)(low >> 24);
+	block[13] = (uint8_t)(low >> 16);
+	block[14] = (uint8_t)(low >> 8);
+	block[15] = (uint8_t)low;
+}
+
+//
+// Writes nblocks consecutive counter blocks and advances the counter past
+// them. Unless the low 32-bit word wraps inside the batch only that word
+// differs between the blocks, so it is written directly.
+//
+static inline void aes_ctr_fill(uint8_t* const blocks, uint8_t counter[AES_BLOCK_SIZE], const uint32_t nblocks) {
+	uint32_t low;
+	uint32_t b;
+
+	low = ((uint32_t)counter[12] << 24) | ((uint32_t)counter[13] << 16) | ((uint32_t)counter[14] << 8) | (uint32_t)counter[15];
+
+	if (low > UINT32_MAX - nblocks) {
+		for (b = 0; b < nblocks; ++b) {
+			memcpy(blocks + b * AES_BLOCK_SIZE, counter, AES_BLOCK_SIZE);
+			aes_ctr_increment(counter);
+		}
+		return;
+	}
+
+	for (b = 0; b < nblocks; ++b) {
+		memcpy(blocks + b * AES_BLOCK_SIZE, counter, AES_BLOCK_SIZE - 4);
+		aes_ctr_put_low(blocks + b * AES_BLOCK_SIZE, low + b);
+	}
+	aes_ctr_put_low(counter, low + nblocks);
+}
+
+//
+// dst = a ^ b, eight bytes at a time
+//
+static inline void aes_xor_bytes(uint8_t* const dst, const uint8_t* const a, const uint8_t* const b, const uint32_t length) {
+	uint64_t x, y;
+	uint32_t i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		x ^= y;
+		memcpy(dst + i, &x, 8);
+	}
+
+	for (; i < length; ++i)
+		dst[i] = a[i] ^ b[i];
+}
+
+//
+// CBC decryption chaining for a batch of independently decrypted blocks:
+// dst[i] = plain[i] ^ src[i - 1], dst[0] = plain[0] ^ iv.
+// The batch is walked backwards so src == dst works, every ciphertext block
+// is consumed before its own slot gets overwritten.
+//
+static inline void aes_cbc_decrypt_chain(uint8_t iv[AES_BLOCK_SIZE], const uint8_t* const src, uint8_t* const dst, const uint8_t* const plain, const uint32_t nblocks) {
+	uint8_t next_iv[AES_BLOCK_SIZE];
+	uint32_t b;
+	int i;
+
+	memcpy(next_iv, src + (nblocks - 1) * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+
+	for (b = nblocks - 1; b > 0; --b) {
+		for (i = 0; i < AES_BLOCK_SIZE; ++i)
+			dst[b * AES_BLOCK_SIZE + i] = plain[b * AES_BLOCK_SIZE + i] ^ src[(b - 1) * AES_BLOCK_SIZE + i];
+	}
+
+	for (i = 0; i < AES_BLOCK_SIZE; ++i)
+		dst[i] = plain[i] ^ iv[i];
+
+	memcpy(iv, next_iv, AES_BLOCK_SIZE);
+}
+
+//
+// XTS tweak multiplication by x in GF(2^128), little endian byte order.
+// The tweak is loaded as two 64-bit words, the reduction is applied with a
+// mask instead of a branch.
+//
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define AES_XTS_LE64(x) __builtin_bswap64(x)
+#else
+#define AES_XTS_LE64(x) (x)
+#endif
+
+static inline void aes_xts_mulx(uint8_t tweak[AES_BLOCK_SIZE]) {
+	uint64_t lo, hi, carry;
+
+	memcpy(&lo, tweak, 8);
+	memcpy(&hi, tweak + 8, 8);
+	lo = AES_XTS_LE64(lo);
+	hi = AES_XTS_LE64(hi);
+
+	carry = hi >> 63;
+	hi = (hi << 1) | (lo >> 63);
+	lo = (lo << 1) ^ (0x87 & (0 - carry));
+
+	lo = AES_XTS_LE64(lo);
+	hi = AES_XTS_LE64(hi);
+	memcpy(tweak, &lo, 8);
+	memcpy(tweak + 8, &hi, 8);
+}
+
+#undef AES_XTS_LE64
+
+//
+// \brief Multi-buffer SHA-1 lane as seen by the backends, blocks_lanes
+//        advances data
+//
+struct sha1_lane_cursor_t {
+	uint32_t* state;
+	const uint8_t* data;
+};
+
+//
+// \brief SHA-1 implementation table
+//
+// \note  blocks runs the compression function over nblocks consecutive
+//        SHA1_BLOCK_SIZE byte blocks, the padding is left to sha1_finish.
+//        blocks_lanes does the same for up to max_lanes independent
+//        messages at once. Either may be NULL, crypto_init() then takes it
+//        from the next supported backend in its priority list.
+//
+struct sha1_backend_t {
+	const char* name;
+
+	int (*supported)(void);
+
+	void (*blocks)(uint32_t state[5], const uint8_t* data, uint32_t nblocks);
+
+	uint32_t max_lanes;
+	void (*blocks_lanes)(struct sha1_lane_cursor_t* const lanes, const uint32_t count, uint32_t nblocks);
+};
+
+//
+// Upper bound of max_lanes over all SHA-1 backends
+//
+#define SHA1_MAX_LANES 8
+
+extern const struct sha1_backend_t sha1_backend_portable;
+extern const struct sha1_backend_t sha1_backend_shani;
+extern const struct sha1_backend_t sha1_backend_avx2;
+extern const struct sha1_backend_t sha1_backend_ssse3;
+
+#endif
@@ -0,0 +1,142 @@
+//
+// Bitsliced 3DES, included by crypto.c with the vector width to instantiate
+//
+// Bit i of all blocks of a batch lives in one vector, 64 blocks per 64-bit
+// element. The permutations then only rename vectors and every S-box is a
+// fixed boolean circuit built from the SB tables (see des_bs_init()), so a
+// batch runs without any data dependent memory access.
+//
+// The including file defines:
+//   DS_VEC        vector type of 64-bit elements
+//   DS_LANES      number of 64-bit elements
+//   DS_FN(name)   name mangling for the instantiated functions
+//   DS_TARGET     function attributes enabling the instruction set
+//
+
+#define DS_BLOCKS (64 * DS_LANES)
+
+//
+// One S-box: the 16 minterms of the column bits are combined with the
+// functions of the two row bits selected for each output bit
+//
+DS_TARGET static inline void DS_FN(des_bs_sbox)(DS_VEC out[4], const DS_VEC in[6], const int s) {
+	DS_VEC lo[4], hi[4], col[16], row[4], rowfn[16];
+	DS_VEC acc;
+	int c, m, o;
+
+	lo[0] = ~in[1] & ~in[2];
+	lo[1] = in[1] & ~in[2];
+	lo[2] = ~in[1] & in[2];
+	lo[3] = in[1] & in[2];
+
+	hi[0] = ~in[3] & ~in[4];
+	hi[1] = in[3] & ~in[4];
+	hi[2] = ~in[3] & in[4];
+	hi[3] = in[3] & in[4];
+
+	for (c = 0; c < 16; ++c)
+		col[c] = lo[c & 3] & hi[c >> 2];
+
+	row[0] = ~in[5] & ~in[0];
+	row[1] = ~in[5] & in[0];
+	row[2] = in[5] & ~in[0];
+	row[3] = in[5] & in[0];
+
+	rowfn[0] = row[0] ^ row[0];
+	for (m = 1; m < 16; ++m)
+		rowfn[m] = rowfn[m & (m - 1)] | row[__builtin_ctz(m)];
+
+	for (o = 0; o < 4; ++o) {
+		acc = rowfn[0];
+#pragma GCC unroll 16
+		for (c = 0; c < 16; ++c)
+			acc ^= col[c] & rowfn[des_bs_rowfn[s][o][c]];
+		out[o] = acc;
+	}
+}
+
+//
+// y ^= f(x, subkey), the vector form of DES_ROUND
+//
+DS_TARGET static inline void DS_FN(des_bs_round)(const DS_VEC x[32], DS_VEC y[32], const uint32_t sk[2]) {
+	const DS_VEC zero = x[0] ^ x[0];
+	DS_VEC in[6], out[4];
+	uint32_t key;
+	int s, j, o;
+
+#pragma GCC unroll 8
+	for (s = 0; s < 8; ++s) {
+		key = sk[s >> 2] >> des_bs_shift[s];
+
+		for (j = 0; j < 6; ++j)
+			in[j] = x[(des_bs_shift[s] + (s >> 2) * 4 + j) & 0x1F] ^ (((key >> j) & 1) ? ~zero : zero);
+
+		DS_FN(des_bs_sbox)(out, in, s);
+
+		for (o = 0; o < 4; ++o)
+			y[des_bs_outbit[s][o]] ^= out[o];
+	}
+}
+
+//
+// DS_BLOCKS blocks through the three DES passes of des3_crypt_ecb
+//
+DS_TARGET static void DS_FN(des3_bs_ecb)(const uint32_t sk[96], const unsigned char* input, unsigned char* output) {
+	uint64_t m[64];
+	DS_VEC bits[64], x[32], y[32];
+	uint32_t X, Y;
+	int l, i, j;
+
+	for (l = 0; l < DS_LANES; ++l) {
+		for (j = 0; j < 64; ++j) {
+			GET_UINT32_BE(X, input, 8 * (64 * l + j));
+			GET_UINT32_BE(Y, input, 8 * (64 * l + j) + 4);
+			m[j] = ((uint64_t)X << 32) | Y;
+		}
+
+		des_bs_transpose(m);
+
+		for (i = 0; i < 64; ++i)
+			bits[i][l] = m[i];
+	}
+
+	for (i = 0; i < 32; ++i) {
+		x[i] = bits[des_bs_ip[32 + i]];
+		y[i] = bits[des_bs_ip[i]];
+	}
+
+	for (i = 0; i < 16; i += 2) {
+		DS_FN(des_bs_round)(y, x, sk + 2 * i);
+		DS_FN(des_bs_round)(x, y, sk + 2 * i + 2);
+	}
+
+	for (i = 16; i < 32; i += 2) {
+		DS_FN(des_bs_round)(x, y, sk + 2 * i);
+		DS_FN(des_bs_round)(y, x, sk + 2 * i + 2);
+	}
+
+	for (i = 32; i < 48; i += 2) {
+		DS_FN(des_bs_round)(y, x, sk + 2 * i);
+		DS_FN(des_bs_round)(x, y, sk + 2 * i + 2);
+	}
+
+	// DES_FP(Y, X) and the output order Y, X
+	for (i = 0; i < 32; ++i) {
+		bits[des_bs_fp[32 + i]] = x[i];
+		bits[des_bs_fp[i]] = y[i];
+	}
+
+	for (l = 0; l < DS_LANES; ++l) {
+		for (i = 0; i < 64; ++i)
+			m[i] = bits[i][l];
+
+		des_bs_transpose(m);
+
+		for (j = 0; j < 64; ++j) {
+			PUT_UINT32_BE((uint32_t)(m[j] >> 32), output, 8 * (64 * l + j));
+			PUT_UINT32_BE((uint32_t)m[j], output, 8 * (64 * l + j) + 4);
+		}
+	}
+}
+
+#undef DS_BLOCKS
@@ -0,0 +1,71 @@
+//
+// Build-time generator for key_schedules.c
+//
+// Expands the constant AES keys from keys.c with the portable key schedule
+// and prints them as const struct aes_key_t objects, so the protocol code
+// never has to run the key expansion for them.
+//
+
+#include "common.h"
+#include "keys.h"
+#include "crypto.h"
+
+struct key_entry_t {
+	const char* name;
+	const uint8_t* key;
+};
+
+#define KEY_ENTRY(name) { #name, name }
+
+static const struct key_entry_t key_entries[] = {
+	KEY_ENTRY(fix1_it), KEY_ENTRY(fix2_it),
+	KEY_ENTRY(fix1_pn), KEY_ENTRY(fix2_pn),
+	KEY_ENTRY(Kf1_u0), KEY_ENTRY(Kf2_u0),
+	KEY_ENTRY(Kf1_u1), KEY_ENTRY(Kf2_u1),
+	KEY_ENTRY(Kf1_u2), KEY_ENTRY(Kf2_u2),
+	KEY_ENTRY(Kf1_u3), KEY_ENTRY(Kf2_u3),
+	KEY_ENTRY(Kf1_u4), KEY_ENTRY(Kf2_u4),
+	KEY_ENTRY(kms1), KEY_ENTRY(kms2),
+	KEY_ENTRY(Kh),
+	KEY_ENTRY(Kwm),
+	KEY_ENTRY(Kdid),
+};
+
+static void print_context(const char* const name, const char* const member, const struct aes_context_t* const ctx) {
+	unsigned int i;
+
+	printf("\t.%s = {\n", member);
+	printf("\t\t.buf = {");
+	for (i = 0; i < sizeof(ctx->buf) / sizeof(ctx->buf[0]); ++i)
+		printf("%s0x%08X,", (i % 6 == 0) ? "\n\t\t\t" : " ", ctx->buf[i]);
+	printf("\n\t\t},\n");
+	printf("\t\t.rk = %s_key.%s.buf,\n", name, member);
+	printf("\t\t.nr = %d,\n", ctx->nr);
+	printf("\t\t.mode = %s,\n", (ctx->mode == AES_ENCRYPT) ? "AES_ENCRYPT" : "AES_DECRYPT");
+	printf("\t},\n");
+}
+
+int main() {
+	// zeroed, so unused round key slots are printed deterministically
+	static struct aes_key_t key;
+	unsigned int i;
+
+	printf("// generated by gen_key_schedules, do not edit\n\n");
+	printf("#include \"key_schedules.h\"\n");
+
+	for (i = 0; i < sizeof(key_entries) / sizeof(key_entries[0]); ++i) {
+		memset(&key, 0, sizeof(key));
+
+		if (aes_key_init(&key, key_entries[i].key, 128) != 0) {
+			fprintf(stderr, "gen_key_schedules :: failed to expand %s\n", key_entries[i].name);
+			return 1;
+		}
+
+		printf("\nconst struct aes_key_t %s_key = {\n", key_entries[i].name);
+		print_context(key_entries[i].name, "enc", &key.enc);
+		print_context(key_entries[i].name, "dec", &key.dec);
+		printf("};\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef __KEY_SCHEDULES_H__
+#define __KEY_SCHEDULES_H__
+
+#include "crypto.h"
+
+//
+// Pre-expanded AES keys for the constant keys in keys.c
+// key_schedules.c is generated at build time by gen_key_schedules
+//
+
+extern const struct aes_key_t fix1_it_key;
+extern const struct aes_key_t fix2_it_key;
+extern const struct aes_key_t fix1_pn_key;
+extern const struct aes_key_t fix2_pn_key;
+extern const struct aes_key_t Kf1_u0_key;
+extern const struct aes_key_t Kf2_u0_key;
+extern const struct aes_key_t Kf1_u1_key;
+extern const struct aes_key_t Kf2_u1_key;
+extern const struct aes_key_t Kf1_u2_key;
+extern const struct aes_key_t Kf2_u2_key;
+extern const struct aes_key_t Kf1_u3_key;
+extern const struct aes_key_t Kf2_u3_key;
+extern const struct aes_key_t Kf1_u4_key;
+extern const struct aes_key_t Kf2_u4_key;
+extern const struct aes_key_t kms1_key;
+extern const struct aes_key_t kms2_key;
+extern const struct aes_key_t Kh_key;
+extern const struct aes_key_t Kwm_key;
+extern const struct aes_key_t Kdid_key;
+
+#endif
@@ -164,9 +164,7 @@ int decrypt_eid4() {
 	if (eid4_file != NULL)
 	{
 		uint8_t* eid4 = (uint8_t*)malloc(EID4_SIZE);
-		uint8_t* eid4_sig = (uint8_t*)malloc(0x10);
 		memset(eid4, 0, EID4_SIZE);
-		memset(eid4_sig, 0, 0x10);
 		fread(eid4, EID4_SIZE, 1, eid4_file);
 		fclose(eid4_file);
 
@@ -175,10 +173,13 @@ int decrypt_eid4() {
 		aes_encrypt_cbc(eid_root_key, EID4_KEY_SIZE * 8, eid_root_iv, sv_iso_module_individual_seed, eid4_keys, INDIVIDUAL_SEED_SIZE);
 
 		//verify eid4
+		uint8_t eid4_sig[0x10];
 		aes_cmac(eid4_keys + 0x20, EID4_KEY_SIZE * 8, eid4, eid4_sig, 0x20);
-		if (memcmp(eid4_sig, eid4 + 0x20, 0x10) != 0)
+		if (!aes_tag_equal(eid4_sig, eid4 + 0x20, 0x10))
 		{
 			fprintf(stdout, "eid4 signature is invalid!\n");
+			free(eid4_keys);
+			free(eid4);
 			return -7;
 		}
 
@@ -189,6 +190,8 @@ int decrypt_eid4() {
 		memcpy(sv_auth.kf1_eid, eid4, 0x10);
 		memcpy(sv_auth.kf2_eid, eid4 + 0x10, 0x10);
 
+		free(eid4_keys);
+		free(eid4);
 		return 0;
 	}
 	return -1;
@@ -8,11 +8,11 @@
 
 int main(int argc, char* argv[])
 {
-	int result, stopcode;
+	int result, stopcode = 0;
 	result = 0;
 
-	// init RNG
-	srand((unsigned int)time(0));
+	// select crypto backends
+	crypto_init();
 
 	set_eid_root_key();
 
@@ -23,6 +23,19 @@ int main(int argc, char* argv[])
 		goto fail;
 	}
 
+	//one drive handle for the whole session, SV_DEVICE=/dev/bsg/... goes through bsg
+	const char *device = getenv("SV_DEVICE");
+	if (device == NULL)
+		device = SV_TRANSPORT_DEFAULT_DEVICE;
+
+	result = sv_transport_open(device);
+	if (result != 0)
+	{
+		fprintf(stderr, "sv_transport_open() failed: %d\n", result);
+		stopcode = 0x103;
+		goto fail;
+	}
+
 	//setup mode
 	sv_auth.m_mode = 0xD;  //PS3 Disc AUTH
 	sv_auth.m_retry_flag = RETRY_FLAG_ALLOW;
@@ -237,10 +250,12 @@ int main(int argc, char* argv[])
 	goto done;
 
 fail:
+	sv_transport_close();
 	fprintf(stderr, "Stopcode: %#4x\n", stopcode);
 	return result;
 
 done:
+	sv_transport_close();
 	fprintf(stdout, "Success!\n");
 	return 0;
 }
@@ -0,0 +1,129 @@
+//
+// Multi-buffer SHA-1, included by sha1_simd.c once per vector width
+//
+// Every 32-bit element of a vector belongs to a different message, so the
+// rounds run exactly as in the scalar code with M_LANES messages side by
+// side. The including file defines:
+//   M_VEC             vector type
+//   M_LANES           number of 32-bit elements
+//   M_FN(name)        name mangling for the instantiated functions
+//   M_TARGET          function attributes enabling the instruction set
+//   M_LOAD_BLOCK(w, data)
+//                     transpose the next block of every lane into w[0..15],
+//                     data[l] points at the block of lane l
+//   M_LOADU(p), M_STOREU(p, x)
+//                     unaligned load and store of M_LANES words
+//   M_SET1(k)         broadcast a 32-bit word
+//   M_ADD32, M_XOR, M_AND, M_OR, M_SLLI32, M_SRLI32
+//   M_LEAVE()         clean up the vector state before returning
+//
+
+#define M_ROL(x, n) M_OR(M_SLLI32((x), (n)), M_SRLI32((x), 32 - (n)))
+
+#define M_F1(x, y, z) M_XOR((z), M_AND((x), M_XOR((y), (z))))
+#define M_F2(x, y, z) M_XOR(M_XOR((x), (y)), (z))
+#define M_F3(x, y, z) M_OR(M_AND((x), (y)), M_AND((z), M_OR((x), (y))))
+
+#define M_ROUND(f, a, b, c, d, e, t) { \
+		e = M_ADD32(M_ADD32(e, M_ROL(a, 5)), M_ADD32(f(b, c, d), M_ADD32(k, M_FN(sha1_mb_word)(w, (t))))); \
+		b = M_ROL(b, 30); \
+	}
+
+#define M_ROUNDS5(f, t) \
+	M_ROUND(f, a, b, c, d, e, (t) + 0); \
+	M_ROUND(f, e, a, b, c, d, (t) + 1); \
+	M_ROUND(f, d, e, a, b, c, (t) + 2); \
+	M_ROUND(f, c, d, e, a, b, (t) + 3); \
+	M_ROUND(f, b, c, d, e, a, (t) + 4)
+
+//
+// Message word t, the schedule is kept in a ring of 16 words
+//
+M_TARGET static inline M_VEC M_FN(sha1_mb_word)(M_VEC w[16], const int t) {
+	M_VEC x;
+
+	if (t >= 16) {
+		x = M_XOR(M_XOR(w[(t - 3) & 0x0F], w[(t - 8) & 0x0F]), M_XOR(w[(t - 14) & 0x0F], w[t & 0x0F]));
+		w[t & 0x0F] = M_ROL(x, 1);
+	}
+
+	return w[t & 0x0F];
+}
+
+M_TARGET static void M_FN(sha1_mb_blocks_lanes)(struct sha1_lane_cursor_t* const lanes, const uint32_t count, uint32_t nblocks) {
+	uint32_t state[5][M_LANES];
+	const uint8_t* data[M_LANES];
+	M_VEC v[5], w[16];
+	M_VEC a, b, c, d, e, k;
+	uint32_t l;
+	int i, t;
+
+	// unused lanes hash the data of the first one and are discarded
+	for (l = 0; l < M_LANES; ++l) {
+		const struct sha1_lane_cursor_t* const lane = &lanes[(l < count) ? l : 0];
+
+		for (i = 0; i < 5; ++i)
+			state[i][l] = lane->state[i];
+		data[l] = lane->data;
+	}
+
+	for (i = 0; i < 5; ++i)
+		v[i] = M_LOADU(state[i]);
+
+	while (nblocks-- > 0) {
+		M_LOAD_BLOCK(w, data);
+
+		a = v[0];
+		b = v[1];
+		c = v[2];
+		d = v[3];
+		e = v[4];
+
+		k = M_SET1(0x5A827999);
+		for (t = 0; t < 20; t += 5) {
+			M_ROUNDS5(M_F1, t);
+		}
+
+		k = M_SET1(0x6ED9EBA1);
+		for (t = 20; t < 40; t += 5) {
+			M_ROUNDS5(M_F2, t);
+		}
+
+		k = M_SET1(0x8F1BBCDC);
+		for (t = 40; t < 60; t += 5) {
+			M_ROUNDS5(M_F3, t);
+		}
+
+		k = M_SET1(0xCA62C1D6);
+		for (t = 60; t < 80; t += 5) {
+			M_ROUNDS5(M_F2, t);
+		}
+
+		v[0] = M_ADD32(v[0], a);
+		v[1] = M_ADD32(v[1], b);
+		v[2] = M_ADD32(v[2], c);
+		v[3] = M_ADD32(v[3], d);
+		v[4] = M_ADD32(v[4], e);
+
+		for (l = 0; l < M_LANES; ++l)
+			data[l] += SHA1_BLOCK_SIZE;
+	}
+
+	for (i = 0; i < 5; ++i)
+		M_STOREU(state[i], v[i]);
+
+	for (l = 0; l < count; ++l) {
+		for (i = 0; i < 5; ++i)
+			lanes[l].state[i] = state[i][l];
+		lanes[l].data = data[l];
+	}
+
+	M_LEAVE();
+}
+
+#undef M_ROUNDS5
+#undef M_ROUND
+#undef M_F3
+#undef M_F2
+#undef M_F1
+#undef M_ROL
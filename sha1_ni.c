@@ -0,0 +1,186 @@
+//
+// SHA-NI backend.
+//
+// The SHA extensions run four rounds per instruction and derive the message
+// schedule four words at a time, so a block costs a few dozen instructions.
+// The state is kept in the ABCD/E register layout for the whole update and
+// only converted back at the end.
+//
+
+#include "crypto_backend.h"
+
+#if defined(CPU_X86)
+
+#include <immintrin.h>
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+
+static int shani_supported(void) {
+	return cpu_has(CPU_FEATURE_SHA | CPU_FEATURE_SSE41);
+}
+
+//
+// Four rounds with the next message words, E is derived from the ABCD value
+// in front of the previous four rounds
+//
+#define SHANI_ROUNDS(msg, func) \
+	e = _mm_sha1nexte_epu32(prev, (msg)); \
+	prev = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, e, (func))
+
+static SHANI_TARGET void shani_blocks(uint32_t state[5], const uint8_t* data, uint32_t nblocks) {
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090A0B0C0D0E0FULL);
+	__m128i abcd, abcd_save, e, e_save, prev;
+	__m128i msg0, msg1, msg2, msg3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+	e = _mm_set_epi32(state[4], 0, 0, 0);
+
+	while (nblocks-- > 0) {
+		abcd_save = abcd;
+		e_save = e;
+
+		// rounds 0-3
+		msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), mask);
+		e = _mm_add_epi32(e, msg0);
+		prev = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+
+		// rounds 4-7
+		msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+		SHANI_ROUNDS(msg1, 0);
+		msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+		// rounds 8-11
+		msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+		SHANI_ROUNDS(msg2, 0);
+		msg0 = _mm_xor_si128(msg0, msg2);
+		msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+
+		// rounds 12-15
+		msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+		SHANI_ROUNDS(msg3, 0);
+		msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+		msg1 = _mm_xor_si128(msg1, msg3);
+		msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+
+		// rounds 16-19
+		SHANI_ROUNDS(msg0, 0);
+		msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+		msg2 = _mm_xor_si128(msg2, msg0);
+		msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+
+		// rounds 20-23
+		SHANI_ROUNDS(msg1, 1);
+		msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+		msg3 = _mm_xor_si128(msg3, msg1);
+		msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+		// rounds 24-27
+		SHANI_ROUNDS(msg2, 1);
+		msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+		msg0 = _mm_xor_si128(msg0, msg2);
+		msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+
+		// rounds 28-31
+		SHANI_ROUNDS(msg3, 1);
+		msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+		msg1 = _mm_xor_si128(msg1, msg3);
+		msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+
+		// rounds 32-35
+		SHANI_ROUNDS(msg0, 1);
+		msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+		msg2 = _mm_xor_si128(msg2, msg0);
+		msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+
+		// rounds 36-39
+		SHANI_ROUNDS(msg1, 1);
+		msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+		msg3 = _mm_xor_si128(msg3, msg1);
+		msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+		// rounds 40-43
+		SHANI_ROUNDS(msg2, 2);
+		msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+		msg0 = _mm_xor_si128(msg0, msg2);
+		msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+
+		// rounds 44-47
+		SHANI_ROUNDS(msg3, 2);
+		msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+		msg1 = _mm_xor_si128(msg1, msg3);
+		msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+
+		// rounds 48-51
+		SHANI_ROUNDS(msg0, 2);
+		msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+		msg2 = _mm_xor_si128(msg2, msg0);
+		msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+
+		// rounds 52-55
+		SHANI_ROUNDS(msg1, 2);
+		msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+		msg3 = _mm_xor_si128(msg3, msg1);
+		msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+		// rounds 56-59
+		SHANI_ROUNDS(msg2, 2);
+		msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+		msg0 = _mm_xor_si128(msg0, msg2);
+		msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+
+		// rounds 60-63
+		SHANI_ROUNDS(msg3, 3);
+		msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+		msg1 = _mm_xor_si128(msg1, msg3);
+		msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+
+		// rounds 64-67
+		SHANI_ROUNDS(msg0, 3);
+		msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+		msg2 = _mm_xor_si128(msg2, msg0);
+		msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+
+		// rounds 68-71
+		SHANI_ROUNDS(msg1, 3);
+		msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+		msg3 = _mm_xor_si128(msg3, msg1);
+
+		// rounds 72-75
+		SHANI_ROUNDS(msg2, 3);
+		msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+
+		// rounds 76-79
+		SHANI_ROUNDS(msg3, 3);
+
+		e = _mm_sha1nexte_epu32(prev, e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+
+		data += SHA1_BLOCK_SIZE;
+	}
+
+	_mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = (uint32_t)_mm_extract_epi32(e, 3);
+}
+
+#undef SHANI_ROUNDS
+
+const struct sha1_backend_t sha1_backend_shani = {
+	.name = "sha-ni",
+	.supported = shani_supported,
+	.blocks = shani_blocks,
+};
+
+#else
+
+static int shani_supported(void) {
+	return 0;
+}
+
+const struct sha1_backend_t sha1_backend_shani = {
+	.name = "sha-ni",
+	.supported = shani_supported,
+};
+
+#endif
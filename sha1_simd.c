@@ -0,0 +1,180 @@
+//
+// SSSE3 and AVX2 multi-buffer SHA-1 backends.
+//
+// For many independent messages the rounds of 4 (SSE) or 8 (AVX2) messages
+// run in the 32-bit elements of a vector. A single message is a serial chain
+// of scalar rounds that vectorising the message schedule alone does not
+// speed up, so these backends leave it to the portable code.
+//
+
+#include "crypto_backend.h"
+
+#if defined(CPU_X86)
+
+#include <immintrin.h>
+
+#define SSE_TARGET __attribute__((target("ssse3")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+//-----------------------------------------------------------------------------
+// SSE, four messages side by side
+//-----------------------------------------------------------------------------
+
+//
+// Big endian words t..t+3 of four blocks, transposed so that w[t + i] holds
+// word t + i of every lane
+//
+#define SHA1_TRANSPOSE4(w, r0, r1, r2, r3, unpacklo32, unpackhi32, unpacklo64, unpackhi64) { \
+		t0 = unpacklo32((r0), (r1)); \
+		t1 = unpacklo32((r2), (r3)); \
+		t2 = unpackhi32((r0), (r1)); \
+		t3 = unpackhi32((r2), (r3)); \
+		(w)[0] = unpacklo64(t0, t1); \
+		(w)[1] = unpackhi64(t0, t1); \
+		(w)[2] = unpacklo64(t2, t3); \
+		(w)[3] = unpackhi64(t2, t3); \
+	}
+
+static SSE_TARGET inline void sha1_mb_load_sse(__m128i w[16], const uint8_t* const data[4]) {
+	const __m128i bswap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+	__m128i r[4], t0, t1, t2, t3;
+	int i, j;
+
+	for (i = 0; i < 4; ++i) {
+		for (j = 0; j < 4; ++j)
+			r[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data[j] + 16 * i)), bswap);
+
+		SHA1_TRANSPOSE4(w + 4 * i, r[0], r[1], r[2], r[3], _mm_unpacklo_epi32, _mm_unpackhi_epi32, _mm_unpacklo_epi64, _mm_unpackhi_epi64);
+	}
+}
+
+#define M_VEC __m128i
+#define M_LANES 4
+#define M_FN(name) name##_sse
+#define M_TARGET SSE_TARGET
+#define M_LOAD_BLOCK sha1_mb_load_sse
+#define M_LOADU(p) _mm_loadu_si128((const __m128i*)(p))
+#define M_STOREU(p, x) _mm_storeu_si128((__m128i*)(p), (x))
+#define M_SET1(k) _mm_set1_epi32((int)(k))
+#define M_ADD32 _mm_add_epi32
+#define M_XOR _mm_xor_si128
+#define M_AND _mm_and_si128
+#define M_OR _mm_or_si128
+#define M_SLLI32 _mm_slli_epi32
+#define M_SRLI32 _mm_srli_epi32
+#define M_LEAVE()
+
+#include "sha1_mb_core.h"
+
+#undef M_LEAVE
+#undef M_SRLI32
+#undef M_SLLI32
+#undef M_OR
+#undef M_AND
+#undef M_XOR
+#undef M_ADD32
+#undef M_SET1
+#undef M_STOREU
+#undef M_LOADU
+#undef M_LOAD_BLOCK
+#undef M_TARGET
+#undef M_FN
+#undef M_LANES
+#undef M_VEC
+
+static int ssse3_supported(void) {
+	return cpu_has(CPU_FEATURE_SSSE3);
+}
+
+const struct sha1_backend_t sha1_backend_ssse3 = {
+	.name = "ssse3",
+	.supported = ssse3_supported,
+	.max_lanes = 4,
+	.blocks_lanes = sha1_mb_blocks_lanes_sse,
+};
+
+//-----------------------------------------------------------------------------
+// AVX2, eight messages side by side
+//-----------------------------------------------------------------------------
+
+//
+// Lanes 0-3 go to the low and lanes 4-7 to the high 128-bit half, each half
+// is then transposed like the SSE version
+//
+static AVX2_TARGET inline void sha1_mb_load_avx2(__m256i w[16], const uint8_t* const data[8]) {
+	const __m256i bswap = _mm256_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL, 0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+	__m256i r[4], t0, t1, t2, t3;
+	int i, j;
+
+	for (i = 0; i < 4; ++i) {
+		for (j = 0; j < 4; ++j) {
+			r[j] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(data[j] + 16 * i))), _mm_loadu_si128((const __m128i*)(data[j + 4] + 16 * i)), 1);
+			r[j] = _mm256_shuffle_epi8(r[j], bswap);
+		}
+
+		SHA1_TRANSPOSE4(w + 4 * i, r[0], r[1], r[2], r[3], _mm256_unpacklo_epi32, _mm256_unpackhi_epi32, _mm256_unpacklo_epi64, _mm256_unpackhi_epi64);
+	}
+}
+
+#define M_VEC __m256i
+#define M_LANES 8
+#define M_FN(name) name##_avx2
+#define M_TARGET AVX2_TARGET
+#define M_LOAD_BLOCK sha1_mb_load_avx2
+#define M_LOADU(p) _mm256_loadu_si256((const __m256i*)(p))
+#define M_STOREU(p, x) _mm256_storeu_si256((__m256i*)(p), (x))
+#define M_SET1(k) _mm256_set1_epi32((int)(k))
+#define M_ADD32 _mm256_add_epi32
+#define M_XOR _mm256_xor_si256
+#define M_AND _mm256_and_si256
+#define M_OR _mm256_or_si256
+#define M_SLLI32 _mm256_slli_epi32
+#define M_SRLI32 _mm256_srli_epi32
+#define M_LEAVE() _mm256_zeroupper()
+
+#include "sha1_mb_core.h"
+
+#undef M_LEAVE
+#undef M_SRLI32
+#undef M_SLLI32
+#undef M_OR
+#undef M_AND
+#undef M_XOR
+#undef M_ADD32
+#undef M_SET1
+#undef M_STOREU
+#undef M_LOADU
+#undef M_LOAD_BLOCK
+#undef M_TARGET
+#undef M_FN
+#undef M_LANES
+#undef M_VEC
+
+static int avx2_supported(void) {
+	return cpu_has(CPU_FEATURE_AVX2 | CPU_FEATURE_SSSE3);
+}
+
+const struct sha1_backend_t sha1_backend_avx2 = {
+	.name = "avx2",
+	.supported = avx2_supported,
+	.max_lanes = 8,
+	.blocks_lanes = sha1_mb_blocks_lanes_avx2,
+};
+
+#else
+
+static int simd_supported(void) {
+	return 0;
+}
+
+const struct sha1_backend_t sha1_backend_ssse3 = {
+	.name = "ssse3",
+	.supported = simd_supported,
+};
+
+const struct sha1_backend_t sha1_backend_avx2 = {
+	.name = "avx2",
+	.supported = simd_supported,
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "common.h"
 #include "keys.h"
 #include "crypto.h"
+#include "key_schedules.h"
 #include "sv_command.h"
 #include "sv_send0_command.h"
 #include "sv_send2_command.h"
@@ -11,6 +12,29 @@
 #include "sv_getver_command.h"
 #include "sv_auth.h"
 
+struct sv_auth_keys_t sv_auth_keys;
+
+static void set_fix_keys(const unsigned char *fix1, const unsigned char *fix2, const struct aes_key_t *fix1_key, const struct aes_key_t *fix2_key)
+{
+	memcpy(sv_auth.fix1, fix1, 0x10);
+	memcpy(sv_auth.fix2, fix2, 0x10);
+	sv_auth_keys.fix1 = fix1_key;
+	sv_auth_keys.fix2 = fix2_key;
+}
+
+int sv_auth_prepare_session_keys()
+{
+	if (aes_key_init(&sv_auth_keys.ks1, sv_auth.ks1, 128) != 0)
+		return -1;
+
+	if (aes_key_init(&sv_auth_keys.ks2, sv_auth.ks2, 128) != 0)
+		return -1;
+
+	if (des3_set2key_enc(&sv_auth_keys.ks1_des3, sv_auth.ks1) != 0)
+		return -1;
+
+	return 0;
+}
 
 int authenticate_common(unsigned int auth_mode, unsigned int allow_retry)
 {
@@ -23,6 +47,9 @@ int authenticate_common(unsigned int auth_mode, unsigned int allow_retry)
 	if (memcmp(sv_auth.fix2, zeroes, 0x10) == 0)
 		return -1;
 
+	if (sv_auth_keys.fix1 == NULL || sv_auth_keys.fix2 == NULL)
+		return -1;
+
 	//send0
 	sv_send0_command_set();
 
@@ -66,8 +93,13 @@ int authenticate_common(unsigned int auth_mode, unsigned int allow_retry)
 int auth_drive_super()
 {
 	unsigned int auth_mode, allow_retry;
-	memcpy(sv_auth.fix1, sv_auth.kf1_eid, 0x10);
-	memcpy(sv_auth.fix2, sv_auth.kf2_eid, 0x10);
+	if (aes_key_init(&sv_auth_keys.fix1_eid, sv_auth.kf1_eid, 128) != 0)
+		return -1;
+
+	if (aes_key_init(&sv_auth_keys.fix2_eid, sv_auth.kf2_eid, 128) != 0)
+		return -1;
+
+	set_fix_keys(sv_auth.kf1_eid, sv_auth.kf2_eid, &sv_auth_keys.fix1_eid, &sv_auth_keys.fix2_eid);
 
 	if(sv_auth.m_retry_flag == RETRY_FLAG_ALLOW)
 	{
@@ -83,15 +115,13 @@ int auth_drive_super()
 	int result = authenticate_common(auth_mode, allow_retry);
 	if (result == -8)
 	{
-		memcpy(sv_auth.fix1, fix1_it, 0x10);
-		memcpy(sv_auth.fix2, fix2_it, 0x10);
+		set_fix_keys(fix1_it, fix2_it, &fix1_it_key, &fix2_it_key);
 		auth_mode = AUTH_MODE_SUPER;
 		allow_retry = ALLOW_RETRY_YES;
 		result = authenticate_common(auth_mode, allow_retry);
 		if (result == -8)
 		{
-			memcpy(sv_auth.fix1, fix1_pn, 0x10);
-			memcpy(sv_auth.fix2, fix2_pn, 0x10);
+			set_fix_keys(fix1_pn, fix2_pn, &fix1_pn_key, &fix2_pn_key);
 			auth_mode = AUTH_MODE_SUPER;
 			allow_retry = ALLOW_RETRY_NO;
 			result = authenticate_common(auth_mode, allow_retry);
@@ -106,28 +136,23 @@ int auth_drive_user()
 	switch (sv_auth.m_mode)
 	{
 		case 0:
-			memcpy(sv_auth.fix1, Kf1_u0, 0x10);
-			memcpy(sv_auth.fix2, Kf2_u0, 0x10);
+			set_fix_keys(Kf1_u0, Kf2_u0, &Kf1_u0_key, &Kf2_u0_key);
 			break;
 		case 1:
-			memcpy(sv_auth.fix1, Kf1_u1, 0x10);
-			memcpy(sv_auth.fix2, Kf2_u1, 0x10);
+			set_fix_keys(Kf1_u1, Kf2_u1, &Kf1_u1_key, &Kf2_u1_key);
 			break;
 		case 2:
 		case 12:
-			memcpy(sv_auth.fix1, Kf1_u2, 0x10);
-			memcpy(sv_auth.fix2, Kf2_u2, 0x10);
+			set_fix_keys(Kf1_u2, Kf2_u2, &Kf1_u2_key, &Kf2_u2_key);
 			break;
 		case 3:
 		case 13:
 		case 14:
-			memcpy(sv_auth.fix1, Kf1_u3, 0x10);
-			memcpy(sv_auth.fix2, Kf2_u3, 0x10);
+			set_fix_keys(Kf1_u3, Kf2_u3, &Kf1_u3_key, &Kf2_u3_key);
 			break;
 		case 4:
 		case 20:
-			memcpy(sv_auth.fix1, Kf1_u4, 0x10);
-			memcpy(sv_auth.fix2, Kf2_u4, 0x10);
+			set_fix_keys(Kf1_u4, Kf2_u4, &Kf1_u4_key, &Kf2_u4_key);
 			break;
 		default:
 			return -15;
@@ -177,7 +202,7 @@ int set_contents_key(unsigned char *wm3_data1, unsigned char *contents_key, unsi
 	}
 	else
 	{
-		if (aes_encrypt_cbc(Kh, 128, IVh, wm3_data1, contents_key, 0x10) != 0)		
+		if (aes_key_encrypt_cbc(&Kh_key, IVh, wm3_data1, contents_key, 0x10) != 0)		
 			return -3;
 
 		dm = PS3_DISC_RELEASE_MODE;
@@ -189,7 +214,7 @@ int set_contents_key(unsigned char *wm3_data1, unsigned char *contents_key, unsi
 
 int  set_misc_wm(unsigned char *wm3_data2, unsigned char *misc_wm)
 {
-	if (aes_decrypt_cbc(Kwm, 128, giv, wm3_data2, misc_wm, 0x10) != 0)
+	if (aes_key_decrypt_cbc(&Kwm_key, giv, wm3_data2, misc_wm, 0x10) != 0)
 		return -3;
 
 	return 0;
@@ -226,7 +251,7 @@ int get_disc_id(unsigned char *misc_wm, unsigned char *disc_id)
 	unsigned char buf[0x10] = {0};
 	memcpy(buf + 0xB, misc_wm + 0xB, 5);
 
-	if (aes_encrypt_cbc(Kdid, 128, zero_iv, buf, disc_id, 0x10) != 0)		
+	if (aes_key_encrypt_cbc(&Kdid_key, zero_iv, buf, disc_id, 0x10) != 0)		
 		return -3;
 
 	return 0;
@@ -1,6 +1,8 @@
 #ifndef __SV_AUTH_H__
 #define __SV_AUTH_H__
 
+#include "crypto.h"
+
 struct __attribute__ ((packed)) sv_auth_t
 {
 	unsigned int m_mode;
@@ -18,6 +20,23 @@ struct __attribute__ ((packed)) sv_auth_t
 
 struct sv_auth_t sv_auth;
 
+//prepared keys of the current session, expanded once per key
+//fix1/fix2 point either to a pre-expanded constant key or to the eid keys
+struct sv_auth_keys_t
+{
+	const struct aes_key_t *fix1;
+	const struct aes_key_t *fix2;
+	struct aes_key_t fix1_eid;
+	struct aes_key_t fix2_eid;
+	struct aes_key_t ks1;
+	struct aes_key_t ks2;
+	des3_context ks1_des3; //encrypts the secure command cdbs
+};
+
+extern struct sv_auth_keys_t sv_auth_keys;
+
+int sv_auth_prepare_session_keys();
+
 #endif
 
 
@@ -1,7 +1,7 @@
 #include "common.h"
 #include "sv_command.h"
+#include "crypto.h"
 #include <sys/ioctl.h>
-#include <scsi/sg.h>
 #include <scsi/scsi_ioctl.h>
 
 unsigned char generate_check_code(const unsigned char *data, int len)
@@ -16,100 +16,306 @@ unsigned char generate_check_code(const unsigned char *data, int len)
 
 void generate_rnd(unsigned char *dest, int size)
 {
-    unsigned char *buffer = (uint8_t*)malloc(size);
-//	srand((unsigned int)time(0));  // random fail fix, srand must be initialized at main function
+	// a command must never go out with a predictable nonce
+	if (generate_random_bytes(dest, (uint32_t)size) != 0)
+	{
+		fprintf(stderr, "generate_rnd: no system entropy available\n");
+		abort();
+	}
+}
+
+//command descriptors indexed by operation code, pkt_len 0 marks an unsupported opcode
+//only read-only commands are resent after a host timeout or reset, the drive
+//may already have run the others (SEND KEY / REPORT KEY advance the handshake)
+const struct atp_io_params_t atp_io_params[0x100] = {
+	[0xA1] = {0xC, 0, 0, 600000, 0, 0},  // BLANK
+	[0x5B] = {0xC, 0, 0, 120000, 0, 0},  // CLOSE TRACK/SESSION
+	[0x35] = {0xC, 0, 0, 120000, 0, 0},  // SYNCHRONIZE CACHE
+	[0x04] = {0xC, 1, 1, 600000, 0, 0},  // FORMAT UNIT
+	[0x46] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // GET CONFIGURATION
+	[0x4A] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // GET EVENT STATUS NOTIFICATION
+	[0xAC] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // GET PERFORMANCE
+	[0x12] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // INQUIRY
+	[0xA6] = {0xC, 0, 0, 60000, 0, 0},  // LOAD/UNLOAD MEDIUM
+	[0xBD] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // MECHANISM STATUS
+	[0x55] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // MODE SELECT (10)
+	[0x5A] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // MODE SENSE (10)
+	[0x4B] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // PAUSE/RESUME
+	[0x45] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // PLAY AUDIO(10)
+	[0x47] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // PLAY AUDIO MSF
+	[0x48] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},
+	[0xBC] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},
+	[0x1E] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // PREVENT ALLOW MEDIUM REMOVAL
+	[0x28] = {0xC, 3, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ (10)
+	[0xA8] = {0xC, 3, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ (12)
+	[0x25] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 8, 1},  // READ CAPACITY
+	[0xBE] = {0xC, 3, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ CD
+	[0xB9] = {0xC, 3, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ CD MSF
+	[0x51] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ DISC INFORMATION
+	[0xAD] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ DISC STRUCTURE
+	[0x23] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ FORMAT CAPACITIES
+	[0x44] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ HEADER
+	[0x52] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ TRACK INFORMATION
+	[0x42] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ SUBCHANNEL
+	[0x43] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ TOC/PMA/ATIP
+	[0x58] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // REPAIR TRACK
+	[0xA4] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // REPORT KEY
+	[0x03] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // REQUEST SENSE
+	[0x53] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // RESERVE TRACK
+	[0xBA] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SCAN
+	[0x2B] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // SEEK (10)
+	[0xBF] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SEND DISC STRUCTURE
+	[0xA2] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SECURITY PROTOCOL IN
+	[0xA3] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SEND KEY
+	[0x54] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SEND OPC INFORMATION
+	[0xA7] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SET READ AHEAD
+	[0xB6] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SET STREAMING
+	[0x1B] = {0xC, 0, 0, 60000, 0, 0},  // START STOP UNIT
+	[0x4E] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // STOP PLAY/SCAN
+	[0x00] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // TEST UNIT READY
+	[0x2F] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // VERIFY (10)
+	[0x2A] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // WRITE (10)
+	[0xAA] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // WRITE (12)
+	[0x2E] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // WRITE AND VERIFY (10)
+	[0xBB] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SET CD SPEED
+	[0xDA] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},
+	[0xF6] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},
+	[0xF9] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},
+	[0x3B] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // WRITE BUFFER
+	[0x3C] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // READ BUFFER
+	[0xD7] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // d7_cmd_sacd
+	[0xA5] = {0xC, 0, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},
+	[0x4C] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // LOG SELECT
+	[0x4D] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 1},  // LOG SENSE
+	[0xE0] = {0xC, 1, 1, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SECURE REPORT
+	[0xE1] = {0xC, 2, 0, ATP_IO_DEFAULT_TIMEOUT, 0, 0},  // SECURE SEND
+};
+
+int sv_command_prepare_io_hdr(struct sg_io_hdr *io_hdr, unsigned char *packet, unsigned char *sense, unsigned char sense_len)
+{
+	unsigned char opcode = packet[0x14];
+	unsigned short spu_cmd_size = (packet[0x12] * 0x100) + (packet[0x13]);
 
-	int i;
-	for(i = 0; i < size; i++)
-      buffer[i] = (unsigned char)(rand() & 0xFF);
+	//packet len, atp protocol, direction and timeout by operation code
+	const struct atp_io_params_t *params = &atp_io_params[opcode];
+	if (params->pkt_len == 0)
+		return -1;
 
-	memcpy(dest, buffer, size);
+	//fprintf(stdout, "opcode: 0x%02X pkt_len: 0x%02X , atp_proto: 0x%02X , direction: 0x%02X , spu_cmd_size: 0x%02X\n", opcode, params->pkt_len, params->atp_proto, params->direction, spu_cmd_size);
 
-	free (buffer);
+	memset(io_hdr, 0, sizeof(*io_hdr));
+	io_hdr->interface_id = 'S';
+	if (params->direction == 0)
+		io_hdr->dxfer_direction = SG_DXFER_TO_DEV;
+	
+	if (params->direction == 1)
+		io_hdr->dxfer_direction = SG_DXFER_FROM_DEV;
+
+	io_hdr->timeout = params->timeout;
+	io_hdr->cmdp = (void*)(packet + 0x14);
+	io_hdr->cmd_len = params->pkt_len;
+	io_hdr->dxferp = (void*)(packet + 0x24);
+	//a fixed reply length only applies when the packet leaves less room for the data
+	unsigned int packet_len = spu_cmd_size > 0x10 ? (unsigned int)spu_cmd_size - 0x10 : 0;
+	io_hdr->dxfer_len = params->data_len > packet_len ? params->data_len : packet_len;
+	io_hdr->sbp = sense;
+	io_hdr->mx_sb_len = sense_len;
+	return 0;
 }
 
-int get_atp_io_params_by_opcode(struct atp_io_params_t *params, unsigned char opcode)
+void sv_sense_decode(const unsigned char *sense, unsigned int len, struct sv_sense_t *decoded)
 {
-	unsigned char atp_io_params[62][4] = {
-		{0xA1, 0xC, 0, 0},  // BLANK
-		{0x5B, 0xC, 0, 0},  // CLOSE TRACK/SESSION
-		{0x35, 0xC, 0, 0},  // SYNCHRONIZE CACHE
-		{0x04, 0xC, 1, 1},  // FORMAT UNIT
-		{0x46, 0xC, 1, 1},  // GET CONFIGURATION
-		{0x4A, 0xC, 1, 1},  // GET EVENT STATUS NOTIFICATION
-		{0xAC, 0xC, 1, 1},  // GET PERFORMANCE
-		{0x12, 0xC, 1, 1},  // INQUIRY
-		{0xA6, 0xC, 0, 0},  // LOAD/UNLOAD MEDIUM
-		{0xBD, 0xC, 1, 1},  // MECHANISM STATUS
-		{0x55, 0xC, 2, 0},  // MODE SELECT (10)
-		{0x5A, 0xC, 1, 1},  // MODE SENSE (10)
-		{0x4B, 0xC, 0, 0},  // PAUSE/RESUME
-		{0x45, 0xC, 0, 0},  // PLAY AUDIO(10)
-		{0x47, 0xC, 0, 0},  // PLAY AUDIO MSF
-		{0x48, 0xC, 0, 0},  //
-		{0xBC, 0xC, 0, 0},  //
-		{0x1E, 0xC, 0, 0},  // PREVENT ALLOW MEDIUM REMOVAL
-		{0x28, 0xC, 3, 1},  // READ (10)
-		{0xA8, 0xC, 3, 1},  // READ (12)
-		{0x25, 0xC, 1, 1},  // READ CAPACITY
-		{0xBE, 0xC, 3, 1},  // READ CD
-		{0xB9, 0xC, 3, 1},  // READ CD MSF
-		{0x51, 0xC, 1, 1},  // READ DISC INFORMATION
-		{0xAD, 0xC, 1, 1},  // READ DISC STRUCTURE
-		{0x23, 0xC, 1, 1},  // READ FORMAT CAPACITIES
-		{0x44, 0xC, 0, 0},  // READ HEADER
-		{0x52, 0xC, 1, 1},  // READ TRACK INFORMATION
-		{0x42, 0xC, 1, 1},  // READ SUBCHANNEL
-		{0x43, 0xC, 1, 1},  // READ TOC/PMA/ATIP
-		{0x58, 0xC, 0, 0},  // REPAIR TRACK
-		{0xA4, 0xC, 1, 1},  // REPORT KEY
-		{0x03, 0xC, 1, 1},  // REQUEST SENSE
-		{0x53, 0xC, 0, 0},  // RESERVE TRACK
-		{0xBA, 0xC, 0, 0},  // SCAN
-		{0x2B, 0xC, 0, 0},  // SEEK (10)
-		{0xBF, 0xC, 2, 0},  // SEND DISC STRUCTURE
-		{0xA2, 0xC, 0, 0},  // SECURITY PROTOCOL IN
-		{0xA3, 0xC, 2, 0},  // SEND KEY
-		{0x54, 0xC, 2, 0},  // SEND OPC INFORMATION
-		{0xA7, 0xC, 0, 0},  // SET READ AHEAD
-		{0xB6, 0xC, 2, 0},  // SET STREAMING
-		{0x1B, 0xC, 0, 0},  // START STOP UNIT
-		{0x4E, 0xC, 0, 0},  // STOP PLAY/SCAN
-		{0x00, 0xC, 0, 0},  // TEST UNIT READY
-		{0x2F, 0xC, 0, 0},  // VERIFY (10)
-		{0x2A, 0xC, 2, 0},  // WRITE (10)
-		{0xAA, 0xC, 2, 0},  // WRITE (12)
-		{0x2E, 0xC, 2, 0},  // WRITE AND VERIFY (10)
-		{0xBB, 0xC, 0, 0},  // SET CD SPEED
-		{0x48, 0xC, 0, 0},  // 
-		{0xDA, 0xC, 0, 0},  // 
-		{0xF6, 0xC, 0, 0},  // 
-		{0xF9, 0xC, 0, 0},  // 
-		{0x3B, 0xC, 2, 0},  // WRITE BUFFER
-		{0x3C, 0xC, 1, 1},  // READ BUFFER
-		{0xD7, 0xC, 1, 1},  // d7_cmd_sacd
-		{0xA5, 0xC, 0, 0},  // 
-		{0x4C, 0xC, 2, 0},  // LOG SELECT
-		{0x4D, 0xC, 1, 1},  // LOG SENSE
-		{0xE0, 0xC, 1, 1},  // SECURE REPORT
-		{0xE1, 0xC, 2, 0},  // SECURE SEND
-	};
-	
-	//find entry
-	int f;
-	for (f = 0; f < 62; f++)
+	memset(decoded, 0, sizeof(*decoded));
+	if (len < 2)
+		return;
+
+	switch (sense[0] & 0x7F)
+	{
+		case 0x70:
+		case 0x71:
+			if (len < 3)
+				return;
+
+			decoded->key = sense[2] & 0xF;
+			if (len >= 14 && sense[7] >= 6)
+			{
+				decoded->asc = sense[12];
+				decoded->ascq = sense[13];
+			}
+			break;
+		case 0x72:
+		case 0x73:
+			decoded->key = sense[1] & 0xF;
+			if (len >= 4)
+			{
+				decoded->asc = sense[2];
+				decoded->ascq = sense[3];
+			}
+			break;
+		default:
+			decoded->error = SENSE_ERR_FATAL;
+			return;
+	}
+
+	switch (decoded->key)
+	{
+		case 0x0:  //NO SENSE
+		case 0x1:  //RECOVERED ERROR
+			decoded->error = SENSE_ERR_NONE;
+			break;
+		case 0x2:  //NOT READY
+			if (decoded->asc == 0x04 && (decoded->ascq == 0x01 || decoded->ascq == 0x07))
+				decoded->error = SENSE_ERR_BECOMING_READY;
+			else
+				decoded->error = SENSE_ERR_NOT_READY;
+			break;
+		case 0x3:  //MEDIUM ERROR
+			if (decoded->asc == 0x11 || decoded->asc == 0x15)
+				decoded->error = SENSE_ERR_MEDIUM_TRANSIENT;
+			else
+				decoded->error = SENSE_ERR_FATAL;
+			break;
+		case 0x6:  //UNIT ATTENTION
+			if (decoded->asc == 0x28 || decoded->asc == 0x29)
+				decoded->error = SENSE_ERR_RESET;
+			else
+				decoded->error = SENSE_ERR_UNIT_ATTENTION;
+			break;
+		default:
+			decoded->error = SENSE_ERR_FATAL;
+			break;
+	}
+}
+
+//SG_IO with the v3 sg_io_hdr, served by sr and sg devices
+static int sv_transport_sg_execute(struct sv_transport_t *transport, unsigned char *packet)
+{
+	struct sg_io_hdr *io_hdr = &transport->io_hdr;
+	if (sv_command_prepare_io_hdr(io_hdr, packet, transport->sense, sizeof(transport->sense)) != 0)
+		return -1;
+
+	transport->sense_len = 0;
+	transport->host_status = 0;
+	if (ioctl(transport->fd, SG_IO, io_hdr) != 0)
+		return (-1);
+
+	//a timeout or reset leaves status 0 and only shows in the host and driver status
+	if (io_hdr->status || io_hdr->host_status || io_hdr->driver_status) {
+		transport->sense_len = io_hdr->sb_len_wr;
+		transport->host_status = (unsigned char)io_hdr->host_status;
+		fprintf(stderr, "status %d host status %d driver status %d\n", io_hdr->status, io_hdr->host_status, io_hdr->driver_status);
+		return (-1);
+	}
+
+	return 0;
+}
+
+//SG_IO with the v4 sg_io_v4 of the block SCSI generic driver (/dev/bsg/H:C:T:L)
+static int sv_transport_bsg_execute(struct sv_transport_t *transport, unsigned char *packet)
+{
+	struct sg_io_hdr *io_hdr = &transport->io_hdr;
+	struct sg_io_v4 *io_v4 = &transport->io_v4;
+	if (sv_command_prepare_io_hdr(io_hdr, packet, transport->sense, sizeof(transport->sense)) != 0)
+		return -1;
+
+	memset(io_v4, 0, sizeof(*io_v4));
+	io_v4->guard = 'Q';
+	io_v4->protocol = BSG_PROTOCOL_SCSI;
+	io_v4->subprotocol = BSG_SUB_PROTOCOL_SCSI_CMD;
+	io_v4->request = (uintptr_t)io_hdr->cmdp;
+	io_v4->request_len = io_hdr->cmd_len;
+	io_v4->response = (uintptr_t)io_hdr->sbp;
+	io_v4->max_response_len = io_hdr->mx_sb_len;
+	io_v4->timeout = io_hdr->timeout;
+
+	if (io_hdr->dxfer_direction == SG_DXFER_TO_DEV)
+	{
+		io_v4->dout_xferp = (uintptr_t)io_hdr->dxferp;
+		io_v4->dout_xfer_len = io_hdr->dxfer_len;
+	}
+	else if (io_hdr->dxfer_direction == SG_DXFER_FROM_DEV)
+	{
+		io_v4->din_xferp = (uintptr_t)io_hdr->dxferp;
+		io_v4->din_xfer_len = io_hdr->dxfer_len;
+	}
+
+	transport->sense_len = 0;
+	transport->host_status = 0;
+	if (ioctl(transport->fd, SG_IO, io_v4) != 0)
+		return (-1);
+
+	if (io_v4->device_status || io_v4->transport_status || io_v4->driver_status) {
+		transport->sense_len = io_v4->response_len;
+		transport->host_status = (unsigned char)io_v4->transport_status;
+		fprintf(stderr, "status %d host status %d driver status %d\n", io_v4->device_status, io_v4->transport_status, io_v4->driver_status);
+		return (-1);
+	}
+
+	return 0;
+}
+
+static const struct sv_transport_backend_t sv_transport_bsg = {
+	.name = "bsg",
+	.prefix = "/dev/bsg/",
+	.execute = sv_transport_bsg_execute,
+};
+
+static const struct sv_transport_backend_t sv_transport_sg = {
+	.name = "sg",
+	.prefix = NULL,
+	.execute = sv_transport_sg_execute,
+};
+
+//first match wins
+static const struct sv_transport_backend_t *const sv_transport_backends[] = {
+	&sv_transport_bsg,
+	&sv_transport_sg,
+};
+
+#define SV_RETRY_MAX 6
+#define SV_RETRY_DELAY_MS 100  //doubled after every wait, 3.1 s in total
+
+struct sv_transport_t sv_transport = { .fd = -1 };
+
+int sv_transport_open(const char *device)
+{
+	if (sv_transport.fd >= 0)
+		return 0;
+
+	int fd = open(device, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+	{
+		fprintf(stderr, "sv_transport_open :: cannot open %s: %s\n", device, strerror(errno));
+		return -1;
+	}
+
+	memset(&sv_transport, 0, sizeof(sv_transport));
+	sv_transport.fd = fd;
+	sv_transport.device = device;
+
+	size_t i;
+	for (i = 0; i < sizeof(sv_transport_backends) / sizeof(sv_transport_backends[0]); i++)
 	{
-		if ((unsigned char)(atp_io_params[f][0]) == opcode)
+		const char *prefix = sv_transport_backends[i]->prefix;
+		if (prefix == NULL || strncmp(device, prefix, strlen(prefix)) == 0)
 		{
-			params->pkt_len = atp_io_params[f][1];
-			params->atp_proto = atp_io_params[f][2];
-			params->direction = atp_io_params[f][3];
-			return 0;
+			sv_transport.backend = sv_transport_backends[i];
+			break;
 		}
 	}
-	return -1;
+
+	return 0;
 }
 
+void sv_transport_close()
+{
+	if (sv_transport.fd < 0)
+		return;
+
+	close(sv_transport.fd);
+	memset(&sv_transport, 0, sizeof(sv_transport));
+	sv_transport.fd = -1;
+}
 
 int sendrecv()
 {
@@ -117,58 +323,48 @@ int sendrecv()
 //	int *command_size = (int*)(packet_buffer);
 //	fprintf(stdout, "Data put:\n");
 //	dump_data(packet_buffer, *command_size + 0x10);
-	
-	
-	int rbd = open("/dev/sr0", O_RDWR | O_NONBLOCK);
-	struct sg_io_hdr io_hdr;
-	if (rbd < 0)
-		return -1;
 
-	memset(&io_hdr, 0, sizeof(io_hdr));
-	struct atp_io_params_t *atp_io_params = malloc(sizeof(struct atp_io_params_t));
-	unsigned char opcode = packet_buffer[0x14];
-	unsigned short spu_cmd_size = (packet_buffer[0x12] * 0x100) + (packet_buffer[0x13]);
-	unsigned char sense[32];
-
-	//geting packet len, atp protocol and direction by operation code
-	if (get_atp_io_params_by_opcode(atp_io_params, opcode) != 0)
+	//callers that did not open a session get the default drive until sv_transport_close()
+	if (sv_transport.fd < 0 && sv_transport_open(SV_TRANSPORT_DEFAULT_DEVICE) != 0)
 		return -1;
 
-	//fprintf(stdout, "opcode: 0x%02X pkt_len: 0x%02X , atp_proto: 0x%02X , direction: 0x%02X , spu_cmd_size: 0x%02X\n", opcode, atp_io_params->pkt_len, atp_io_params->atp_proto, atp_io_params->direction, spu_cmd_size);
-
-	io_hdr.interface_id = 'S';
-	if (atp_io_params->direction == 0)
-		io_hdr.dxfer_direction = SG_DXFER_TO_DEV;
-	
-	if (atp_io_params->direction == 1)
-		io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
-
-	io_hdr.timeout = 20000;
-	io_hdr.cmdp = (void*)(packet_buffer + 0x14);
-	io_hdr.cmd_len = atp_io_params->pkt_len;
-	io_hdr.dxferp = (void*)(packet_buffer + 0x24);
-	io_hdr.dxfer_len = spu_cmd_size - 0x10;
-	io_hdr.sbp = sense;
-	io_hdr.mx_sb_len = sizeof(sense);
-	
-	if (ioctl(rbd, SG_IO, &io_hdr) != 0)
+	//a check condition means the drive did not run the command, so those
+	//transient conditions are retried with the same packet. A host timeout or
+	//reset leaves that open and is only retried for read-only commands, the
+	//others fail so the caller restarts the handshake
+	struct sv_sense_t sense;
+	unsigned int attempt, delay_ms = SV_RETRY_DELAY_MS;
+	for (attempt = 0; ; attempt++)
 	{
-		close(rbd);
-		return (-1);
-	}
+		if (sv_transport.backend->execute(&sv_transport, packet_buffer) == 0)
+			break;
 
-	close(rbd);
+		sv_sense_decode(sv_transport.sense, sv_transport.sense_len, &sense);
+		if (sense.error != SENSE_ERR_NONE)
+			fprintf(stderr, "sendrecv :: sense key 0x%X asc 0x%02X ascq 0x%02X\n", sense.key, sense.asc, sense.ascq);
+		else if ((sv_transport.host_status == SV_DID_TIME_OUT || sv_transport.host_status == SV_DID_RESET) && atp_io_params[packet_buffer[0x14]].retry)
+			sense.error = SENSE_ERR_HOST_TRANSIENT;
 
-	if (io_hdr.status) {
-		fprintf(stderr, "status %d host status %d driver status %d\n", io_hdr.status, io_hdr.host_status, io_hdr.driver_status);
-		return (-1);
+		if (sense.error != SENSE_ERR_UNIT_ATTENTION && sense.error != SENSE_ERR_BECOMING_READY && sense.error != SENSE_ERR_MEDIUM_TRANSIENT && sense.error != SENSE_ERR_HOST_TRANSIENT)
+			return -1;
+
+		if (attempt + 1 >= SV_RETRY_MAX)
+			return -1;
+
+		//a unit attention is consumed by reporting it, resend at once
+		if (sense.error != SENSE_ERR_UNIT_ATTENTION)
+		{
+			struct timespec ts = { delay_ms / 1000, (delay_ms % 1000) * 1000000L };
+			nanosleep(&ts, NULL);
+			delay_ms *= 2;
+		}
 	}
 
 	// print command
 //	fprintf(stdout, "Data get:\n");
 //	dump_data(packet_buffer, *command_size + 0x10);
 
-//	dump_data(io_hdr.cmdp, io_hdr.cmd_len);
-//	dump_data(io_hdr.dxferp, io_hdr.dxfer_len);
+//	dump_data(sv_transport.io_hdr.cmdp, sv_transport.io_hdr.cmd_len);
+//	dump_data(sv_transport.io_hdr.dxferp, sv_transport.io_hdr.dxfer_len);
 	return 0;
-}
\ No newline at end of file
+}
@@ -1,3 +1,6 @@
+#include <scsi/sg.h>
+#include <linux/bsg.h>
+
 
 enum {
 	ENC_CMD_USERDATA = 0,
@@ -6,12 +9,19 @@ enum {
 	ENC_CMD_GETVER = 4,
 };
 
+#define ATP_IO_DEFAULT_TIMEOUT 20000
+
 struct  __attribute__ ((packed)) atp_io_params_t {
 	unsigned char pkt_len;
 	unsigned char atp_proto;
 	unsigned char direction;
+	unsigned int timeout;   //ms
+	unsigned int data_len;  //fixed reply length, used when the packet gives less, 0 if none
+	unsigned char retry;    //1 if resending after a host timeout or reset is safe
 };
 
+extern const struct atp_io_params_t atp_io_params[0x100];
+
 struct __attribute__ ((packed)) sce_send_key_cdb_t
 {
 	unsigned char operation_code;
@@ -49,4 +59,64 @@ unsigned char generate_check_code(const unsigned char *data, int len);
 
 void generate_rnd(unsigned char *dest, int size);
 
+#define SV_TRANSPORT_DEFAULT_DEVICE "/dev/sr0"
+
+//host_status of sg_io_hdr and transport_status of sg_io_v4, as in the kernel's scsi.h
+#define SV_DID_TIME_OUT 0x03
+#define SV_DID_RESET 0x08
+
+struct sv_transport_t;
+
+//how sendrecv() talks to the drive, picked by sv_transport_open() from the device path
+struct sv_transport_backend_t {
+	const char *name;
+	const char *prefix;  //device paths served by this backend, NULL matches any
+	int (*execute)(struct sv_transport_t *transport, unsigned char *packet);
+};
+
+//drive handle of the current session: the device stays open from
+//sv_transport_open() to sv_transport_close() and every sendrecv()
+//reuses the same request headers and sense block
+struct sv_transport_t {
+	int fd;
+	const char *device;
+	const struct sv_transport_backend_t *backend;
+	struct sg_io_hdr io_hdr;
+	struct sg_io_v4 io_v4;  //bsg only, built from io_hdr
+	unsigned char sense[32];
+	unsigned char sense_len;  //valid sense bytes of the last failed command
+	unsigned char host_status;  //adapter status of the last failed command, SV_DID_*
+};
+
+extern struct sv_transport_t sv_transport;
+
+int sv_transport_open(const char *device);
+
+void sv_transport_close();
+
+//what a failed command's sense data means for the session
+enum {
+	SENSE_ERR_NONE = 0,          //no sense data, nothing to decode
+	SENSE_ERR_UNIT_ATTENTION,    //drive state notice, the command can be resent at once
+	SENSE_ERR_BECOMING_READY,    //spin-up or operation in progress, resend after a wait
+	SENSE_ERR_MEDIUM_TRANSIENT,  //read/positioning error that may clear on a retry
+	SENSE_ERR_HOST_TRANSIENT,    //adapter timeout or bus reset on a command marked retry, resend after a wait
+	SENSE_ERR_RESET,             //power on, reset or medium change: the drive lost the session
+	SENSE_ERR_NOT_READY,         //no medium or otherwise not usable
+	SENSE_ERR_FATAL,             //anything else
+};
+
+struct sv_sense_t {
+	unsigned char key;
+	unsigned char asc;
+	unsigned char ascq;
+	int error;  //SENSE_ERR_*
+};
+
+//decodes fixed (0x70/0x71) and descriptor (0x72/0x73) format sense data
+void sv_sense_decode(const unsigned char *sense, unsigned int len, struct sv_sense_t *decoded);
+
+//fills io_hdr for the command in packet (laid out like packet_buffer), -1 for an unknown opcode
+int sv_command_prepare_io_hdr(struct sg_io_hdr *io_hdr, unsigned char *packet, unsigned char *sense, unsigned char sense_len);
+
 int sendrecv();
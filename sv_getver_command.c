@@ -30,7 +30,7 @@ int sv_getver_command_set()
 	encrypted_cdb[0] = ENC_CMD_GETVER;
 	generate_rnd (encrypted_cdb + 6, 1);
 	encrypted_cdb[7] = generate_check_code (encrypted_cdb, 7);
-	if (des3_encrypt_cbc(sv_auth.ks1, ivs_3des, encrypted_cdb, getver_cmd_buf + 0x18, 8) != 0)
+	if (des3_key_encrypt_cbc(&sv_auth_keys.ks1_des3, ivs_3des, encrypted_cdb, getver_cmd_buf + 0x18, 8) != 0)
 		return -3;
 
 	//copy command buffer to "shared LS"
@@ -43,7 +43,7 @@ int sv_getver_check_recved_data(unsigned char *version)
 	unsigned char version_buf[0x50] = {0};
 	memcpy(version_buf, packet_buffer + 0x28, 0x50);
 
-	if (aes_decrypt_cbc(sv_auth.ks1, 128, ivs_aes, version_buf, version_buf, 0x50) != 0)
+	if (aes_key_decrypt_cbc(&sv_auth_keys.ks1, ivs_aes, version_buf, version_buf, 0x50) != 0)
 		return -15;
 
 	//verify check code
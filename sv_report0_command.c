@@ -66,7 +66,7 @@ int sv_report0_command_check_recved_data()
 	memcpy(enc_rand1, packet_buffer + 0x28, 0x10);
 
 	//Decrypt sv_auth::m_rand1 from the drive
-	aes_decrypt_cbc(sv_auth.fix2, 128, giv, enc_rand1, dec_rand1, 0x10);
+	aes_key_decrypt_cbc(sv_auth_keys.fix2, giv, enc_rand1, dec_rand1, 0x10);
 
 	//Check sv_auth::m_rand1
 	if (memcmp(dec_rand1, sv_auth.m_rand1, 0x10) != 0)
@@ -76,7 +76,7 @@ int sv_report0_command_check_recved_data()
 	memcpy(enc_rand2, packet_buffer + 0x38, 0x10);
 
 	//Decrypt and set sv_auth::m_rand2 from the drive to host
-	aes_decrypt_cbc(sv_auth.fix2, 128, giv, enc_rand2, sv_auth.m_rand2, 0x10);
+	aes_key_decrypt_cbc(sv_auth_keys.fix2, giv, enc_rand2, sv_auth.m_rand2, 0x10);
 
 	//Check rands, they must not be same
 	if  (memcmp(sv_auth.m_rand1, sv_auth.m_rand2, 0x10) == 0)
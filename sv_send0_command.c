@@ -58,7 +58,7 @@ int sv_send0_command_set()
 	args->data_len[1] = 0x10;
 
 	//encrypt m_rand1 using fix1 as aes key and set the result into the param list
-	if(aes_encrypt_cbc(sv_auth.fix1, 128, giv, sv_auth.m_rand1, args->data, 0x10) != 0)
+	if(aes_key_encrypt_cbc(sv_auth_keys.fix1, giv, sv_auth.m_rand1, args->data, 0x10) != 0)
 		return -3;
 
 	//copy command buffer to "shared LS"
@@ -1,6 +1,7 @@
 #include "common.h"
 #include "keys.h"
 #include "crypto.h"
+#include "key_schedules.h"
 #include "sv_auth.h"
 #include "sv_command.h"
 #include "sv_send2_command.h"
@@ -56,7 +57,7 @@ int sv_send2_command_set()
 	args->data_len[1] = 0x10;
 
 	//encrypt m_rand2 using fix1 as aes key and set the result into the param list
-	if(aes_encrypt_cbc(sv_auth.fix1, 128, giv, sv_auth.m_rand2, args->data, 0x10) != 0)
+	if(aes_key_encrypt_cbc(sv_auth_keys.fix1, giv, sv_auth.m_rand2, args->data, 0x10) != 0)
 		return -3;
 
 	//copy command buffer to "shared LS"
@@ -76,12 +77,25 @@ int sv_send2_command_check_recved_data()
 	memcpy(session_key2_buf, sv_auth.m_rand1 + 8, 8);
 	memcpy(session_key2_buf + 8, sv_auth.m_rand2, 8);
 
-	//encrypt session key1 using kms1 key
-	if (aes_encrypt_cbc(kms1, 128, giv, session_key1_buf, sv_auth.ks1, 0x10) != 0)
+	//encrypt session key1 using kms1 key and session key2 using kms2 key in one pass
+	struct aes_cbc_lane_t lanes[2];
+	lanes[0].ctx = &kms1_key.enc;
+	memcpy(lanes[0].iv, giv, 0x10);
+	lanes[0].input = session_key1_buf;
+	lanes[0].output = sv_auth.ks1;
+	lanes[0].length = 0x10;
+
+	lanes[1].ctx = &kms2_key.enc;
+	memcpy(lanes[1].iv, giv, 0x10);
+	lanes[1].input = session_key2_buf;
+	lanes[1].output = sv_auth.ks2;
+	lanes[1].length = 0x10;
+
+	if (aes_crypt_cbc_multi(lanes, 2) != 0)
 		return -3;
 
-	//encrypt session key2 using kms2 key
-	if (aes_encrypt_cbc(kms2, 128, giv, session_key2_buf, sv_auth.ks2, 0x10) != 0)
+	//expand session keys once for the rest of the session
+	if (sv_auth_prepare_session_keys() != 0)
 		return -3;
 
 	return 0;
@@ -30,7 +30,7 @@ int sv_udata_command_set()
 	encrypted_cdb[0] = ENC_CMD_USERDATA;
 	generate_rnd (encrypted_cdb + 6, 1);
 	encrypted_cdb[7] = generate_check_code (encrypted_cdb, 7);
-	if (des3_encrypt_cbc(sv_auth.ks1, ivs_3des, encrypted_cdb, udata_cmd_buf + 0x18, 8) != 0)
+	if (des3_key_encrypt_cbc(&sv_auth_keys.ks1_des3, ivs_3des, encrypted_cdb, udata_cmd_buf + 0x18, 8) != 0)
 		return -15;
 	
 	unsigned char encrypted_arg[0x50] = {0};  //must be encrypted with session key (ks1)
@@ -66,7 +66,7 @@ int sv_udata_command_set()
 	generate_rnd(encrypted_arg + 1, 1);
 	encrypted_arg[0] = generate_check_code(encrypted_arg + 1, 0x4F);
 
-	if (aes_encrypt_cbc(sv_auth.ks1, 128, ivs_aes, encrypted_arg, udata_cmd_buf + 0x28, 0x50) != 0)
+	if (aes_key_encrypt_cbc(&sv_auth_keys.ks1, ivs_aes, encrypted_arg, udata_cmd_buf + 0x28, 0x50) != 0)
 		return -11;
 
 	unsigned char plain_arg[4] = {0};
@@ -1,6 +1,7 @@
 #include "common.h"
 #include "keys.h"
 #include "crypto.h"
+#include "key_schedules.h"
 #include "sv_auth.h"
 #include "sv_command.h"
 #include "sv_wm2_command.h"
@@ -39,7 +40,7 @@ int sv_wm2_command_set(unsigned char layer, unsigned char area, unsigned int lba
 	encrypted_cdb[5] = (area & 0xF)|(layer << 4);  //MSB 4bits layer, 4bits area LSB
 	generate_rnd (encrypted_cdb + 6, 1);
 	encrypted_cdb[7] = generate_check_code (encrypted_cdb, 7);
-	if (des3_encrypt_cbc(sv_auth.ks1, ivs_3des, encrypted_cdb, wm2_cmd_buf + 0x18, 8) != 0)
+	if (des3_key_encrypt_cbc(&sv_auth_keys.ks1_des3, ivs_3des, encrypted_cdb, wm2_cmd_buf + 0x18, 8) != 0)
 		return -3;
 
 	//copy command buffer to "shared LS"
@@ -54,7 +55,7 @@ int sv_wm2_command_check_recved_data(unsigned char *buf1, unsigned char *buf2)
 	memcpy(wm2_buf, packet_buffer + 0x28, 0x40);
 	
 	//remove session key1 encryption layer
-	if (aes_decrypt_cbc(sv_auth.ks1, 128, ivs_aes, wm2_buf, wm2_buf, 0x40) != 0)
+	if (aes_key_decrypt_cbc(&sv_auth_keys.ks1, ivs_aes, wm2_buf, wm2_buf, 0x40) != 0)
 		return -15;
 	
 	//verify check code
@@ -63,22 +64,22 @@ int sv_wm2_command_check_recved_data(unsigned char *buf1, unsigned char *buf2)
 		return -16;
 
 	//remove session key2 encryption layer
-	if (aes_decrypt_cbc(sv_auth.ks2, 128, ivs_aes, wm2_buf + 3, wm2_buf + 3, 0x10) != 0)
+	if (aes_key_decrypt_cbc(&sv_auth_keys.ks2, ivs_aes, wm2_buf + 3, wm2_buf + 3, 0x10) != 0)
 		return -17;
 
-	if (aes_decrypt_cbc(sv_auth.ks2, 128, ivs_aes, wm2_buf + 0x13, wm2_buf + 0x13, 0x10) != 0)
+	if (aes_key_decrypt_cbc(&sv_auth_keys.ks2, ivs_aes, wm2_buf + 0x13, wm2_buf + 0x13, 0x10) != 0)
 		return -18;
 	
-	if (aes_decrypt_cbc(sv_auth.ks2, 128, ivs_aes, wm2_buf + 0x23, wm2_buf + 0x23, 0x10) != 0)
+	if (aes_key_decrypt_cbc(&sv_auth_keys.ks2, ivs_aes, wm2_buf + 0x23, wm2_buf + 0x23, 0x10) != 0)
 		return -19;
 
-	if (aes_decrypt_cbc(Kwm, 128, giv, wm2_buf + 3, wm2_buf + 3, 0x10) != 0)
+	if (aes_key_decrypt_cbc(&Kwm_key, giv, wm2_buf + 3, wm2_buf + 3, 0x10) != 0)
 		return -17;
 	
-	if (aes_decrypt_cbc(Kwm, 128, giv, wm2_buf + 0x13, wm2_buf + 0x13, 0x10) != 0)
+	if (aes_key_decrypt_cbc(&Kwm_key, giv, wm2_buf + 0x13, wm2_buf + 0x13, 0x10) != 0)
 		return -18;
 
-	if (aes_decrypt_cbc(Kwm, 128, giv, wm2_buf + 0x23, wm2_buf + 0x23, 0x10) != 0)
+	if (aes_key_decrypt_cbc(&Kwm_key, giv, wm2_buf + 0x23, wm2_buf + 0x23, 0x10) != 0)
 		return -19;
 	
 	
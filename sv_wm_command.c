@@ -33,7 +33,7 @@ int sv_wm_command_set()
 	encrypted_cdb[0] = ENC_CMD_PS3DISC;
 	generate_rnd (encrypted_cdb + 6, 1);
 	encrypted_cdb[7] = generate_check_code (encrypted_cdb, 7);
-	if (des3_encrypt_cbc(sv_auth.ks1, ivs_3des, encrypted_cdb, wm_cmd_buf + 0x18, 8) != 0)
+	if (des3_key_encrypt_cbc(&sv_auth_keys.ks1_des3, ivs_3des, encrypted_cdb, wm_cmd_buf + 0x18, 8) != 0)
 		return -3;
 
 	//copy command buffer to "shared LS"
@@ -48,7 +48,7 @@ int sv_wm_command_check_recved_data(unsigned char *wm)
 	memcpy(wm_buf, packet_buffer + 0x28, 0x30);
 
 	//remove session key1 encryption layer
-	if (aes_decrypt_cbc(sv_auth.ks1, 128, ivs_aes, wm_buf, wm_buf, 0x30) != 0)
+	if (aes_key_decrypt_cbc(&sv_auth_keys.ks1, ivs_aes, wm_buf, wm_buf, 0x30) != 0)
 		return -3;
 
 	//verify check code
@@ -57,10 +57,10 @@ int sv_wm_command_check_recved_data(unsigned char *wm)
 		return -1;
 
 	//remove session key2 encryption layer
-	if (aes_decrypt_cbc(sv_auth.ks2, 128, ivs_aes, wm_buf + 3, wm_buf + 3, 0x10) != 0)
+	if (aes_key_decrypt_cbc(&sv_auth_keys.ks2, ivs_aes, wm_buf + 3, wm_buf + 3, 0x10) != 0)
 		return -3;
 
-	if (aes_decrypt_cbc(sv_auth.ks2, 128, ivs_aes, wm_buf + 0x13, wm_buf + 0x13, 0x10) != 0)
+	if (aes_key_decrypt_cbc(&sv_auth_keys.ks2, ivs_aes, wm_buf + 0x13, wm_buf + 0x13, 0x10) != 0)
 		return -3;
 
 	memcpy(wm, wm_buf, 0x30);